@@ -205,6 +205,12 @@ static inline void set_cr(unsigned int val)
 extern void adjust_cr(unsigned long mask, unsigned long set);
 #endif
 
+/*
+ * Nonzero when the kernel may use unaligned LDR/STR/LDRH/STRH, i.e. on
+ * ARMv6 and later with alignment faults off. See arch/arm/kernel/setup.c.
+ */
+extern int cpu_unaligned_access_ok(void);
+
 #define CPACC_FULL(n)		(3 << (n * 2))
 #define CPACC_SVC(n)		(1 << (n * 2))
 #define CPACC_DISABLE(n)	(0 << (n * 2))
@@ -244,6 +244,19 @@ int cpu_architecture(void)
 	return cpu_arch;
 }
 
+/*
+ * ARMv6 and later perform unaligned LDR/STR/LDRH/STRH in hardware once
+ * alignment faults are turned off, as alignment_init() does on boot.
+ * LDRD/STRD/LDM/STM still need aligned addresses. Exported so modular
+ * users such as the lz4/lzo "wide" decompressors can check at runtime
+ * without reaching for cr_alignment themselves.
+ */
+int cpu_unaligned_access_ok(void)
+{
+	return cpu_architecture() >= CPU_ARCH_ARMv6 && !(cr_alignment & CR_A);
+}
+EXPORT_SYMBOL_GPL(cpu_unaligned_access_ok);
+
 static int cpu_has_aliasing_icache(unsigned int arch)
 {
 	int aliasing_icache;
@@ -135,6 +135,14 @@ struct blkio_cgroup *task_blkio_cgroup(struct task_struct *tsk)
 }
 EXPORT_SYMBOL_GPL(task_blkio_cgroup);
 
+static inline bool blkio_policy_owns(struct blkio_policy_type *blkiop,
+				     struct blkio_group *blkg)
+{
+	if (blkiop->plid != blkg->plid)
+		return false;
+	return !blkg->owner || blkg->owner == blkiop;
+}
+
 static inline void
 blkio_update_group_weight(struct blkio_group *blkg, unsigned int weight)
 {
@@ -142,7 +150,7 @@ blkio_update_group_weight(struct blkio_group *blkg, unsigned int weight)
 
 	list_for_each_entry(blkiop, &blkio_list, list) {
 		/* If this policy does not own the blkg, do not send updates */
-		if (blkiop->plid != blkg->plid)
+		if (!blkio_policy_owns(blkiop, blkg))
 			continue;
 		if (blkiop->ops.blkio_update_group_weight_fn)
 			blkiop->ops.blkio_update_group_weight_fn(blkg->key,
@@ -158,7 +166,7 @@ static inline void blkio_update_group_bps(struct blkio_group *blkg, u64 bps,
 	list_for_each_entry(blkiop, &blkio_list, list) {
 
 		/* If this policy does not own the blkg, do not send updates */
-		if (blkiop->plid != blkg->plid)
+		if (!blkio_policy_owns(blkiop, blkg))
 			continue;
 
 		if (fileid == BLKIO_THROTL_read_bps_device
@@ -181,7 +189,7 @@ static inline void blkio_update_group_iops(struct blkio_group *blkg,
 	list_for_each_entry(blkiop, &blkio_list, list) {
 
 		/* If this policy does not own the blkg, do not send updates */
-		if (blkiop->plid != blkg->plid)
+		if (!blkio_policy_owns(blkiop, blkg))
 			continue;
 
 		if (fileid == BLKIO_THROTL_read_iops_device
@@ -1599,7 +1607,7 @@ static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 		 */
 		spin_lock(&blkio_list_lock);
 		list_for_each_entry(blkiop, &blkio_list, list) {
-			if (blkiop->plid != blkg->plid)
+			if (!blkio_policy_owns(blkiop, blkg))
 				continue;
 			blkiop->ops.blkio_unlink_group_fn(key, blkg);
 		}
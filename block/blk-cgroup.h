@@ -171,6 +171,12 @@ struct blkio_group {
 	dev_t dev;
 	/* policy which owns this blk group */
 	enum blkio_policy_id plid;
+	/*
+	 * Policy instance which created this group. Needed when more than
+	 * one policy registers with the same plid (e.g. cfq and fiops).
+	 * NULL means any policy with a matching plid.
+	 */
+	struct blkio_policy_type *owner;
 
 	/* Need to serialize the stats in the case of reset/update */
 	spinlock_t stats_lock;
@@ -210,6 +210,52 @@ static void blk_delay_work(struct work_struct *work)
 	spin_unlock_irq(q->queue_lock);
 }
 
+#ifdef CONFIG_BLK_CPU_STAGING
+static void blk_stage_work(struct work_struct *work)
+{
+	struct request_queue *q =
+		container_of(work, struct request_queue, stage_work);
+
+	blk_flush_cpu_stages(q);
+}
+
+static int blk_init_cpu_stages(struct request_queue *q)
+{
+	int cpu;
+
+	q->cpu_stage = alloc_percpu(struct blk_cpu_stage);
+	if (!q->cpu_stage)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_cpu_stage *stage = per_cpu_ptr(q->cpu_stage, cpu);
+
+		spin_lock_init(&stage->lock);
+		INIT_LIST_HEAD(&stage->list);
+		stage->count = 0;
+	}
+	INIT_WORK(&q->stage_work, blk_stage_work);
+	q->stage_batch = BLK_STAGE_BATCH;
+
+	return 0;
+}
+
+static void blk_exit_cpu_stages(struct request_queue *q)
+{
+	free_percpu(q->cpu_stage);
+	q->cpu_stage = NULL;
+}
+#else
+static inline int blk_init_cpu_stages(struct request_queue *q)
+{
+	return 0;
+}
+
+static inline void blk_exit_cpu_stages(struct request_queue *q)
+{
+}
+#endif
+
 /**
  * blk_delay_queue - restart queueing after defined interval
  * @q:		The &struct request_queue in question
@@ -288,6 +334,10 @@ void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
 	cancel_delayed_work_sync(&q->delay_work);
+#ifdef CONFIG_BLK_CPU_STAGING
+	cancel_work_sync(&q->stage_work);
+	blk_flush_cpu_stages(q);
+#endif
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -377,6 +427,7 @@ void blk_drain_queue(struct request_queue *q, bool drain_all)
 		bool drain = false;
 		int i;
 
+		blk_flush_cpu_stages(q);
 		spin_lock_irq(q->queue_lock);
 
 		elv_drain_elevator(q);
@@ -511,9 +562,15 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	if (err)
 		goto fail_id;
 
-	if (blk_throtl_init(q))
+	if (blk_init_cpu_stages(q))
 		goto fail_id;
 
+	if (blk_lat_hist_init(q))
+		goto fail_stages;
+
+	if (blk_throtl_init(q))
+		goto fail_lat_hist;
+
 	setup_timer(&q->backing_dev_info.laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
 	setup_timer(&q->timeout, blk_rq_timed_out_timer, (unsigned long) q);
@@ -537,6 +594,10 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 
 	return q;
 
+fail_lat_hist:
+	blk_lat_hist_exit(q);
+fail_stages:
+	blk_exit_cpu_stages(q);
 fail_id:
 	ida_simple_remove(&blk_queue_ida, q->id);
 fail_q:
@@ -1374,6 +1435,128 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_BLK_CPU_STAGING
+/*
+ * Per-CPU request staging. Requests from submitters that are not plugged
+ * would otherwise each take @q->queue_lock once more to be added to the
+ * elevator and run the queue. With QUEUE_FLAG_CPU_STAGING they are kept
+ * on a list of the submitting CPU instead, where later bios can merge
+ * into them without the queue lock, and go to the elevator together when
+ * stage_batch of them have accumulated, a sync request arrives, or from
+ * kblockd shortly after. The per-CPU lock is only contended by that
+ * flush. It is taken with interrupts off, since bios may be submitted
+ * from completion context.
+ *
+ * Plugged submitters, which covers most filesystem and direct I/O,
+ * already batch on their plug and never reach the stages.
+ */
+static bool attempt_stage_merge(struct request_queue *q, struct bio *bio)
+{
+	struct blk_cpu_stage *stage;
+	struct request *rq;
+	unsigned long flags;
+	bool ret = false;
+
+	stage = per_cpu_ptr(q->cpu_stage, raw_smp_processor_id());
+	spin_lock_irqsave(&stage->lock, flags);
+	list_for_each_entry_reverse(rq, &stage->list, queuelist) {
+		int el_ret;
+
+		if (!blk_rq_merge_ok(rq, bio))
+			continue;
+
+		el_ret = blk_try_merge(rq, bio);
+		if (el_ret == ELEVATOR_BACK_MERGE) {
+			ret = bio_attempt_back_merge(q, rq, bio);
+			if (ret)
+				break;
+		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
+			ret = bio_attempt_front_merge(q, rq, bio);
+			if (ret)
+				break;
+		}
+	}
+	spin_unlock_irqrestore(&stage->lock, flags);
+
+	return ret;
+}
+
+static void blk_flush_cpu_stage(struct request_queue *q,
+				struct blk_cpu_stage *stage)
+{
+	struct request *rq;
+	unsigned long flags;
+	LIST_HEAD(list);
+	u64 start;
+
+	spin_lock_irqsave(&stage->lock, flags);
+	list_splice_init(&stage->list, &list);
+	stage->count = 0;
+	spin_unlock_irqrestore(&stage->lock, flags);
+
+	if (list_empty(&list))
+		return;
+
+	start = blk_queue_lock_irq(q);
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+
+		if (unlikely(blk_queue_dead(q))) {
+			__blk_end_request_all(rq, -ENODEV);
+			continue;
+		}
+		__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+	}
+	if (likely(!blk_queue_dead(q)))
+		__blk_run_queue(q);
+	blk_queue_unlock_irq(q, start);
+}
+
+void blk_flush_cpu_stages(struct request_queue *q)
+{
+	int cpu;
+
+	if (!q->cpu_stage)
+		return;
+
+	for_each_possible_cpu(cpu)
+		blk_flush_cpu_stage(q, per_cpu_ptr(q->cpu_stage, cpu));
+}
+
+static void blk_stage_request(struct request_queue *q, struct request *req,
+			      bool sync)
+{
+	struct blk_cpu_stage *stage;
+	unsigned long flags;
+	bool flush;
+
+	drive_stat_acct(req, 1);
+
+	stage = per_cpu_ptr(q->cpu_stage, raw_smp_processor_id());
+	spin_lock_irqsave(&stage->lock, flags);
+	list_add_tail(&req->queuelist, &stage->list);
+	flush = sync || ++stage->count >= q->stage_batch;
+	spin_unlock_irqrestore(&stage->lock, flags);
+
+	if (flush)
+		blk_flush_cpu_stage(q, stage);
+	else
+		kblockd_schedule_work(q, &q->stage_work);
+}
+#else
+static inline bool attempt_stage_merge(struct request_queue *q,
+				       struct bio *bio)
+{
+	return false;
+}
+
+static inline void blk_stage_request(struct request_queue *q,
+				     struct request *req, bool sync)
+{
+}
+#endif /* CONFIG_BLK_CPU_STAGING */
+
 void init_request_from_bio(struct request *req, struct bio *bio)
 {
 	req->cmd_type = REQ_TYPE_FS;
@@ -1395,6 +1578,8 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
 	struct request *req;
 	unsigned int request_count = 0;
+	bool staged = false;
+	u64 start;
 
 	/*
 	 * low level driver can indicate that it wants pages above a
@@ -1404,7 +1589,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	blk_queue_bounce(q, &bio);
 
 	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
-		spin_lock_irq(q->queue_lock);
+		start = blk_queue_lock_irq(q);
 		where = ELEVATOR_INSERT_FLUSH;
 		goto get_rq;
 	}
@@ -1416,7 +1601,12 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	if (attempt_plug_merge(q, bio, &request_count))
 		return;
 
-	spin_lock_irq(q->queue_lock);
+	/* Or with the requests staged on this CPU */
+	staged = !current->plug && blk_queue_cpu_staging(q);
+	if (staged && attempt_stage_merge(q, bio))
+		return;
+
+	start = blk_queue_lock_irq(q);
 
 	el_ret = elv_merge(q, &req, bio);
 	if (el_ret == ELEVATOR_BACK_MERGE) {
@@ -1449,9 +1639,11 @@ get_rq:
 	 * Grab a free request. This is might sleep but can not fail.
 	 * Returns with the queue unlocked.
 	 */
+	blk_queue_lock_release(q, start);
 	req = get_request_wait(q, rw_flags, bio);
 	if (unlikely(!req)) {
 		bio_endio(bio, -ENODEV);	/* @q is dead */
+		start = 0;
 		goto out_unlock;
 	}
 
@@ -1490,12 +1682,14 @@ get_rq:
 		}
 		list_add_tail(&req->queuelist, &plug->list);
 		drive_stat_acct(req, 1);
+	} else if (staged) {
+		blk_stage_request(q, req, sync);
 	} else {
-		spin_lock_irq(q->queue_lock);
+		start = blk_queue_lock_irq(q);
 		add_acct_request(q, req, where);
 		__blk_run_queue(q);
 out_unlock:
-		spin_unlock_irq(q->queue_lock);
+		blk_queue_unlock_irq(q, start);
 	}
 }
 EXPORT_SYMBOL_GPL(blk_queue_bio);	/* for device mapper only */
@@ -2090,6 +2284,8 @@ void blk_dequeue_request(struct request *rq)
 		q->in_flight[rq_is_sync(rq)]++;
 		set_io_start_time_ns(rq);
 	}
+	if (rq->cmd_flags & REQ_SORTED)
+		blk_lat_dispatch(rq);
 }
 
 /**
@@ -2381,6 +2577,8 @@ static void blk_finish_request(struct request *req, int error)
 
 
 	blk_account_io_done(req);
+	if (req->cmd_flags & REQ_SORTED)
+		blk_lat_complete(req);
 
 	if (req->end_io)
 		req->end_io(req, error);
@@ -2831,7 +3029,7 @@ EXPORT_SYMBOL(blk_start_plug);
  * plugger did not intend it.
  */
 static void queue_unplugged(struct request_queue *q, unsigned int depth,
-			    bool from_schedule)
+			    bool from_schedule, u64 start)
 	__releases(q->queue_lock)
 {
 	trace_block_unplug(q, depth, !from_schedule);
@@ -2840,6 +3038,7 @@ static void queue_unplugged(struct request_queue *q, unsigned int depth,
 	 * Don't mess with dead queue.
 	 */
 	if (unlikely(blk_queue_dead(q))) {
+		blk_queue_lock_release(q, start);
 		spin_unlock(q->queue_lock);
 		return;
 	}
@@ -2850,10 +3049,12 @@ static void queue_unplugged(struct request_queue *q, unsigned int depth,
 	 * this lock).
 	 */
 	if (from_schedule) {
+		blk_queue_lock_release(q, start);
 		spin_unlock(q->queue_lock);
 		blk_run_queue_async(q);
 	} else {
 		__blk_run_queue(q);
+		blk_queue_lock_release(q, start);
 		spin_unlock(q->queue_lock);
 	}
 
@@ -2884,6 +3085,7 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	struct request *rq;
 	LIST_HEAD(list);
 	unsigned int depth;
+	u64 start = 0;
 
 	BUG_ON(plug->magic != PLUG_MAGIC);
 
@@ -2910,10 +3112,11 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 			 * This drops the queue lock
 			 */
 			if (q)
-				queue_unplugged(q, depth, from_schedule);
+				queue_unplugged(q, depth, from_schedule,
+						start);
 			q = rq->q;
 			depth = 0;
-			spin_lock(q->queue_lock);
+			start = blk_queue_lock(q);
 		}
 
 		/*
@@ -2939,7 +3142,7 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	 * This drops the queue lock
 	 */
 	if (q)
-		queue_unplugged(q, depth, from_schedule);
+		queue_unplugged(q, depth, from_schedule, start);
 
 	local_irq_restore(flags);
 }
@@ -0,0 +1,142 @@
+/*
+ * Request latency histograms, independent of the I/O scheduler.
+ *
+ * Two intervals are measured for every request that goes through the
+ * elevator: from insertion into the scheduler to the driver fetching it
+ * ("dispatch"), and from there to completion. Each one is accounted in a
+ * per-CPU log2 histogram of usecs, split by sync/async and read/write, and
+ * the sum over all CPUs is shown in /sys/block/<dev>/queue/latency_hist.
+ * Writing to that file clears the histograms.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+
+#include "blk.h"
+
+static const char * const blk_lat_phase_name[] = {
+	[BLK_LAT_INSERT]	= "insert_to_dispatch",
+	[BLK_LAT_DISPATCH]	= "dispatch_to_complete",
+};
+
+static inline u64 blk_lat_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+/* Called with the queue lock held, so interrupts are off */
+static void blk_lat_account(struct request *rq, int phase, u64 start)
+{
+	struct blk_lat_hist *hist = this_cpu_ptr(rq->q->lat_hist);
+	u64 us = div_u64(blk_lat_now() - start, NSEC_PER_USEC);
+	int bucket = us ? min(fls64(us) - 1, BLK_LAT_BUCKETS - 1) : 0;
+
+	hist->buckets[phase][rq_is_sync(rq)][rq_data_dir(rq)][bucket]++;
+}
+
+void blk_lat_insert(struct request *rq)
+{
+	/* requeued requests keep their original insertion time */
+	if (!rq->lat_insert_ns)
+		rq->lat_insert_ns = blk_lat_now();
+}
+
+void blk_lat_dispatch(struct request *rq)
+{
+	if (!rq->q->lat_hist)
+		return;
+
+	if (rq->lat_insert_ns && !rq->lat_dispatch_ns)
+		blk_lat_account(rq, BLK_LAT_INSERT, rq->lat_insert_ns);
+	rq->lat_dispatch_ns = blk_lat_now();
+}
+
+void blk_lat_complete(struct request *rq)
+{
+	if (!rq->q->lat_hist || !rq->lat_dispatch_ns)
+		return;
+
+	blk_lat_account(rq, BLK_LAT_DISPATCH, rq->lat_dispatch_ns);
+}
+
+int blk_lat_hist_init(struct request_queue *q)
+{
+	q->lat_hist = alloc_percpu(struct blk_lat_hist);
+	if (!q->lat_hist)
+		return -ENOMEM;
+	return 0;
+}
+
+void blk_lat_hist_exit(struct request_queue *q)
+{
+	free_percpu(q->lat_hist);
+	q->lat_hist = NULL;
+}
+
+ssize_t blk_lat_hist_show(struct request_queue *q, char *page)
+{
+	struct blk_lat_hist *sum;
+	ssize_t len;
+	int cpu, phase, sync, dir, i, last;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_lat_hist *hist = per_cpu_ptr(q->lat_hist, cpu);
+
+		for (phase = 0; phase < BLK_LAT_PHASES; phase++)
+			for (sync = 0; sync < 2; sync++)
+				for (dir = 0; dir < 2; dir++)
+					for (i = 0; i < BLK_LAT_BUCKETS; i++)
+						sum->buckets[phase][sync][dir][i] +=
+						hist->buckets[phase][sync][dir][i];
+	}
+
+	len = snprintf(page, PAGE_SIZE,
+		       "# bucket n counts latencies of [2^n, 2^(n+1)) usec\n");
+	for (phase = 0; phase < BLK_LAT_PHASES; phase++) {
+		for (sync = 1; sync >= 0; sync--) {
+			for (dir = 0; dir < 2; dir++) {
+				u32 *b = sum->buckets[phase][sync][dir];
+
+				/* trailing empty buckets are not shown */
+				for (last = BLK_LAT_BUCKETS - 1; last > 0; last--)
+					if (b[last])
+						break;
+
+				len += snprintf(page + len, PAGE_SIZE - len,
+						"%s %s %s:",
+						blk_lat_phase_name[phase],
+						sync ? "sync" : "async",
+						dir == READ ? "read" : "write");
+				for (i = 0; i <= last; i++)
+					len += snprintf(page + len,
+							PAGE_SIZE - len,
+							" %u", b[i]);
+				len += snprintf(page + len, PAGE_SIZE - len,
+						"\n");
+			}
+		}
+	}
+
+	kfree(sum);
+	return len;
+}
+
+ssize_t blk_lat_hist_store(struct request_queue *q, const char *page,
+			   size_t count)
+{
+	int cpu;
+
+	spin_lock_irq(q->queue_lock);
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(q->lat_hist, cpu), 0,
+		       sizeof(struct blk_lat_hist));
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
@@ -296,6 +296,90 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+#ifdef CONFIG_BLK_CPU_STAGING
+static ssize_t queue_cpu_staging_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_cpu_staging(q), page);
+}
+
+static ssize_t
+queue_cpu_staging_store(struct request_queue *q, const char *page,
+			size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	if (ret < 0)
+		return ret;
+
+	/* only request based queues go through blk_queue_bio() */
+	if (!q->request_fn)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	if (val)
+		queue_flag_set(QUEUE_FLAG_CPU_STAGING, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_CPU_STAGING, q);
+	spin_unlock_irq(q->queue_lock);
+
+	if (!val)
+		blk_flush_cpu_stages(q);
+
+	return ret;
+}
+
+static ssize_t queue_stage_batch_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(q->stage_batch, page);
+}
+
+static ssize_t
+queue_stage_batch_store(struct request_queue *q, const char *page,
+			size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	if (ret < 0)
+		return ret;
+	if (!val)
+		return -EINVAL;
+
+	q->stage_batch = val;
+	return ret;
+}
+
+static ssize_t queue_lock_stats_show(struct request_queue *q, char *page)
+{
+	struct blk_queue_lock_stats stats;
+
+	spin_lock_irq(q->queue_lock);
+	stats = q->lock_stats;
+	spin_unlock_irq(q->queue_lock);
+
+	return sprintf(page, "acquired %llu\ncontended %llu\n"
+		       "hold_ns %llu\nhold_ns_max %llu\n",
+		       stats.acquired, stats.contended,
+		       stats.hold_ns, stats.hold_ns_max);
+}
+
+static ssize_t
+queue_lock_stats_store(struct request_queue *q, const char *page,
+		       size_t count)
+{
+	/* any write resets the counters */
+	spin_lock_irq(q->queue_lock);
+	q->lock_stats.acquired = 0;
+	q->lock_stats.contended = 0;
+	q->lock_stats.hold_ns = 0;
+	q->lock_stats.hold_ns_max = 0;
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -410,6 +494,34 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_CPU_STAGING
+static struct queue_sysfs_entry queue_cpu_staging_entry = {
+	.attr = {.name = "cpu_staging", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_cpu_staging_show,
+	.store = queue_cpu_staging_store,
+};
+
+static struct queue_sysfs_entry queue_stage_batch_entry = {
+	.attr = {.name = "stage_batch", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_stage_batch_show,
+	.store = queue_stage_batch_store,
+};
+
+static struct queue_sysfs_entry queue_lock_stats_entry = {
+	.attr = {.name = "lock_stats", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lock_stats_show,
+	.store = queue_lock_stats_store,
+};
+#endif
+
+#ifdef CONFIG_BLK_LATENCY_HIST
+static struct queue_sysfs_entry queue_latency_hist_entry = {
+	.attr = {.name = "latency_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = blk_lat_hist_show,
+	.store = blk_lat_hist_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -432,6 +544,14 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+#ifdef CONFIG_BLK_CPU_STAGING
+	&queue_cpu_staging_entry.attr,
+	&queue_stage_batch_entry.attr,
+	&queue_lock_stats_entry.attr,
+#endif
+#ifdef CONFIG_BLK_LATENCY_HIST
+	&queue_latency_hist_entry.attr,
+#endif
 	NULL,
 };
 
@@ -502,6 +622,11 @@ static void blk_release_queue(struct kobject *kobj)
 
 	blk_sync_queue(q);
 
+#ifdef CONFIG_BLK_CPU_STAGING
+	free_percpu(q->cpu_stage);
+#endif
+	blk_lat_hist_exit(q);
+
 	if (q->elevator) {
 		spin_lock_irq(q->queue_lock);
 		ioc_clear_queue(q);
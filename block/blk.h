@@ -29,6 +29,109 @@ void __blk_queue_free_tags(struct request_queue *q);
 bool __blk_end_bidi_request(struct request *rq, int error,
 			    unsigned int nr_bytes, unsigned int bidi_bytes);
 
+#ifdef CONFIG_BLK_CPU_STAGING
+/* Requests staged per CPU are added to the elevator this many at a time */
+#define BLK_STAGE_BATCH	8
+
+void blk_flush_cpu_stages(struct request_queue *q);
+
+/*
+ * queue_lock accounting for the submission path. The lock is tried first
+ * so that contention can be counted. blk_queue_lock() returns when the
+ * lock was taken and the caller hands that back to blk_queue_lock_release(),
+ * so a hold is only counted between an accounted acquire and release in
+ * the same path, whatever other users of queue_lock do in between. A start
+ * of 0 releases without counting. Both are called with interrupts off.
+ */
+static inline u64 blk_queue_lock(struct request_queue *q)
+{
+	if (!spin_trylock(q->queue_lock)) {
+		spin_lock(q->queue_lock);
+		q->lock_stats.contended++;
+	}
+	q->lock_stats.acquired++;
+	return local_clock();
+}
+
+static inline void blk_queue_lock_release(struct request_queue *q, u64 start)
+{
+	struct blk_queue_lock_stats *stats = &q->lock_stats;
+	u64 held;
+
+	if (!start)
+		return;
+
+	held = local_clock() - start;
+	stats->hold_ns += held;
+	if (held > stats->hold_ns_max)
+		stats->hold_ns_max = held;
+}
+
+static inline u64 blk_queue_lock_irq(struct request_queue *q)
+{
+	local_irq_disable();
+	return blk_queue_lock(q);
+}
+#else
+static inline void blk_flush_cpu_stages(struct request_queue *q)
+{
+}
+
+static inline void blk_queue_lock_release(struct request_queue *q, u64 start)
+{
+}
+
+static inline u64 blk_queue_lock(struct request_queue *q)
+{
+	spin_lock(q->queue_lock);
+	return 0;
+}
+
+static inline u64 blk_queue_lock_irq(struct request_queue *q)
+{
+	spin_lock_irq(q->queue_lock);
+	return 0;
+}
+#endif /* CONFIG_BLK_CPU_STAGING */
+
+static inline void blk_queue_unlock_irq(struct request_queue *q, u64 start)
+{
+	blk_queue_lock_release(q, start);
+	spin_unlock_irq(q->queue_lock);
+}
+
+#ifdef CONFIG_BLK_LATENCY_HIST
+void blk_lat_insert(struct request *rq);
+void blk_lat_dispatch(struct request *rq);
+void blk_lat_complete(struct request *rq);
+int blk_lat_hist_init(struct request_queue *q);
+void blk_lat_hist_exit(struct request_queue *q);
+ssize_t blk_lat_hist_show(struct request_queue *q, char *page);
+ssize_t blk_lat_hist_store(struct request_queue *q, const char *page,
+			   size_t count);
+#else
+static inline void blk_lat_insert(struct request *rq)
+{
+}
+
+static inline void blk_lat_dispatch(struct request *rq)
+{
+}
+
+static inline void blk_lat_complete(struct request *rq)
+{
+}
+
+static inline int blk_lat_hist_init(struct request_queue *q)
+{
+	return 0;
+}
+
+static inline void blk_lat_hist_exit(struct request_queue *q)
+{
+}
+#endif /* CONFIG_BLK_LATENCY_HIST */
+
 void blk_rq_timed_out_timer(unsigned long data);
 void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
@@ -1013,6 +1013,8 @@ static void cfq_group_served(struct cfq_data *cfqd, struct cfq_group *cfqg,
 }
 
 #ifdef CONFIG_CFQ_GROUP_IOSCHED
+static struct blkio_policy_type blkio_policy_cfq;
+
 static inline struct cfq_group *cfqg_of_blkg(struct blkio_group *blkg)
 {
 	if (blkg)
@@ -1040,6 +1042,7 @@ static void cfq_init_add_cfqg_lists(struct cfq_data *cfqd,
 	 * and minor info and this info will be filled in once a new thread
 	 * comes for IO.
 	 */
+	cfqg->blkg.owner = &blkio_policy_cfq;
 	if (bdi->dev) {
 		sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
 		cfq_blkiocg_add_blkio_group(blkcg, &cfqg->blkg,
@@ -3744,18 +3747,13 @@ static void *cfq_init_queue(struct request_queue *q)
 	cfqg->ref = 2;
 
 	if (blkio_alloc_blkg_stats(&cfqg->blkg)) {
-		kfree(cfqg);
-
-		spin_lock(&cic_index_lock);
-		ida_remove(&cic_index_ida, cfqd->cic_index);
-		spin_unlock(&cic_index_lock);
-
 		kfree(cfqd);
 		return NULL;
 	}
 
 	rcu_read_lock();
 
+	cfqg->blkg.owner = &blkio_policy_cfq;
 	cfq_blkiocg_add_blkio_group(&blkio_root_cgroup, &cfqg->blkg,
 					(void *)cfqd, 0);
 	rcu_read_unlock();
@@ -673,6 +673,7 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 		       !(rq->cmd_flags & REQ_DISCARD));
 		rq->cmd_flags |= REQ_SORTED;
 		q->nr_sorted++;
+		blk_lat_insert(rq);
 		if (rq_mergeable(rq)) {
 			elv_rqhash_add(q, rq);
 			if (!q->last_merge)
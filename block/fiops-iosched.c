@@ -12,6 +12,7 @@
 #include <linux/ioprio.h>
 #include <linux/blktrace_api.h>
 #include "blk.h"
+#include "blk-cgroup.h"
 
 #define VIOS_SCALE_SHIFT 10
 #define VIOS_SCALE (1 << VIOS_SCALE_SHIFT)
@@ -39,10 +40,41 @@ enum wl_prio_t {
 	FIOPS_PRIO_NR,
 };
 
+/*
+ * Requests are scheduled in two levels: a group (blkio cgroup) is picked
+ * from fiopsd->group_service_tree by its weight scaled vios, then an ioc
+ * is picked from the group's per class service trees by its own vios.
+ * Without CONFIG_FIOPS_GROUP_IOSCHED every ioc lives in the root group.
+ */
+struct fiops_group {
+	struct fiops_rb_root service_tree[FIOPS_PRIO_NR];
+
+	struct rb_node rb_node;
+	u64 vios; /* key in group_service_tree */
+
+	unsigned int weight;
+	unsigned int new_weight;
+	bool needs_update;
+
+	/* number of iocs on this group's service trees */
+	unsigned int busy_queues;
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	int ref;
+	struct hlist_node fiopsd_node;
+	struct blkio_group blkg;
+#endif
+};
+
 struct fiops_data {
 	struct request_queue *queue;
 
-	struct fiops_rb_root service_tree[FIOPS_PRIO_NR];
+	struct fiops_rb_root group_service_tree;
+	struct fiops_group root_group;
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	struct hlist_head group_list;
+	unsigned int nr_blkcg_linked_grps;
+#endif
 
 	unsigned int busy_queues;
 	unsigned int in_flight[2];
@@ -60,6 +92,7 @@ struct fiops_ioc {
 
 	unsigned int flags;
 	struct fiops_data *fiopsd;
+	struct fiops_group *group;
 	struct rb_node rb_node;
 	u64 vios; /* key in service_tree */
 	struct fiops_rb_root *service_tree;
@@ -74,7 +107,7 @@ struct fiops_ioc {
 	enum wl_prio_t wl_type;
 };
 
-#define ioc_service_tree(ioc) (&((ioc)->fiopsd->service_tree[(ioc)->wl_type]))
+#define ioc_service_tree(ioc) (&((ioc)->group->service_tree[(ioc)->wl_type]))
 #define RQ_CIC(rq)		icq_to_cic((rq)->elv.icq)
 
 enum ioc_state_flags {
@@ -128,10 +161,203 @@ static inline struct fiops_ioc *fiops_cic_lookup(struct fiops_data *fiopsd,
 	return NULL;
 }
 
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+static struct blkio_policy_type blkio_policy_fiops;
+
+static inline struct fiops_group *fiops_group_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct fiops_group, blkg);
+	return NULL;
+}
+
+static void fiops_update_blkio_group_weight(void *key,
+	struct blkio_group *blkg, unsigned int weight)
+{
+	struct fiops_group *group = fiops_group_of_blkg(blkg);
+
+	/* applied the next time the group becomes busy */
+	group->new_weight = weight;
+	group->needs_update = true;
+}
+
+static dev_t fiops_queue_dev(struct fiops_data *fiopsd)
+{
+	struct backing_dev_info *bdi = &fiopsd->queue->backing_dev_info;
+	unsigned int major, minor;
+
+	if (!bdi->dev || !dev_name(bdi->dev))
+		return 0;
+	sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
+	return MKDEV(major, minor);
+}
+
+static void fiops_link_group(struct fiops_data *fiopsd,
+	struct fiops_group *group, struct blkio_cgroup *blkcg)
+{
+	group->blkg.owner = &blkio_policy_fiops;
+	blkiocg_add_blkio_group(blkcg, &group->blkg, (void *)fiopsd,
+		fiops_queue_dev(fiopsd), BLKIO_POLICY_PROP);
+	fiopsd->nr_blkcg_linked_grps++;
+
+	group->weight = blkcg_get_weight(blkcg, group->blkg.dev);
+	group->new_weight = group->weight;
+
+	hlist_add_head(&group->fiopsd_node, &fiopsd->group_list);
+}
+
+/*
+ * Called with the queue lock held. Unlike cfq we don't drop it around the
+ * allocation: the per cpu stats come from a mempool which is fine with
+ * GFP_NOWAIT, and init_icq runs with the lock held anyway.
+ */
+static struct fiops_group *fiops_alloc_group(struct fiops_data *fiopsd)
+{
+	struct fiops_group *group;
+	int i;
+
+	group = kzalloc_node(sizeof(*group), GFP_ATOMIC, fiopsd->queue->node);
+	if (!group)
+		return NULL;
+
+	for (i = IDLE_WORKLOAD; i <= RT_WORKLOAD; i++)
+		group->service_tree[i] = FIOPS_RB_ROOT;
+	RB_CLEAR_NODE(&group->rb_node);
+
+	/* dropped by either elevator exit or cgroup removal */
+	group->ref = 1;
+
+	if (blkio_alloc_blkg_stats(&group->blkg)) {
+		kfree(group);
+		return NULL;
+	}
+
+	return group;
+}
+
+static struct fiops_group *fiops_find_group(struct fiops_data *fiopsd,
+	struct blkio_cgroup *blkcg)
+{
+	struct fiops_group *group;
+
+	if (blkcg == &blkio_root_cgroup)
+		group = &fiopsd->root_group;
+	else
+		group = fiops_group_of_blkg(blkiocg_lookup_group(blkcg, fiopsd));
+
+	/* the device may not have been registered when the group was made */
+	if (group && !group->blkg.dev)
+		group->blkg.dev = fiops_queue_dev(fiopsd);
+
+	return group;
+}
+
+/*
+ * Return the group of the current task's blkio cgroup, creating it if
+ * needed. Falls back to the root group if allocation fails.
+ */
+static struct fiops_group *fiops_get_group(struct fiops_data *fiopsd)
+{
+	struct blkio_cgroup *blkcg;
+	struct fiops_group *group;
+
+	rcu_read_lock();
+	blkcg = task_blkio_cgroup(current);
+	group = fiops_find_group(fiopsd, blkcg);
+	if (!group) {
+		group = fiops_alloc_group(fiopsd);
+		if (group)
+			fiops_link_group(fiopsd, group, blkcg);
+		else
+			group = &fiopsd->root_group;
+	}
+	rcu_read_unlock();
+
+	return group;
+}
+
+static inline void fiops_ref_get_group(struct fiops_group *group)
+{
+	group->ref++;
+}
+
+static void fiops_put_group(struct fiops_group *group)
+{
+	int i;
+
+	BUG_ON(group->ref <= 0);
+	if (--group->ref)
+		return;
+	BUG_ON(group->busy_queues);
+	for (i = IDLE_WORKLOAD; i <= RT_WORKLOAD; i++)
+		BUG_ON(!RB_EMPTY_ROOT(&group->service_tree[i].rb));
+	percpu_mempool_free(group->blkg.stats_cpu, blkg_stats_cpu_pool);
+	kfree(group);
+}
+
+static void fiops_destroy_group(struct fiops_data *fiopsd,
+	struct fiops_group *group)
+{
+	BUG_ON(hlist_unhashed(&group->fiopsd_node));
+	hlist_del_init(&group->fiopsd_node);
+
+	BUG_ON(!fiopsd->nr_blkcg_linked_grps);
+	fiopsd->nr_blkcg_linked_grps--;
+
+	/* iocs still linked to the group keep it alive until they exit */
+	fiops_put_group(group);
+}
+
+static void fiops_release_groups(struct fiops_data *fiopsd)
+{
+	struct hlist_node *pos, *n;
+	struct fiops_group *group;
+
+	hlist_for_each_entry_safe(group, pos, n, &fiopsd->group_list,
+				  fiopsd_node) {
+		/* if cgroup removal got here first it destroys the group */
+		if (!blkiocg_del_blkio_group(&group->blkg))
+			fiops_destroy_group(fiopsd, group);
+	}
+}
+
+/*
+ * The blkio cgroup is going away. Called under rcu_read_lock(), which
+ * keeps the fiops_data behind key valid.
+ */
+static void fiops_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct fiops_data *fiopsd = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(fiopsd->queue->queue_lock, flags);
+	fiops_destroy_group(fiopsd, fiops_group_of_blkg(blkg));
+	spin_unlock_irqrestore(fiopsd->queue->queue_lock, flags);
+}
+
+static inline void fiops_blkiocg_update_dispatch_stats(
+	struct fiops_group *group, struct request *rq)
+{
+	blkiocg_update_dispatch_stats(&group->blkg, blk_rq_bytes(rq),
+		rq_data_dir(rq), rq_is_sync(rq));
+}
+#else /* CONFIG_FIOPS_GROUP_IOSCHED */
+static inline struct fiops_group *fiops_get_group(struct fiops_data *fiopsd)
+{
+	return &fiopsd->root_group;
+}
+
+static inline void fiops_ref_get_group(struct fiops_group *group) {}
+static inline void fiops_put_group(struct fiops_group *group) {}
+static inline void fiops_release_groups(struct fiops_data *fiopsd) {}
+static inline void fiops_blkiocg_update_dispatch_stats(
+	struct fiops_group *group, struct request *rq) {}
+#endif /* CONFIG_FIOPS_GROUP_IOSCHED */
+
 /*
  * The below is leftmost cache rbtree addon
  */
-static struct fiops_ioc *fiops_rb_first(struct fiops_rb_root *root)
+static struct rb_node *__fiops_rb_first(struct fiops_rb_root *root)
 {
 	/* Service tree is empty */
 	if (!root->count)
@@ -140,8 +366,25 @@ static struct fiops_ioc *fiops_rb_first(struct fiops_rb_root *root)
 	if (!root->left)
 		root->left = rb_first(&root->rb);
 
-	if (root->left)
-		return rb_entry(root->left, struct fiops_ioc, rb_node);
+	return root->left;
+}
+
+static struct fiops_ioc *fiops_rb_first(struct fiops_rb_root *root)
+{
+	struct rb_node *n = __fiops_rb_first(root);
+
+	if (n)
+		return rb_entry(n, struct fiops_ioc, rb_node);
+
+	return NULL;
+}
+
+static struct fiops_group *fiops_rb_first_group(struct fiops_rb_root *root)
+{
+	struct rb_node *n = __fiops_rb_first(root);
+
+	if (n)
+		return rb_entry(n, struct fiops_group, rb_node);
 
 	return NULL;
 }
@@ -179,8 +422,85 @@ static void fiops_update_min_vios(struct fiops_rb_root *service_tree)
 	service_tree->min_vios = max_vios(service_tree->min_vios, ioc->vios);
 }
 
+static void fiops_update_group_min_vios(struct fiops_rb_root *service_tree)
+{
+	struct fiops_group *group;
+
+	group = fiops_rb_first_group(service_tree);
+	if (!group)
+		return;
+	service_tree->min_vios = max_vios(service_tree->min_vios, group->vios);
+}
+
 /*
- * The fiopsd->service_trees holds all pending fiops_ioc's that have
+ * Groups are charged vios inversely proportional to their weight, so a
+ * group with twice the weight gets twice the IOPS.
+ */
+static inline u64 fiops_group_scaled_vios(struct fiops_group *group, u64 vios)
+{
+	return div_u64(vios * BLKIO_WEIGHT_DEFAULT, group->weight);
+}
+
+/*
+ * fiopsd->group_service_tree holds all groups which have at least one ioc
+ * with pending requests, sorted by the vios the group has consumed.
+ */
+static void fiops_group_service_tree_add(struct fiops_data *fiopsd,
+	struct fiops_group *group)
+{
+	struct rb_node **p, *parent;
+	struct fiops_group *__group;
+	struct fiops_rb_root *service_tree = &fiopsd->group_service_tree;
+	u64 vios;
+	int left;
+
+	if (RB_EMPTY_NODE(&group->rb_node)) {
+		/* an idle group doesn't get to bank the vios it didn't use */
+		vios = max_vios(service_tree->min_vios, group->vios);
+		if (group->needs_update) {
+			group->weight = group->new_weight;
+			group->needs_update = false;
+		}
+	} else {
+		vios = group->vios;
+		fiops_rb_erase(&group->rb_node, service_tree);
+	}
+
+	left = 1;
+	parent = NULL;
+	p = &service_tree->rb.rb_node;
+	while (*p) {
+		parent = *p;
+		__group = rb_entry(parent, struct fiops_group, rb_node);
+
+		if (vios < __group->vios)
+			p = &(*p)->rb_left;
+		else {
+			p = &(*p)->rb_right;
+			left = 0;
+		}
+	}
+
+	if (left)
+		service_tree->left = &group->rb_node;
+
+	group->vios = vios;
+	rb_link_node(&group->rb_node, parent, p);
+	rb_insert_color(&group->rb_node, &service_tree->rb);
+	service_tree->count++;
+
+	fiops_update_group_min_vios(service_tree);
+}
+
+static void fiops_group_service_tree_del(struct fiops_data *fiopsd,
+	struct fiops_group *group)
+{
+	if (!RB_EMPTY_NODE(&group->rb_node))
+		fiops_rb_erase(&group->rb_node, &fiopsd->group_service_tree);
+}
+
+/*
+ * The group->service_trees holds all pending fiops_ioc's that have
  * requests waiting to be processed. It is sorted in the order that
  * we will service the queues.
  */
@@ -265,6 +585,8 @@ static void fiops_add_ioc_rr(struct fiops_data *fiopsd, struct fiops_ioc *ioc)
 	fiops_mark_ioc_on_rr(ioc);
 
 	fiopsd->busy_queues++;
+	if (!ioc->group->busy_queues++)
+		fiops_group_service_tree_add(fiopsd, ioc->group);
 
 	fiops_resort_rr_list(fiopsd, ioc);
 }
@@ -285,6 +607,36 @@ static void fiops_del_ioc_rr(struct fiops_data *fiopsd, struct fiops_ioc *ioc)
 
 	BUG_ON(!fiopsd->busy_queues);
 	fiopsd->busy_queues--;
+
+	BUG_ON(!ioc->group->busy_queues);
+	if (!--ioc->group->busy_queues)
+		fiops_group_service_tree_del(fiopsd, ioc->group);
+}
+
+/*
+ * Move the ioc to @group. Queued requests follow the ioc, so if it is busy
+ * it is taken off the old group's service tree and put on the new one.
+ */
+static void fiops_link_ioc_group(struct fiops_data *fiopsd,
+	struct fiops_ioc *ioc, struct fiops_group *group)
+{
+	struct fiops_group *old = ioc->group;
+	int on_rr;
+
+	if (old == group)
+		return;
+
+	on_rr = fiops_ioc_on_rr(ioc);
+	if (on_rr)
+		fiops_del_ioc_rr(fiopsd, ioc);
+
+	fiops_ref_get_group(group);
+	ioc->group = group;
+	if (old)
+		fiops_put_group(old);
+
+	if (on_rr)
+		fiops_add_ioc_rr(fiopsd, ioc);
 }
 
 /*
@@ -351,25 +703,30 @@ static u64 fiops_dispatch_request(struct fiops_data *fiopsd,
 	fiopsd->in_flight[rq_is_sync(rq)]++;
 	ioc->in_flight++;
 
+	fiops_blkiocg_update_dispatch_stats(ioc->group, rq);
+
 	return fiops_scaled_vios(fiopsd, ioc, rq);
 }
 
 static int fiops_forced_dispatch(struct fiops_data *fiopsd)
 {
+	struct fiops_group *group;
 	struct fiops_ioc *ioc;
 	int dispatched = 0;
 	int i;
 
-	for (i = RT_WORKLOAD; i >= IDLE_WORKLOAD; i--) {
-		while (!RB_EMPTY_ROOT(&fiopsd->service_tree[i].rb)) {
-			ioc = fiops_rb_first(&fiopsd->service_tree[i]);
-
-			while (!list_empty(&ioc->fifo)) {
-				fiops_dispatch_request(fiopsd, ioc);
-				dispatched++;
+	while ((group = fiops_rb_first_group(&fiopsd->group_service_tree))) {
+		for (i = RT_WORKLOAD; i >= IDLE_WORKLOAD; i--) {
+			while (!RB_EMPTY_ROOT(&group->service_tree[i].rb)) {
+				ioc = fiops_rb_first(&group->service_tree[i]);
+
+				while (!list_empty(&ioc->fifo)) {
+					fiops_dispatch_request(fiopsd, ioc);
+					dispatched++;
+				}
+				if (fiops_ioc_on_rr(ioc))
+					fiops_del_ioc_rr(fiopsd, ioc);
 			}
-			if (fiops_ioc_on_rr(ioc))
-				fiops_del_ioc_rr(fiopsd, ioc);
 		}
 	}
 	return dispatched;
@@ -377,14 +734,19 @@ static int fiops_forced_dispatch(struct fiops_data *fiopsd)
 
 static struct fiops_ioc *fiops_select_ioc(struct fiops_data *fiopsd)
 {
+	struct fiops_group *group;
 	struct fiops_ioc *ioc;
 	struct fiops_rb_root *service_tree = NULL;
 	int i;
 	struct request *rq;
 
+	group = fiops_rb_first_group(&fiopsd->group_service_tree);
+	if (!group)
+		return NULL;
+
 	for (i = RT_WORKLOAD; i >= IDLE_WORKLOAD; i--) {
-		if (!RB_EMPTY_ROOT(&fiopsd->service_tree[i].rb)) {
-			service_tree = &fiopsd->service_tree[i];
+		if (!RB_EMPTY_ROOT(&group->service_tree[i].rb)) {
+			service_tree = &group->service_tree[i];
 			break;
 		}
 	}
@@ -401,7 +763,8 @@ static struct fiops_ioc *fiops_select_ioc(struct fiops_data *fiopsd)
 	 * to be starved, don't delay
 	 */
 	if (!rq_is_sync(rq) && fiopsd->in_flight[1] != 0 &&
-			service_tree->count == 1) {
+			service_tree->count == 1 &&
+			fiopsd->group_service_tree.count == 1) {
 		fiops_log_ioc(fiopsd, ioc,
 				"postpone async, in_flight async %d sync %d",
 				fiopsd->in_flight[0], fiopsd->in_flight[1]);
@@ -415,9 +778,13 @@ static void fiops_charge_vios(struct fiops_data *fiopsd,
 	struct fiops_ioc *ioc, u64 vios)
 {
 	struct fiops_rb_root *service_tree = ioc->service_tree;
+	struct fiops_group *group = ioc->group;
+
 	ioc->vios += vios;
+	group->vios += fiops_group_scaled_vios(group, vios);
 
-	fiops_log_ioc(fiopsd, ioc, "charge vios %lld, new vios %lld", vios, ioc->vios);
+	fiops_log_ioc(fiopsd, ioc, "charge vios %lld, new vios %lld, group vios %lld",
+		vios, ioc->vios, group->vios);
 
 	if (RB_EMPTY_ROOT(&ioc->sort_list))
 		fiops_del_ioc_rr(fiopsd, ioc);
@@ -425,6 +792,10 @@ static void fiops_charge_vios(struct fiops_data *fiopsd,
 		fiops_resort_rr_list(fiopsd, ioc);
 
 	fiops_update_min_vios(service_tree);
+
+	/* the group may have gone idle with this ioc */
+	if (!RB_EMPTY_NODE(&group->rb_node))
+		fiops_group_service_tree_add(fiopsd, group);
 }
 
 static int fiops_dispatch_requests(struct request_queue *q, int force)
@@ -597,9 +968,26 @@ static int fiops_allow_merge(struct request_queue *q, struct request *rq,
 static void fiops_exit_queue(struct elevator_queue *e)
 {
 	struct fiops_data *fiopsd = e->elevator_data;
+	struct request_queue *q = fiopsd->queue;
+	bool wait = false;
 
 	cancel_work_sync(&fiopsd->unplug_work);
 
+	spin_lock_irq(q->queue_lock);
+	fiops_release_groups(fiopsd);
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	/* groups claimed by cgroup removal may still look at the key */
+	if (fiopsd->nr_blkcg_linked_grps)
+		wait = true;
+#endif
+	spin_unlock_irq(q->queue_lock);
+
+	if (wait)
+		synchronize_rcu();
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	free_percpu(fiopsd->root_group.blkg.stats_cpu);
+#endif
 	kfree(fiopsd);
 }
 
@@ -617,6 +1005,7 @@ static void fiops_kick_queue(struct work_struct *work)
 static void *fiops_init_queue(struct request_queue *q)
 {
 	struct fiops_data *fiopsd;
+	struct fiops_group *group;
 	int i;
 
 	fiopsd = kzalloc_node(sizeof(*fiopsd), GFP_KERNEL, q->node);
@@ -625,8 +1014,37 @@ static void *fiops_init_queue(struct request_queue *q)
 
 	fiopsd->queue = q;
 
+	fiopsd->group_service_tree = FIOPS_RB_ROOT;
+
+	group = &fiopsd->root_group;
 	for (i = IDLE_WORKLOAD; i <= RT_WORKLOAD; i++)
-		fiopsd->service_tree[i] = FIOPS_RB_ROOT;
+		group->service_tree[i] = FIOPS_RB_ROOT;
+	RB_CLEAR_NODE(&group->rb_node);
+
+	/* same preference for the root group as cfq gives it */
+	group->weight = 2 * BLKIO_WEIGHT_DEFAULT;
+	group->new_weight = group->weight;
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	/*
+	 * One reference is dropped by fiops_release_groups(), the other is
+	 * never dropped as the root group is embedded in fiopsd.
+	 */
+	group->ref = 2;
+	if (blkio_alloc_blkg_stats(&group->blkg)) {
+		kfree(fiopsd);
+		return NULL;
+	}
+
+	rcu_read_lock();
+	group->blkg.owner = &blkio_policy_fiops;
+	blkiocg_add_blkio_group(&blkio_root_cgroup, &group->blkg,
+		(void *)fiopsd, 0, BLKIO_POLICY_PROP);
+	rcu_read_unlock();
+	fiopsd->nr_blkcg_linked_grps++;
+
+	hlist_add_head(&group->fiopsd_node, &fiopsd->group_list);
+#endif
 
 	INIT_WORK(&fiopsd->unplug_work, fiops_kick_queue);
 
@@ -648,11 +1066,45 @@ static void fiops_init_icq(struct io_cq *icq)
 	ioc->sort_list = RB_ROOT;
 
 	ioc->fiopsd = fiopsd;
+	fiops_link_ioc_group(fiopsd, ioc, fiops_get_group(fiopsd));
 
 	ioc->pid = current->pid;
 	fiops_mark_ioc_prio_changed(ioc);
 }
 
+static void fiops_exit_icq(struct io_cq *icq)
+{
+	struct fiops_ioc *ioc = icq_to_cic(icq);
+
+	if (ioc->group) {
+		fiops_put_group(ioc->group);
+		ioc->group = NULL;
+	}
+}
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+/*
+ * Pick up blkio cgroup migrations. Called without the queue lock from the
+ * submitting task, which is the one whose cgroup we want.
+ */
+static int fiops_set_request(struct request_queue *q, struct request *rq,
+	gfp_t gfp_mask)
+{
+	struct fiops_data *fiopsd = q->elevator->elevator_data;
+	struct fiops_ioc *ioc = RQ_CIC(rq);
+
+	if (!ioc || likely(!test_bit(ICQ_CGROUP_CHANGED, &ioc->icq.changed)))
+		return 0;
+
+	spin_lock_irq(q->queue_lock);
+	if (test_and_clear_bit(ICQ_CGROUP_CHANGED, &ioc->icq.changed))
+		fiops_link_ioc_group(fiopsd, ioc, fiops_get_group(fiopsd));
+	spin_unlock_irq(q->queue_lock);
+
+	return 0;
+}
+#endif
+
 /*
  * sysfs parts below -->
  */
@@ -725,6 +1177,10 @@ static struct elevator_type iosched_fiops = {
 		.elevator_former_req_fn =	elv_rb_former_request,
 		.elevator_latter_req_fn =	elv_rb_latter_request,
 		.elevator_init_icq_fn =		fiops_init_icq,
+		.elevator_exit_icq_fn =		fiops_exit_icq,
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+		.elevator_set_req_fn =		fiops_set_request,
+#endif
 		.elevator_init_fn =		fiops_init_queue,
 		.elevator_exit_fn =		fiops_exit_queue,
 	},
@@ -735,13 +1191,36 @@ static struct elevator_type iosched_fiops = {
 	.elevator_owner =	THIS_MODULE,
 };
 
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+static struct blkio_policy_type blkio_policy_fiops = {
+	.ops = {
+		.blkio_unlink_group_fn =	fiops_unlink_blkio_group,
+		.blkio_update_group_weight_fn =	fiops_update_blkio_group_weight,
+	},
+	.plid = BLKIO_POLICY_PROP,
+};
+#endif
+
 static int __init fiops_init(void)
 {
-	return elv_register(&iosched_fiops);
+	int ret;
+
+	ret = elv_register(&iosched_fiops);
+	if (ret)
+		return ret;
+
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	blkio_policy_register(&blkio_policy_fiops);
+#endif
+
+	return 0;
 }
 
 static void __exit fiops_exit(void)
 {
+#ifdef CONFIG_FIOPS_GROUP_IOSCHED
+	blkio_policy_unregister(&blkio_policy_fiops);
+#endif
 	elv_unregister(&iosched_fiops);
 }
 
@@ -96,10 +96,63 @@ static const struct row_queue_params row_queues_def[] = {
 	{false, 1, false}	/* ROWQ_PRIO_LOW_SWRITE */
 };
 
+/*
+ * Default completion latency targets (in usec) for the adaptive mode.
+ * 0 means the queue has no target and its quantum is left alone.
+ */
+static const int row_queues_target_us[] = {
+	20000,	/* ROWQ_PRIO_HIGH_READ */
+	0,	/* ROWQ_PRIO_HIGH_SWRITE */
+	50000,	/* ROWQ_PRIO_REG_READ */
+	0,	/* ROWQ_PRIO_REG_SWRITE */
+	0,	/* ROWQ_PRIO_REG_WRITE */
+	0,	/* ROWQ_PRIO_LOW_READ */
+	0	/* ROWQ_PRIO_LOW_SWRITE */
+};
+
+static const char * const row_queues_name[] = {
+	"hp_read",
+	"hp_swrite",
+	"rp_read",
+	"rp_swrite",
+	"rp_write",
+	"lp_read",
+	"lp_swrite"
+};
+
 /* Default values for idling on read queues (in msec) */
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 5
 
+/* Limits for the values set by the adaptive mode */
+#define ROW_MAX_ADAPT_QUANTUM	1000
+#define ROW_MAX_ADAPT_IDLE_MSEC	20
+
+/*
+ * Completion latencies are kept in a histogram of ROW_LAT_BUCKETS buckets,
+ * 1 << ROW_LAT_SUB_BITS of them per power of two usecs. The histogram is
+ * halved every ROW_LAT_WINDOW completions so that it follows the
+ * workload, and the adaptive mode reevaluates a queue every
+ * ROW_ADAPT_SAMPLES completions on it.
+ */
+#define ROW_LAT_SUB_BITS	2
+#define ROW_LAT_BUCKETS		(32 << ROW_LAT_SUB_BITS)
+#define ROW_LAT_WINDOW		1024
+#define ROW_ADAPT_SAMPLES	32
+
+/**
+ * struct row_lat_stats - completion latency of a ROW queue
+ * @buckets:		latency histogram
+ * @nr_samples:		number of samples in the histogram
+ * @nr_new:		completions since the last adaptation
+ *
+ */
+struct row_lat_stats {
+	u32			buckets[ROW_LAT_BUCKETS];
+	u32			nr_samples;
+	u32			nr_new;
+};
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
@@ -123,6 +176,8 @@ struct rowq_idling_data {
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
  * @idle_data:		data for idling on queues
+ * @target_us:		completion latency target in the adaptive mode
+ * @lat:		measured completion latency
  *
  */
 struct row_queue {
@@ -137,6 +192,9 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	int			target_us;
+	struct row_lat_stats	lat;
 };
 
 /**
@@ -188,6 +246,7 @@ struct starvation_data {
  * @reg_prio_starvation: starvation data for REGULAR priority queues
  * @low_prio_starvation: starvation data for LOW priority queues
  * @cycle_flags:	used for marking unserved queueus
+ * @adaptive:		adjust quantums and idling to the latency targets
  *
  */
 struct row_data {
@@ -207,9 +266,12 @@ struct row_data {
 	struct starvation_data		low_prio_starvation;
 
 	unsigned int			cycle_flags;
+	int				adaptive;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elv.priv[0]))
+/* insertion time in usecs, wraps but only deltas are used */
+#define RQ_INSERT_US(rq) ((unsigned long) ((rq)->elv.priv[1]))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -317,6 +379,118 @@ static inline bool row_low_req_pending(struct row_data *rd)
 	return false;
 }
 
+static inline unsigned long row_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
+static int row_lat_bucket(u32 us)
+{
+	int msb;
+
+	if (us < (1 << ROW_LAT_SUB_BITS))
+		return us;
+
+	msb = fls(us) - 1;
+	return ((msb - ROW_LAT_SUB_BITS + 1) << ROW_LAT_SUB_BITS) +
+		((us >> (msb - ROW_LAT_SUB_BITS)) &
+		 ((1 << ROW_LAT_SUB_BITS) - 1));
+}
+
+/* Lowest latency (in usec) accounted in bucket @idx */
+static u64 row_lat_bucket_floor(int idx)
+{
+	int msb = (idx >> ROW_LAT_SUB_BITS) + ROW_LAT_SUB_BITS - 1;
+	int sub = idx & ((1 << ROW_LAT_SUB_BITS) - 1);
+
+	if (idx < (1 << ROW_LAT_SUB_BITS))
+		return idx;
+
+	return (u64)((1 << ROW_LAT_SUB_BITS) + sub) <<
+		(msb - ROW_LAT_SUB_BITS);
+}
+
+static void row_lat_add(struct row_lat_stats *lat, u32 us)
+{
+	int i;
+
+	if (lat->nr_samples >= ROW_LAT_WINDOW) {
+		lat->nr_samples = 0;
+		for (i = 0; i < ROW_LAT_BUCKETS; i++) {
+			lat->buckets[i] >>= 1;
+			lat->nr_samples += lat->buckets[i];
+		}
+	}
+	lat->buckets[row_lat_bucket(us)]++;
+	lat->nr_samples++;
+	lat->nr_new++;
+}
+
+/*
+ * row_lat_percentile() - latency (usec) under which @pct percent of the
+ *			  recent completions fall, rounded up to the
+ *			  histogram resolution. 0 if nothing was measured.
+ */
+static unsigned int row_lat_percentile(struct row_lat_stats *lat, int pct)
+{
+	u32 rank, sum = 0;
+	int i;
+
+	if (!lat->nr_samples)
+		return 0;
+
+	rank = DIV_ROUND_UP(lat->nr_samples * pct, 100);
+	for (i = 0; i < ROW_LAT_BUCKETS; i++) {
+		sum += lat->buckets[i];
+		if (sum >= rank)
+			break;
+	}
+	return min_t(u64, row_lat_bucket_floor(i + 1), UINT_MAX);
+}
+
+/*
+ * row_adapt_queue() - adjust a queue to its latency target
+ * @rd:		pointer to struct row_data
+ * @rqueue:	queue that reached ROW_ADAPT_SAMPLES new completions
+ *
+ * A queue missing its p99 target gets its dispatch quantum doubled, and
+ * read queues idle longer so that their sequential requests are not
+ * broken up by writes. A queue well within its target (p99 under half of
+ * it) gives back an eighth of its quantum and a msec of idling. The
+ * quantum never drops below a quarter of its default.
+ */
+static void row_adapt_queue(struct row_data *rd, struct row_queue *rqueue)
+{
+	unsigned int p99 = row_lat_percentile(&rqueue->lat, 99);
+	int min_quantum = max(row_queues_def[rqueue->prio].quantum / 4, 1);
+	int quantum = rqueue->disp_quantum;
+	s64 idle = rd->rd_idle_data.idle_time_ms;
+
+	rqueue->lat.nr_new = 0;
+	if (!rqueue->target_us)
+		return;
+
+	if (p99 > rqueue->target_us) {
+		quantum *= 2;
+		idle++;
+	} else if (p99 < rqueue->target_us / 2) {
+		quantum -= quantum / 8;
+		idle--;
+	} else {
+		return;
+	}
+
+	rqueue->disp_quantum = clamp(quantum, min_quantum,
+				     ROW_MAX_ADAPT_QUANTUM);
+	if (row_queues_def[rqueue->prio].idling_enabled)
+		rd->rd_idle_data.idle_time_ms = clamp_t(s64, idle, 1,
+						ROW_MAX_ADAPT_IDLE_MSEC);
+
+	row_log_rowq(rd, rqueue->prio, "adapted: p99=%uus quantum=%d idle=%lld",
+		     p99, rqueue->disp_quantum,
+		     rd->rd_idle_data.idle_time_ms);
+}
+
 /******************* Elevator callback functions *********************/
 
 /*
@@ -341,6 +515,7 @@ static void row_add_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	rq->elv.priv[1] = (void *)row_now_us();
 
 	if (rq->cmd_flags & REQ_URGENT) {
 		WARN_ON(1);
@@ -457,6 +632,14 @@ static int row_reinsert_req(struct request_queue *q,
 static void row_completed_req(struct request_queue *q, struct request *rq)
 {
 	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+
+	if (rqueue) {
+		row_lat_add(&rqueue->lat,
+			    (u32)(row_now_us() - RQ_INSERT_US(rq)));
+		if (rd->adaptive && rqueue->lat.nr_new >= ROW_ADAPT_SAMPLES)
+			row_adapt_queue(rd, rqueue);
+	}
 
 	 if (rq->cmd_flags & REQ_URGENT) {
 		if (!rd->urgent_in_flight) {
@@ -806,6 +989,7 @@ static void *row_init_queue(struct request_queue *q)
 		rdata->row_queues[i].idle_data.begin_idling = false;
 		rdata->row_queues[i].idle_data.last_insert_time =
 			ktime_set(0, 0);
+		rdata->row_queues[i].target_us = row_queues_target_us[i];
 	}
 
 	rdata->reg_prio_starvation.starvation_limit =
@@ -988,6 +1172,21 @@ SHOW_FUNCTION(row_reg_starv_limit_show,
 	rowd->reg_prio_starvation.starvation_limit);
 SHOW_FUNCTION(row_low_starv_limit_show,
 	rowd->low_prio_starvation.starvation_limit);
+SHOW_FUNCTION(row_adaptive_show, rowd->adaptive);
+SHOW_FUNCTION(row_hp_read_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_READ].target_us);
+SHOW_FUNCTION(row_rp_read_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_REG_READ].target_us);
+SHOW_FUNCTION(row_hp_swrite_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].target_us);
+SHOW_FUNCTION(row_rp_swrite_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_REG_SWRITE].target_us);
+SHOW_FUNCTION(row_rp_write_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_REG_WRITE].target_us);
+SHOW_FUNCTION(row_lp_read_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_READ].target_us);
+SHOW_FUNCTION(row_lp_swrite_target_us_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].target_us);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)			\
@@ -1034,9 +1233,58 @@ STORE_FUNCTION(row_reg_starv_limit_store,
 STORE_FUNCTION(row_low_starv_limit_store,
 			&rowd->low_prio_starvation.starvation_limit,
 			1, INT_MAX);
+STORE_FUNCTION(row_adaptive_store, &rowd->adaptive, 0, 1);
+STORE_FUNCTION(row_hp_read_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_HIGH_READ].target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_rp_read_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_READ].target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_hp_swrite_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_rp_swrite_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_SWRITE].target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_rp_write_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_REG_WRITE].target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_lp_read_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_LOW_READ].target_us,
+			0, INT_MAX);
+STORE_FUNCTION(row_lp_swrite_target_us_store,
+			&rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].target_us,
+			0, INT_MAX);
 
 #undef STORE_FUNCTION
 
+/*
+ * One line per queue: name, latency target, current quantum and the
+ * achieved p50/p99 completion latencies (usec) over the recent window.
+ */
+static ssize_t row_latency_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	ssize_t len = 0;
+	int i;
+
+	spin_lock_irq(q->queue_lock);
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		struct row_queue *rqueue = &rowd->row_queues[i];
+
+		len += snprintf(page + len, PAGE_SIZE - len,
+				"%-9s target %8d quantum %4d p50 %8u p99 %8u\n",
+				row_queues_name[i], rqueue->target_us,
+				rqueue->disp_quantum,
+				row_lat_percentile(&rqueue->lat, 50),
+				row_lat_percentile(&rqueue->lat, 99));
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return len;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -1053,6 +1301,15 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(rd_idle_data_freq),
 	ROW_ATTR(reg_starv_limit),
 	ROW_ATTR(low_starv_limit),
+	ROW_ATTR(adaptive),
+	ROW_ATTR(hp_read_target_us),
+	ROW_ATTR(rp_read_target_us),
+	ROW_ATTR(hp_swrite_target_us),
+	ROW_ATTR(rp_swrite_target_us),
+	ROW_ATTR(rp_write_target_us),
+	ROW_ATTR(lp_read_target_us),
+	ROW_ATTR(lp_swrite_target_us),
+	__ATTR(latency, S_IRUGO, row_latency_show, NULL),
 	__ATTR_NULL
 };
 
@@ -12,6 +12,13 @@
  * Asynchronous and synchronous requests are not treated separately, but
  * we relay on deadlines to ensure fairness.
  *
+ * Requests are also kept sorted by sector per direction, which is used for
+ * front merges and, when contig_batch is above 1, to dispatch up to that
+ * many requests contiguous with the previous one in a single go. Small
+ * interleaved sync writes then reach the driver back to back and can be
+ * coalesced there. Expired requests are still checked every fifo_batch
+ * dispatches, and before each request of a contiguous run.
+ *
  */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
@@ -32,11 +39,15 @@ static const int async_write_expire = 16 * HZ;	/* ditto for async, these limits
 static const int writes_starved = 2;		/* max times reads can starve a write */
 static const int fifo_batch     = 8;		/* # of sequential requests treated as one
 						   by the above parameters. For throughput. */
+static const int contig_batch   = 1;		/* max # of contiguous requests dispatched
+						   at once. 1 disables batching. */
+static const int contig_batch_max = BLKDEV_MAX_RQ;	/* upper bound for the above */
 
 /* Elevator data */
 struct sio_data {
 	/* Request queues */
 	struct list_head fifo_list[2][2];
+	struct rb_root sort_list[2];
 
 	/* Attributes */
 	unsigned int batched;
@@ -46,12 +57,47 @@ struct sio_data {
 	int fifo_expire[2][2];
 	int fifo_batch;
 	int writes_starved;
+	int contig_batch;
 };
 
+static int
+sio_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+	struct request *__rq;
+
+	/*
+	 * Back merges are found through the elevator hash,
+	 * look for a front merge.
+	 */
+	__rq = elv_rb_find(&sd->sort_list[bio_data_dir(bio)], sector);
+	if (__rq && elv_rq_merge_ok(__rq, bio)) {
+		*req = __rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void
+sio_merged_request(struct request_queue *q, struct request *req, int type)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+
+	/* A front merge moves the start sector, reposition the request */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(&sd->sort_list[rq_data_dir(req)], req);
+		elv_rb_add(&sd->sort_list[rq_data_dir(req)], req);
+	}
+}
+
 static void
 sio_merged_requests(struct request_queue *q, struct request *rq,
 		    struct request *next)
 {
+	struct sio_data *sd = q->elevator->elevator_data;
+
 	/*
 	 * If next expires before rq, assign its expire time to rq
 	 * and move into next position (next will be deleted) in fifo.
@@ -65,6 +111,7 @@ sio_merged_requests(struct request_queue *q, struct request *rq,
 
 	/* Delete next request */
 	rq_fifo_clear(next);
+	elv_rb_del(&sd->sort_list[rq_data_dir(next)], next);
 }
 
 static void
@@ -80,6 +127,7 @@ sio_add_request(struct request_queue *q, struct request *rq)
 	 */
 	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
 	list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+	elv_rb_add(&sd->sort_list[data_dir], rq);
 }
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
@@ -168,10 +216,11 @@ static inline void
 sio_dispatch_request(struct sio_data *sd, struct request *rq)
 {
 	/*
-	 * Remove the request from the fifo list
+	 * Remove the request from the fifo and sort lists
 	 * and dispatch it.
 	 */
 	rq_fifo_clear(rq);
+	elv_rb_del(&sd->sort_list[rq_data_dir(rq)], rq);
 	elv_dispatch_add_tail(rq->q, rq);
 
 	sd->batched++;
@@ -188,6 +237,7 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	struct sio_data *sd = q->elevator->elevator_data;
 	struct request *rq = NULL;
 	int data_dir = READ;
+	int dispatched;
 
 	/*
 	 * Retrieve any expired request after a batch of
@@ -203,7 +253,15 @@ sio_dispatch_requests(struct request_queue *q, int force)
 		if (sd->starved > sd->writes_starved)
 			data_dir = WRITE;
 
-		rq = sio_choose_request(sd, data_dir);
+		/*
+		 * Prefer a request that continues the last one
+		 * sent to the driver, so that they can be coalesced.
+		 */
+		if (sd->contig_batch > 1)
+			rq = elv_rb_find(&sd->sort_list[data_dir],
+					 q->end_sector);
+		if (!rq)
+			rq = sio_choose_request(sd, data_dir);
 		if (!rq)
 			return 0;
 	}
@@ -211,7 +269,33 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	/* Dispatch request */
 	sio_dispatch_request(sd, rq);
 
-	return 1;
+	/*
+	 * Dispatch the contiguous requests following it. Each one counts
+	 * towards writes_starved like any other dispatch, and a run of
+	 * reads stops as soon as the writes are due. An expired request
+	 * ends the run and goes out next, so the deadlines hold however
+	 * long the run could be.
+	 */
+	for (dispatched = 1; dispatched < sd->contig_batch; dispatched++) {
+		struct request *expired = sio_choose_expired_request(sd);
+
+		if (expired) {
+			sd->batched = 0;
+			sio_dispatch_request(sd, expired);
+			dispatched++;
+			break;
+		}
+		data_dir = rq_data_dir(rq);
+		if (data_dir == READ && sd->starved > sd->writes_starved &&
+		    !RB_EMPTY_ROOT(&sd->sort_list[WRITE]))
+			break;
+		rq = elv_rb_find(&sd->sort_list[data_dir], rq_end_sector(rq));
+		if (!rq)
+			break;
+		sio_dispatch_request(sd, rq);
+	}
+
+	return dispatched;
 }
 
 static struct request *
@@ -257,14 +341,19 @@ sio_init_queue(struct request_queue *q)
 	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
 	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
 	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
+	sd->sort_list[READ] = RB_ROOT;
+	sd->sort_list[WRITE] = RB_ROOT;
 
 	/* Initialize data */
 	sd->batched = 0;
+	sd->starved = 0;
 	sd->fifo_expire[SYNC][READ] = sync_read_expire;
 	sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
 	sd->fifo_expire[ASYNC][READ] = async_read_expire;
 	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
 	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->contig_batch = contig_batch;
 
 	return sd;
 }
@@ -317,6 +406,7 @@ SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
 SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
 SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+SHOW_FUNCTION(sio_contig_batch_show, sd->contig_batch, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -341,6 +431,7 @@ STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, IN
 STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
 STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_contig_batch_store, &sd->contig_batch, 1, contig_batch_max, 0);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -354,11 +445,14 @@ static struct elv_fs_entry sio_attrs[] = {
 	DD_ATTR(async_write_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
+	DD_ATTR(contig_batch),
 	__ATTR_NULL
 };
 
 static struct elevator_type iosched_sio = {
 	.ops = {
+		.elevator_merge_fn		= sio_merge,
+		.elevator_merged_fn		= sio_merged_request,
 		.elevator_merge_req_fn		= sio_merged_requests,
 		.elevator_dispatch_fn		= sio_dispatch_requests,
 		.elevator_add_req_fn		= sio_add_request,
@@ -24,6 +24,12 @@
 #include <linux/vmalloc.h>
 #include <linux/lz4.h>
 
+#if defined(CONFIG_LZ4_DECOMPRESS_WIDE) || \
+	defined(CONFIG_LZ4_DECOMPRESS_WIDE_MODULE)
+#define HAVE_LZ4_WIDE
+#include <asm/system.h>
+#endif
+
 struct lz4_ctx {
 	void *lz4_comp_mem;
 };
@@ -77,6 +83,7 @@ static int lz4_decompress_crypto(struct crypto_tfm *tfm, const u8 *src,
 
 static struct crypto_alg alg_lz4 = {
 	.cra_name		= "lz4",
+	.cra_driver_name	= "lz4-generic",
 	.cra_flags		= CRYPTO_ALG_TYPE_COMPRESS,
 	.cra_ctxsize		= sizeof(struct lz4_ctx),
 	.cra_module		= THIS_MODULE,
@@ -88,13 +95,68 @@ static struct crypto_alg alg_lz4 = {
 	.coa_decompress		= lz4_decompress_crypto } }
 };
 
+#ifdef HAVE_LZ4_WIDE
+static int lz4_decompress_wide_crypto(struct crypto_tfm *tfm, const u8 *src,
+			      unsigned int slen, u8 *dst, unsigned int *dlen)
+{
+	int err;
+	size_t tmp_len = *dlen;
+
+	err = lz4_decompress_wide(src, &slen, dst, tmp_len);
+	if (err < 0)
+		return -EINVAL;
+
+	*dlen = tmp_len;
+	return err;
+}
+
+/* Preferred over lz4-generic where the CPU handles unaligned words */
+static struct crypto_alg alg_lz4_wide = {
+	.cra_name		= "lz4",
+	.cra_driver_name	= "lz4-wide",
+	.cra_priority		= 100,
+	.cra_flags		= CRYPTO_ALG_TYPE_COMPRESS,
+	.cra_ctxsize		= sizeof(struct lz4_ctx),
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(alg_lz4_wide.cra_list),
+	.cra_init		= lz4_init,
+	.cra_exit		= lz4_exit,
+	.cra_u			= { .compress = {
+	.coa_compress		= lz4_compress_crypto,
+	.coa_decompress		= lz4_decompress_wide_crypto } }
+};
+
+static bool lz4_wide_registered;
+#endif
+
 static int __init lz4_mod_init(void)
 {
-	return crypto_register_alg(&alg_lz4);
+	int err;
+
+	err = crypto_register_alg(&alg_lz4);
+	if (err)
+		return err;
+
+#ifdef HAVE_LZ4_WIDE
+	if (cpu_unaligned_access_ok()) {
+		err = crypto_register_alg(&alg_lz4_wide);
+		if (err) {
+			crypto_unregister_alg(&alg_lz4);
+			return err;
+		}
+		lz4_wide_registered = true;
+	}
+#endif
+
+	return 0;
 }
 
 static void __exit lz4_mod_fini(void)
 {
+#ifdef HAVE_LZ4_WIDE
+	if (lz4_wide_registered)
+		crypto_unregister_alg(&alg_lz4_wide);
+#endif
 	crypto_unregister_alg(&alg_lz4);
 }
 
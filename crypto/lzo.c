@@ -22,6 +22,12 @@
 #include <linux/vmalloc.h>
 #include <linux/lzo.h>
 
+#if defined(CONFIG_LZO_DECOMPRESS_WIDE) || \
+	defined(CONFIG_LZO_DECOMPRESS_WIDE_MODULE)
+#define HAVE_LZO_WIDE
+#include <asm/system.h>
+#endif
+
 struct lzo_ctx {
 	void *lzo_comp_mem;
 };
@@ -78,6 +84,7 @@ static int lzo_decompress(struct crypto_tfm *tfm, const u8 *src,
 
 static struct crypto_alg alg = {
 	.cra_name		= "lzo",
+	.cra_driver_name	= "lzo-generic",
 	.cra_flags		= CRYPTO_ALG_TYPE_COMPRESS,
 	.cra_ctxsize		= sizeof(struct lzo_ctx),
 	.cra_module		= THIS_MODULE,
@@ -89,13 +96,69 @@ static struct crypto_alg alg = {
 	.coa_decompress  	= lzo_decompress } }
 };
 
+#ifdef HAVE_LZO_WIDE
+static int lzo_decompress_wide(struct crypto_tfm *tfm, const u8 *src,
+			      unsigned int slen, u8 *dst, unsigned int *dlen)
+{
+	int err;
+	size_t tmp_len = *dlen; /* size_t(ulong) <-> uint on 64 bit */
+
+	err = lzo1x_decompress_safe_wide(src, slen, dst, &tmp_len);
+
+	if (err != LZO_E_OK)
+		return -EINVAL;
+
+	*dlen = tmp_len;
+	return 0;
+}
+
+/* Preferred over lzo-generic where the CPU handles unaligned words */
+static struct crypto_alg alg_wide = {
+	.cra_name		= "lzo",
+	.cra_driver_name	= "lzo-wide",
+	.cra_priority		= 100,
+	.cra_flags		= CRYPTO_ALG_TYPE_COMPRESS,
+	.cra_ctxsize		= sizeof(struct lzo_ctx),
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(alg_wide.cra_list),
+	.cra_init		= lzo_init,
+	.cra_exit		= lzo_exit,
+	.cra_u			= { .compress = {
+	.coa_compress 		= lzo_compress,
+	.coa_decompress  	= lzo_decompress_wide } }
+};
+
+static bool lzo_wide_registered;
+#endif
+
 static int __init lzo_mod_init(void)
 {
-	return crypto_register_alg(&alg);
+	int err;
+
+	err = crypto_register_alg(&alg);
+	if (err)
+		return err;
+
+#ifdef HAVE_LZO_WIDE
+	if (cpu_unaligned_access_ok()) {
+		err = crypto_register_alg(&alg_wide);
+		if (err) {
+			crypto_unregister_alg(&alg);
+			return err;
+		}
+		lzo_wide_registered = true;
+	}
+#endif
+
+	return 0;
 }
 
 static void __exit lzo_mod_fini(void)
 {
+#ifdef HAVE_LZO_WIDE
+	if (lzo_wide_registered)
+		crypto_unregister_alg(&alg_wide);
+#endif
 	crypto_unregister_alg(&alg);
 }
 
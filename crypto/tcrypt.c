@@ -141,6 +141,194 @@ out:
 
 static u32 block_sizes[] = { 16, 64, 256, 1024, 8192, 0 };
 
+/*
+ * Used by test_comp_speed()
+ */
+#define COMP_BUF_SIZE	(2 * PAGE_SIZE)
+
+/*
+ * Fill a page the way anonymous memory tends to look, from mostly zero
+ * to incompressible, so that one tvmem page of each kind gives a ratio
+ * close to what a swap device sees.
+ */
+static void test_comp_fill_page(char *page, int kind)
+{
+	u32 *word = (u32 *)page;
+	u32 seed = 0x9e3779b9 * (kind + 1);
+	int i;
+
+	switch (kind) {
+	case 0:		/* mostly zero, a few scattered pointers */
+		memset(page, 0, PAGE_SIZE);
+		for (i = 0; i < PAGE_SIZE / sizeof(u32); i += 61)
+			word[i] = 0xc0000000 | (i << 4);
+		break;
+	case 1:		/* arrays of small structures */
+		for (i = 0; i < PAGE_SIZE / sizeof(u32); i++)
+			word[i] = (i % 16 < 4) ? i / 16 : 0x10000 + i % 16;
+		break;
+	case 2:		/* text */
+		for (i = 0; i < PAGE_SIZE; i++) {
+			seed = seed * 1103515245 + 12345;
+			page[i] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+		}
+		break;
+	default:	/* incompressible */
+		for (i = 0; i < PAGE_SIZE / sizeof(u32); i++) {
+			seed = seed * 1103515245 + 12345;
+			word[i] = seed;
+		}
+		break;
+	}
+}
+
+static int do_one_comp_op(struct crypto_comp *tfm, int decomp,
+			  const char *src, unsigned int slen, char *dst)
+{
+	unsigned int dlen = COMP_BUF_SIZE;
+
+	if (decomp)
+		return crypto_comp_decompress(tfm, src, slen, dst, &dlen);
+	return crypto_comp_compress(tfm, src, slen, dst, &dlen);
+}
+
+static int test_comp_jiffies(struct crypto_comp *tfm, int decomp,
+			     char **src, unsigned int *slen, char *dst,
+			     int sec)
+{
+	unsigned long start, end;
+	int pcount;
+	int ret;
+
+	for (start = jiffies, end = start + sec * HZ, pcount = 0;
+	     time_before(jiffies, end); pcount++) {
+		int i = pcount % TVMEMSIZE;
+
+		ret = do_one_comp_op(tfm, decomp, src[i], slen[i], dst);
+		if (ret)
+			return ret;
+	}
+
+	printk("%d pages in %d seconds (%lu MB/s)\n", pcount, sec,
+	       ((unsigned long)pcount * PAGE_SIZE / sec) >> 20);
+	return 0;
+}
+
+static int test_comp_cycles(struct crypto_comp *tfm, int decomp,
+			    char **src, unsigned int *slen, char *dst)
+{
+	unsigned long cycles = 0;
+	int ret = 0;
+	int i;
+
+	local_bh_disable();
+	local_irq_disable();
+
+	/* Warm-up run. */
+	for (i = 0; i < TVMEMSIZE; i++) {
+		ret = do_one_comp_op(tfm, decomp, src[i], slen[i], dst);
+		if (ret)
+			goto out;
+	}
+
+	/* The real thing. */
+	for (i = 0; i < 8 * TVMEMSIZE; i++) {
+		int p = i % TVMEMSIZE;
+		cycles_t start, end;
+
+		start = get_cycles();
+		ret = do_one_comp_op(tfm, decomp, src[p], slen[p], dst);
+		end = get_cycles();
+
+		if (ret)
+			goto out;
+
+		cycles += end - start;
+	}
+
+out:
+	local_irq_enable();
+	local_bh_enable();
+
+	if (ret == 0)
+		printk("1 page in %lu cycles\n",
+		       (cycles + 4 * TVMEMSIZE) / (8 * TVMEMSIZE));
+
+	return ret;
+}
+
+/*
+ * Compress and decompress one page of each kind from
+ * test_comp_fill_page(), the way zram does on swap-out and swap-in.
+ */
+static void test_comp_speed(const char *algo, unsigned int sec)
+{
+	struct crypto_comp *tfm;
+	char *comp[TVMEMSIZE] = { NULL };
+	unsigned int plen[TVMEMSIZE], clen[TVMEMSIZE];
+	unsigned int total = 0;
+	char *out;
+	int i, ret;
+
+	tfm = crypto_alloc_comp(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		printk(KERN_ERR "failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	printk(KERN_INFO "\ntesting speed of %s (%s)\n", algo,
+	       crypto_tfm_alg_driver_name(crypto_comp_tfm(tfm)));
+
+	out = kmalloc(COMP_BUF_SIZE, GFP_KERNEL);
+	if (!out)
+		goto out;
+
+	for (i = 0; i < TVMEMSIZE; i++) {
+		comp[i] = kmalloc(COMP_BUF_SIZE, GFP_KERNEL);
+		if (!comp[i])
+			goto out;
+
+		test_comp_fill_page(tvmem[i], i);
+		plen[i] = PAGE_SIZE;
+		clen[i] = COMP_BUF_SIZE;
+		ret = crypto_comp_compress(tfm, tvmem[i], plen[i], comp[i],
+					   &clen[i]);
+		if (ret) {
+			printk(KERN_ERR "compression failed: %d\n", ret);
+			goto out;
+		}
+		total += clen[i];
+	}
+
+	printk(KERN_INFO "%d pages compressed to %u bytes (%lu%%)\n",
+	       TVMEMSIZE, total, total * 100 / (TVMEMSIZE * PAGE_SIZE));
+
+	printk(KERN_INFO "compress: ");
+	if (sec)
+		ret = test_comp_jiffies(tfm, 0, tvmem, plen, out, sec);
+	else
+		ret = test_comp_cycles(tfm, 0, tvmem, plen, out);
+	if (ret) {
+		printk(KERN_ERR "compression failed: %d\n", ret);
+		goto out;
+	}
+
+	printk(KERN_INFO "decompress: ");
+	if (sec)
+		ret = test_comp_jiffies(tfm, 1, comp, clen, out, sec);
+	else
+		ret = test_comp_cycles(tfm, 1, comp, clen, out);
+	if (ret)
+		printk(KERN_ERR "decompression failed: %d\n", ret);
+
+out:
+	for (i = 0; i < TVMEMSIZE; i++)
+		kfree(comp[i]);
+	kfree(out);
+	crypto_free_comp(tfm);
+}
+
 static void test_cipher_speed(const char *algo, int enc, unsigned int sec,
 			      struct cipher_speed_template *template,
 			      unsigned int tcount, u8 *keysize)
@@ -1231,6 +1419,40 @@ static int do_test(int m)
 	case 499:
 		break;
 
+	case 500:
+		/* fall through */
+
+	case 501:
+		test_comp_speed("lzo", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 502:
+		test_comp_speed("lz4", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 503:
+		test_comp_speed("lz4hc", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 504:
+		test_comp_speed("lzo-generic", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 505:
+		test_comp_speed("lzo-wide", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 506:
+		test_comp_speed("lz4-generic", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 507:
+		test_comp_speed("lz4-wide", sec);
+		if (mode > 500 && mode < 600) break;
+
+	case 599:
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -32,6 +32,12 @@
 
 #include <trace/events/power.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_governor.h>
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(cpufreq_governor_load);
+EXPORT_TRACEPOINT_SYMBOL_GPL(cpufreq_governor_hotplug);
+
 /**
  * The "cpufreq driver" - the arch- or hardware-dependent low
  * level driver of CPUFreq support, and its spinlock. This lock
@@ -1451,6 +1457,10 @@ int __cpufreq_driver_target(struct cpufreq_policy *policy,
 
 	pr_debug("target for CPU %u: %u kHz, relation %u\n", policy->cpu,
 		target_freq, relation);
+	trace_cpufreq_governor_target(policy->governor ?
+				      policy->governor->name : "none",
+				      policy->cpu, policy->cur, target_freq,
+				      relation);
 	if (cpu_online(policy->cpu) && cpufreq_driver->target)
 		retval = cpufreq_driver->target(policy, target_freq, relation);
 
@@ -26,6 +26,7 @@
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/earlysuspend.h>
 #endif
+#include <trace/events/cpufreq_governor.h>
 
 /*
  * dbs is used in this file as a shortform for demandbased switching
@@ -395,6 +396,9 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 			max_load = load;
 	}
 
+	trace_cpufreq_governor_load(policy->governor->name, policy->cpu,
+				    max_load, policy->cur);
+
 	/*
 	 * break out if we 'cannot' reduce the speed as the user might
 	 * want freq_step to be zero
@@ -431,6 +435,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	if (num_online_cpus() < 2 && cpufreq_gov_lcd_status == 1) {
 		mutex_unlock(&this_dbs_info->timer_mutex);
 		/* hot-plug enable 2nd CPU */
+		trace_cpufreq_governor_hotplug(policy->governor->name, 1, true);
 		cpu_up(1);
 		mutex_lock(&this_dbs_info->timer_mutex);
 		printk("Conservative - Screen ON Hot-plug!\n");
@@ -438,6 +443,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	} else if (num_online_cpus() > 1 && cpufreq_gov_lcd_status == 0) {
 		mutex_unlock(&this_dbs_info->timer_mutex);
 		/* hot-unplug 2nd CPU */
+		trace_cpufreq_governor_hotplug(policy->governor->name, 1, false);
 		cpu_down(1);
 		printk("Conservative - Screen OFF Hot-unplug!\n");
 		mutex_lock(&this_dbs_info->timer_mutex);
@@ -29,6 +29,7 @@
 #include <linux/sched.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <trace/events/cpufreq_governor.h>
 
 /* greater than 80% avg load across online CPUs increases frequency */
 #define DEFAULT_UP_FREQ_MIN_LOAD			(80)
@@ -48,6 +49,21 @@
 /* default number of sampling periods to average before hotplug-out decision */
 #define DEFAULT_HOTPLUG_OUT_SAMPLING_PERIODS		(20)
 
+/*
+ * runnable threads per online CPU, in hundredths, at or above which a busy
+ * system plugs in an auxiliary CPU without waiting for the averaged load
+ */
+#define DEFAULT_NR_RUN_UP_THRESHOLD			(200)
+
+/*
+ * runnable threads per remaining CPU, in hundredths, that must be undercut
+ * before an auxiliary CPU is unplugged
+ */
+#define DEFAULT_NR_RUN_DOWN_THRESHOLD			(125)
+
+/* minimum time (uSec) an auxiliary CPU stays online before unplugging */
+#define DEFAULT_MIN_ONLINE_TIME				(1000000)
+
 static void do_dbs_timer(struct work_struct *work);
 static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 		unsigned int event);
@@ -99,6 +115,9 @@ static struct dbs_tuners {
 	unsigned int *hotplug_load_history;
 	unsigned int ignore_nice;
 	unsigned int io_is_busy;
+	unsigned int nr_run_up_threshold;
+	unsigned int nr_run_down_threshold;
+	unsigned int min_online_time;
 } dbs_tuners_ins = {
 	.sampling_rate =		DEFAULT_SAMPLING_PERIOD,
 	.up_threshold =			DEFAULT_UP_FREQ_MIN_LOAD,
@@ -109,8 +128,32 @@ static struct dbs_tuners {
 	.hotplug_load_index =		0,
 	.ignore_nice =			0,
 	.io_is_busy =			0,
+	.nr_run_up_threshold =		DEFAULT_NR_RUN_UP_THRESHOLD,
+	.nr_run_down_threshold =	DEFAULT_NR_RUN_DOWN_THRESHOLD,
+	.min_online_time =		DEFAULT_MIN_ONLINE_TIME,
 };
 
+/*
+ * hotplug decision accounting, updated from dbs_check_cpu under the
+ * timer_mutex and exported read-only in sysfs
+ */
+static struct hotplug_stats {
+	/* successful cpu_up/cpu_down calls */
+	unsigned long in_count;
+	unsigned long out_count;
+	/* plug-ins decided on runqueue depth before the load average */
+	unsigned long in_nr_run_count;
+	/* plug-outs held back by runqueue depth or min_online_time */
+	unsigned long out_nr_run_vetoed;
+	unsigned long out_min_online_vetoed;
+	/* time spent in cpu_up/cpu_down and time the auxiliary CPU was up */
+	u64 in_time_us;
+	u64 out_time_us;
+	u64 online_time_us;
+	/* when the auxiliary CPU was last plugged in */
+	ktime_t online_stamp;
+} hotplug_stats;
+
 /*
  * A corner case exists when switching io_is_busy at run-time: comparing idle
  * times from a non-io_is_busy period to an io_is_busy period (or vice-versa)
@@ -156,6 +199,25 @@ show_one(hotplug_in_sampling_periods, hotplug_in_sampling_periods);
 show_one(hotplug_out_sampling_periods, hotplug_out_sampling_periods);
 show_one(ignore_nice_load, ignore_nice);
 show_one(io_is_busy, io_is_busy);
+show_one(nr_run_up_threshold, nr_run_up_threshold);
+show_one(nr_run_down_threshold, nr_run_down_threshold);
+show_one(min_online_time, min_online_time);
+
+#define show_stat(file_name, object, format)				\
+static ssize_t show_##file_name						\
+(struct kobject *kobj, struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, format "\n", hotplug_stats.object);		\
+}									\
+define_one_global_ro(file_name)
+show_stat(hotplug_in_count, in_count, "%lu");
+show_stat(hotplug_out_count, out_count, "%lu");
+show_stat(hotplug_in_nr_run_count, in_nr_run_count, "%lu");
+show_stat(hotplug_out_nr_run_vetoed, out_nr_run_vetoed, "%lu");
+show_stat(hotplug_out_min_online_vetoed, out_min_online_vetoed, "%lu");
+show_stat(hotplug_in_time_us, in_time_us, "%llu");
+show_stat(hotplug_out_time_us, out_time_us, "%llu");
+show_stat(hotplug_online_time_us, online_time_us, "%llu");
 
 static ssize_t store_sampling_rate(struct kobject *a, struct attribute *b,
 				   const char *buf, size_t count)
@@ -378,6 +440,56 @@ static ssize_t store_io_is_busy(struct kobject *a, struct attribute *b,
 	return count;
 }
 
+static ssize_t store_nr_run_up_threshold(struct kobject *a,
+		struct attribute *b, const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+
+	if (ret != 1 || input <= dbs_tuners_ins.nr_run_down_threshold)
+		return -EINVAL;
+
+	mutex_lock(&dbs_mutex);
+	dbs_tuners_ins.nr_run_up_threshold = input;
+	mutex_unlock(&dbs_mutex);
+
+	return count;
+}
+
+static ssize_t store_nr_run_down_threshold(struct kobject *a,
+		struct attribute *b, const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+
+	if (ret != 1 || input >= dbs_tuners_ins.nr_run_up_threshold)
+		return -EINVAL;
+
+	mutex_lock(&dbs_mutex);
+	dbs_tuners_ins.nr_run_down_threshold = input;
+	mutex_unlock(&dbs_mutex);
+
+	return count;
+}
+
+static ssize_t store_min_online_time(struct kobject *a, struct attribute *b,
+				     const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&dbs_mutex);
+	dbs_tuners_ins.min_online_time = input;
+	mutex_unlock(&dbs_mutex);
+
+	return count;
+}
+
 define_one_global_rw(sampling_rate);
 define_one_global_rw(up_threshold);
 define_one_global_rw(down_differential);
@@ -386,6 +498,9 @@ define_one_global_rw(hotplug_in_sampling_periods);
 define_one_global_rw(hotplug_out_sampling_periods);
 define_one_global_rw(ignore_nice_load);
 define_one_global_rw(io_is_busy);
+define_one_global_rw(nr_run_up_threshold);
+define_one_global_rw(nr_run_down_threshold);
+define_one_global_rw(min_online_time);
 
 static struct attribute *dbs_attributes[] = {
 	&sampling_rate.attr,
@@ -396,6 +511,17 @@ static struct attribute *dbs_attributes[] = {
 	&hotplug_out_sampling_periods.attr,
 	&ignore_nice_load.attr,
 	&io_is_busy.attr,
+	&nr_run_up_threshold.attr,
+	&nr_run_down_threshold.attr,
+	&min_online_time.attr,
+	&hotplug_in_count.attr,
+	&hotplug_out_count.attr,
+	&hotplug_in_nr_run_count.attr,
+	&hotplug_out_nr_run_vetoed.attr,
+	&hotplug_out_min_online_vetoed.attr,
+	&hotplug_in_time_us.attr,
+	&hotplug_out_time_us.attr,
+	&hotplug_online_time_us.attr,
 	NULL
 };
 
@@ -406,6 +532,49 @@ static struct attribute_group dbs_attr_group = {
 
 /************************** sysfs end ************************/
 
+/*
+ * hotplug with cpufreq is nasty: a call to cpufreq_governor_dbs may cause
+ * a lockup, so the timer_mutex is dropped around cpu_up/cpu_down.
+ */
+static void dbs_cpu_up(struct cpu_dbs_info_s *this_dbs_info,
+		       unsigned int cpu)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	trace_cpufreq_governor_hotplug(this_dbs_info->cur_policy->governor->name,
+				       cpu, true);
+	mutex_unlock(&this_dbs_info->timer_mutex);
+	ret = cpu_up(cpu);
+	mutex_lock(&this_dbs_info->timer_mutex);
+
+	hotplug_stats.in_time_us += ktime_us_delta(ktime_get(), start);
+	if (!ret) {
+		hotplug_stats.in_count++;
+		hotplug_stats.online_stamp = ktime_get();
+	}
+}
+
+static void dbs_cpu_down(struct cpu_dbs_info_s *this_dbs_info,
+			 unsigned int cpu)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	trace_cpufreq_governor_hotplug(this_dbs_info->cur_policy->governor->name,
+				       cpu, false);
+	mutex_unlock(&this_dbs_info->timer_mutex);
+	ret = cpu_down(cpu);
+	mutex_lock(&this_dbs_info->timer_mutex);
+
+	hotplug_stats.out_time_us += ktime_us_delta(ktime_get(), start);
+	if (!ret) {
+		hotplug_stats.out_count++;
+		hotplug_stats.online_time_us +=
+			ktime_us_delta(start, hotplug_stats.online_stamp);
+	}
+}
+
 static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 {
 	/* combined load of all enabled CPUs */
@@ -421,6 +590,10 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	unsigned int hotplug_out_avg_load = 0;
 	/* number of sampling periods averaged for hotplug decisions */
 	unsigned int periods;
+	/* runnable threads across the system, in hundredths */
+	unsigned int nr_run;
+	unsigned int online = num_online_cpus();
+	s64 online_time;
 
 	struct cpufreq_policy *policy;
 	unsigned int i, j;
@@ -469,6 +642,9 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	/* use the max load in the OPP freq change policy */
 	max_load_freq = max_load * policy->cur;
 
+	trace_cpufreq_governor_load(policy->governor->name, policy->cpu,
+				    max_load, policy->cur);
+
 	/* calculate the average load across all related CPUs */
 	avg_load = total_load / num_online_cpus();
 
@@ -510,18 +686,22 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	if (++dbs_tuners_ins.hotplug_load_index == periods)
 		dbs_tuners_ins.hotplug_load_index = 0;
 
-	/* check if auxiliary CPU is needed based on avg_load */
-	if (avg_load > dbs_tuners_ins.up_threshold) {
-		/* should we enable auxillary CPUs? */
-		if (num_online_cpus() < 2 && hotplug_in_avg_load >
-				dbs_tuners_ins.up_threshold) {
-			/* hotplug with cpufreq is nasty
-			 * a call to cpufreq_governor_dbs may cause a lockup.
-			 * wq is not running here so its safe.
-			 */
-			mutex_unlock(&this_dbs_info->timer_mutex);
-			cpu_up(1);
-			mutex_lock(&this_dbs_info->timer_mutex);
+	/* the scheduler's nr_running average already spans ~270ms */
+	nr_run = (avg_nr_running() * 100) >> FSHIFT;
+
+	/*
+	 * check if auxiliary CPU is needed based on avg_load, either because
+	 * the load stayed high for hotplug_in_sampling_periods or because
+	 * threads are already queueing up behind the online CPUs
+	 */
+	if (avg_load > dbs_tuners_ins.up_threshold && online < 2) {
+		if (hotplug_in_avg_load > dbs_tuners_ins.up_threshold) {
+			dbs_cpu_up(this_dbs_info, 1);
+			goto out;
+		}
+		if (nr_run >= dbs_tuners_ins.nr_run_up_threshold * online) {
+			hotplug_stats.in_nr_run_count++;
+			dbs_cpu_up(this_dbs_info, 1);
 			goto out;
 		}
 	}
@@ -541,12 +721,26 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 		/* are we at the minimum frequency already? */
 		if (policy->cur == policy->min) {
 			/* should we disable auxillary CPUs? */
-			if (num_online_cpus() > 1 && hotplug_out_avg_load <
-					dbs_tuners_ins.down_threshold) {
-				mutex_unlock(&this_dbs_info->timer_mutex);
-				cpu_down(1);
-				mutex_lock(&this_dbs_info->timer_mutex);
+			if (online < 2 || hotplug_out_avg_load >=
+					dbs_tuners_ins.down_threshold)
+				goto out;
+
+			/* would the remaining CPUs have threads waiting? */
+			if (nr_run >= dbs_tuners_ins.nr_run_down_threshold *
+					(online - 1)) {
+				hotplug_stats.out_nr_run_vetoed++;
+				goto out;
+			}
+
+			/* don't flap: keep it up for at least min_online_time */
+			online_time = ktime_us_delta(ktime_get(),
+					hotplug_stats.online_stamp);
+			if (online_time < dbs_tuners_ins.min_online_time) {
+				hotplug_stats.out_min_online_vetoed++;
+				goto out;
 			}
+
+			dbs_cpu_down(this_dbs_info, 1);
 			goto out;
 		}
 	}
@@ -646,6 +840,8 @@ static int cpufreq_governor_dbs(struct cpufreq_policy *policy,
 		}
 		this_dbs_info->cpu = cpu;
 		this_dbs_info->freq_table = cpufreq_frequency_get_table(cpu);
+		/* CPUs found online count as just plugged in */
+		hotplug_stats.online_stamp = ktime_get();
 		/*
 		 * Start the timerschedule work, when this governor
 		 * is used for first time
@@ -33,6 +33,7 @@
 #include <linux/kernel_stat.h>
 #include <asm/cputime.h>
 #include <linux/input.h>
+#include <trace/events/cpufreq_governor.h>
 
 static int active_count;
 
@@ -429,6 +430,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	loadadjfreq = (unsigned int)cputime_speedadj * 100;
 	cpu_load = loadadjfreq / pcpu->target_freq;
 	pcpu->prev_load = cpu_load;
+	trace_cpufreq_governor_load(pcpu->policy->governor->name, data,
+				    cpu_load, pcpu->target_freq);
 	boosted = boost_val || now < boostpulse_endtime;
 
 	// HACK HACK HACK BEGIN
@@ -30,6 +30,7 @@
 #include <linux/earlysuspend.h>
 #endif
 #include <linux/rq_stats.h>
+#include <trace/events/cpufreq_governor.h>
 
 #define INTELLIDEMAND_VERSION	3.2
 
@@ -1116,6 +1117,8 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	load_at_max_freq = (cur_load * policy->cur)/policy->cpuinfo.max_freq;
 
 	cpufreq_notify_utilization(policy, load_at_max_freq);
+	trace_cpufreq_governor_load(policy->governor->name, policy->cpu,
+				    max_load_freq / policy->cur, policy->cur);
 
 	/* Check for frequency increase */
 	if (max_load_freq > dbs_tuners_ins.up_threshold * policy->cur) {
@@ -1395,6 +1398,8 @@ static void do_dbs_timer(struct work_struct *work)
 					persist_count--;
 
 				if (num_online_cpus() == 2 && persist_count == 0) {
+					trace_cpufreq_governor_hotplug(
+						"intellidemand", 1, false);
 					cpu_down(1);
 #ifdef CONFIG_CPUFREQ_ID_PERFLOCK
 					saved_policy_min = policy->min;
@@ -1405,6 +1410,8 @@ static void do_dbs_timer(struct work_struct *work)
 			case 2:
 				persist_count = 8;
 				if (num_online_cpus() == 1) {
+					trace_cpufreq_governor_hotplug(
+						"intellidemand", 1, true);
 					cpu_up(1);
 #ifdef CONFIG_CPUFREQ_ID_PERFLOCK
 					policy->min = saved_policy_min;
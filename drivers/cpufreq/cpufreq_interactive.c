@@ -30,6 +30,7 @@
 #include <linux/slab.h>
 #include <linux/input.h>
 #include <asm/cputime.h>
+#include <trace/events/cpufreq_governor.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/cpufreq_interactive.h>
@@ -56,7 +57,19 @@ struct cpufreq_interactive_cpuinfo {
 	unsigned int floor_freq;
 	u64 floor_validate_time;
 	u64 hispeed_validate_time;
+	struct cpufreq_load_map max_load_map;
+	struct cpufreq_load_map hispeed_load_map;
 	int governor_enabled;
+#ifdef CONFIG_CPU_FREQ_INTERACTIVE_TIMER_STATS
+	unsigned long timer_samples;
+	u64 timer_ns;
+	u64 timer_ns_max;
+#endif
+#ifdef CONFIG_SCHED_FREQ_HINTS
+	int sched_hint;
+	unsigned long hint_kick;
+	struct call_single_data hint_csd;
+#endif
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -112,6 +125,16 @@ static struct workqueue_struct *inputopen_wq;
 
 static int boost_val;
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+/*
+ * Non-zero means sample a cpu at the next tick when the scheduler reports
+ * load arriving on it, instead of waiting for the rest of timer_rate.
+ */
+static int sched_hints_val;
+static int sched_hints_registered;
+static DEFINE_MUTEX(sched_hints_mutex);
+#endif
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -131,7 +154,7 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
-static void cpufreq_interactive_timer(unsigned long data)
+static void __cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
 	unsigned int delta_time;
@@ -144,6 +167,9 @@ static void cpufreq_interactive_timer(unsigned long data)
 	u64 now_idle;
 	unsigned int new_freq;
 	unsigned int index;
+	struct cpufreq_load_map *load_map = NULL;
+	unsigned int base_freq = 0;
+	int err;
 	unsigned long flags;
 
 	smp_rmb();
@@ -151,6 +177,10 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (!pcpu->governor_enabled)
 		goto exit;
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+	pcpu->sched_hint = 0;
+#endif
+
 	/*
 	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
 	 * this lets idle exit know the current idle time sample has
@@ -203,6 +233,9 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
+	trace_cpufreq_governor_load(pcpu->policy->governor->name, data,
+				    cpu_load, pcpu->policy->cur);
+
 	if (cpu_load >= go_hispeed_load || boost_val) {
 		if (pcpu->target_freq < hispeed_freq &&
 		    hispeed_freq < pcpu->policy->max) {
@@ -210,8 +243,12 @@ static void cpufreq_interactive_timer(unsigned long data)
 		} else {
 			new_freq = pcpu->policy->max * cpu_load / 100;
 
-			if (new_freq < hispeed_freq)
+			if (new_freq < hispeed_freq) {
 				new_freq = hispeed_freq;
+			} else {
+				load_map = &pcpu->max_load_map;
+				base_freq = pcpu->policy->max;
+			}
 
 			if (pcpu->target_freq == hispeed_freq &&
 			    new_freq > hispeed_freq &&
@@ -226,14 +263,27 @@ static void cpufreq_interactive_timer(unsigned long data)
 		}
 	} else {
 		new_freq = hispeed_freq * cpu_load / 100;
+		load_map = &pcpu->hispeed_load_map;
+		base_freq = hispeed_freq;
 	}
 
 	if (new_freq <= hispeed_freq)
 		pcpu->hispeed_validate_time = pcpu->timer_run_time;
 
-	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
-					   new_freq, CPUFREQ_RELATION_H,
-					   &index)) {
+	if (load_map)
+		err = cpufreq_frequency_table_load_target(pcpu->policy,
+							  pcpu->freq_table,
+							  load_map, base_freq,
+							  cpu_load,
+							  CPUFREQ_RELATION_H,
+							  &index);
+	else
+		err = cpufreq_frequency_table_target(pcpu->policy,
+						     pcpu->freq_table,
+						     new_freq,
+						     CPUFREQ_RELATION_H,
+						     &index);
+	if (err) {
 		pr_warn_once("timer %d: cpufreq_frequency_table_target error\n",
 			     (int) data);
 		goto rearm;
@@ -309,6 +359,30 @@ exit:
 	return;
 }
 
+#ifdef CONFIG_CPU_FREQ_INTERACTIVE_TIMER_STATS
+/*
+ * Account the cost of every sample, lookups, tracing and re-arming
+ * included. The timer only runs on its own cpu, so the counters need no
+ * locking; a reader on another cpu may see a torn update.
+ */
+static void cpufreq_interactive_timer(unsigned long data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, data);
+	u64 start = sched_clock();
+	u64 ns;
+
+	__cpufreq_interactive_timer(data);
+
+	ns = sched_clock() - start;
+	pcpu->timer_samples++;
+	pcpu->timer_ns += ns;
+	if (ns > pcpu->timer_ns_max)
+		pcpu->timer_ns_max = ns;
+}
+#else
+#define cpufreq_interactive_timer __cpufreq_interactive_timer
+#endif
+
 static void cpufreq_interactive_idle_start(void)
 {
 	struct cpufreq_interactive_cpuinfo *pcpu =
@@ -361,10 +435,22 @@ static void cpufreq_interactive_idle_start(void)
 
 }
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+/*
+ * Expiry for a sample cut short by a scheduler load hint: the first tick
+ * at least 1ms away, the shortest sample the timer function evaluates.
+ */
+static inline unsigned long cpufreq_interactive_hint_expires(void)
+{
+	return jiffies + usecs_to_jiffies(USEC_PER_MSEC) + 1;
+}
+#endif
+
 static void cpufreq_interactive_idle_end(void)
 {
 	struct cpufreq_interactive_cpuinfo *pcpu =
 		&per_cpu(cpuinfo, smp_processor_id());
+	unsigned long expires;
 
 	if (!pcpu->governor_enabled)
 		return;
@@ -390,8 +476,13 @@ static void cpufreq_interactive_idle_end(void)
 			get_cpu_idle_time_us(smp_processor_id(),
 					     &pcpu->idle_exit_time);
 		pcpu->timer_idlecancel = 0;
-		mod_timer(&pcpu->cpu_timer,
-			  jiffies + usecs_to_jiffies(timer_rate));
+		expires = jiffies + usecs_to_jiffies(timer_rate);
+#ifdef CONFIG_SCHED_FREQ_HINTS
+		/* Load was queued on us while idle, don't wait timer_rate */
+		if (pcpu->sched_hint)
+			expires = cpufreq_interactive_hint_expires();
+#endif
+		mod_timer(&pcpu->cpu_timer, expires);
 	}
 
 }
@@ -446,11 +537,15 @@ static int cpufreq_interactive_speedchange_task(void *data)
 			/* only master CPU is alive and Screen is ON */
 			if (num_online_cpus() < 2 && cpufreq_gov_lcd_status_interactive == 1) {
 				/* hot-plug enable 2nd CPU */
+				trace_cpufreq_governor_hotplug(
+					pcpu->policy->governor->name, 1, true);
 				cpu_up(1);
 				printk("Interactive - Screen ON Hot-plug!\n");
 			/* Both CPUs are up and Screen is OFF */
 			} else if (num_online_cpus() > 1 && cpufreq_gov_lcd_status_interactive == 0) {
 				/* hot-unplug 2nd CPU */
+				trace_cpufreq_governor_hotplug(
+					pcpu->policy->governor->name, 1, false);
 				cpu_down(1);
 				printk("Interactive - Screen OFF Hot-unplug!\n");
 			}
@@ -468,6 +563,95 @@ static int cpufreq_interactive_speedchange_task(void *data)
 	return 0;
 }
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+/*
+ * Pull in the sample timer of the current cpu. If it is not pending the
+ * cpu is idle at min speed and idle exit will start a short sample.
+ * Called with interrupts off, so the timer cannot fire under us.
+ */
+static void cpufreq_interactive_hint_rearm(void)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+	unsigned long expires;
+
+	if (!pcpu->governor_enabled || !timer_pending(&pcpu->cpu_timer))
+		return;
+
+	expires = cpufreq_interactive_hint_expires();
+	if (time_before(expires, pcpu->cpu_timer.expires))
+		mod_timer_pinned(&pcpu->cpu_timer, expires);
+}
+
+static void cpufreq_interactive_hint_kick(void *info)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, smp_processor_id());
+
+	clear_bit(0, &pcpu->hint_kick);
+	cpufreq_interactive_hint_rearm();
+}
+
+/*
+ * Called by the scheduler with a runqueue lock held, so only the timer
+ * may be touched here; the timer function does the rest. The timer is
+ * only modified on its own cpu, a hint for another cpu is passed on
+ * with an IPI, one at a time, when it has a sample to cut short.
+ */
+static int cpufreq_interactive_sched_hint(struct notifier_block *nb,
+					  unsigned long event, void *data)
+{
+	struct sched_load_hint *hint = data;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	/* Only arriving load can call for a higher speed. */
+	if (event == SCHED_LOAD_DEQUEUE || hint->delta <= 0)
+		return NOTIFY_DONE;
+
+	pcpu = &per_cpu(cpuinfo, hint->cpu);
+	smp_rmb();
+
+	if (!pcpu->governor_enabled ||
+	    pcpu->target_freq == pcpu->policy->max)
+		return NOTIFY_DONE;
+
+	pcpu->sched_hint = 1;
+
+	if (hint->cpu == smp_processor_id())
+		cpufreq_interactive_hint_rearm();
+#ifdef CONFIG_SMP
+	else if (cpu_online(hint->cpu) && timer_pending(&pcpu->cpu_timer) &&
+		 !test_and_set_bit(0, &pcpu->hint_kick))
+		__smp_call_function_single(hint->cpu, &pcpu->hint_csd, 0);
+#endif
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block cpufreq_interactive_sched_nb = {
+	.notifier_call = cpufreq_interactive_sched_hint,
+};
+
+/* (Un)register for load hints as sched_hints and governor use dictate */
+static void cpufreq_interactive_sched_hints_update(void)
+{
+	int want;
+
+	mutex_lock(&sched_hints_mutex);
+	want = sched_hints_val && atomic_read(&active_count) > 0;
+
+	if (want && !sched_hints_registered)
+		register_sched_load_notifier(&cpufreq_interactive_sched_nb);
+	else if (!want && sched_hints_registered)
+		unregister_sched_load_notifier(&cpufreq_interactive_sched_nb);
+
+	sched_hints_registered = want;
+	mutex_unlock(&sched_hints_mutex);
+}
+#else
+static inline void cpufreq_interactive_sched_hints_update(void) { }
+#endif
+
 static void cpufreq_interactive_boost(void)
 {
 	int i;
@@ -775,6 +959,73 @@ static ssize_t store_boostpulse(struct kobject *kobj, struct attribute *attr,
 static struct global_attr boostpulse =
 	__ATTR(boostpulse, 0200, NULL, store_boostpulse);
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+static ssize_t show_sched_hints(struct kobject *kobj, struct attribute *attr,
+				char *buf)
+{
+	return sprintf(buf, "%d\n", sched_hints_val);
+}
+
+static ssize_t store_sched_hints(struct kobject *kobj, struct attribute *attr,
+				 const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	sched_hints_val = !!val;
+	cpufreq_interactive_sched_hints_update();
+	return count;
+}
+
+define_one_global_rw(sched_hints);
+#endif
+
+#ifdef CONFIG_CPU_FREQ_INTERACTIVE_TIMER_STATS
+static ssize_t show_timer_stats(struct kobject *kobj, struct attribute *attr,
+				char *buf)
+{
+	ssize_t len = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+		unsigned long samples = pcpu->timer_samples;
+
+		if (!samples)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "cpu%d %lu %llu %llu\n", cpu, samples,
+				 div_u64(pcpu->timer_ns, samples),
+				 pcpu->timer_ns_max);
+	}
+	return len;
+}
+
+/* Any write clears the counters, to start a new measurement */
+static ssize_t store_timer_stats(struct kobject *kobj, struct attribute *attr,
+				 const char *buf, size_t count)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+
+		pcpu->timer_samples = 0;
+		pcpu->timer_ns = 0;
+		pcpu->timer_ns_max = 0;
+	}
+	return count;
+}
+
+define_one_global_rw(timer_stats);
+#endif
+
 static struct attribute *interactive_attributes[] = {
 	&hispeed_freq_attr.attr,
 	&go_hispeed_load_attr.attr,
@@ -784,6 +1035,12 @@ static struct attribute *interactive_attributes[] = {
 	&input_boost.attr,
 	&boost.attr,
 	&boostpulse.attr,
+#ifdef CONFIG_SCHED_FREQ_HINTS
+	&sched_hints.attr,
+#endif
+#ifdef CONFIG_CPU_FREQ_INTERACTIVE_TIMER_STATS
+	&timer_stats.attr,
+#endif
 	NULL,
 };
 
@@ -833,6 +1090,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->policy = policy;
 			pcpu->target_freq = policy->cur;
 			pcpu->freq_table = freq_table;
+			pcpu->max_load_map.table = NULL;
+			pcpu->hispeed_load_map.table = NULL;
 			pcpu->target_set_time_in_idle =
 				get_cpu_idle_time_us(j,
 					     &pcpu->target_set_time);
@@ -869,6 +1128,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 				__func__);
 
 		idle_notifier_register(&cpufreq_interactive_idle_nb);
+		cpufreq_interactive_sched_hints_update();
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -891,6 +1151,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		cpufreq_interactive_sched_hints_update();
 		idle_notifier_unregister(&cpufreq_interactive_idle_nb);
 		input_unregister_handler(&cpufreq_interactive_input_handler);
 		sysfs_remove_group(cpufreq_global_kobject,
@@ -948,6 +1209,9 @@ static int __init cpufreq_interactive_init(void)
 		init_timer(&pcpu->cpu_timer);
 		pcpu->cpu_timer.function = cpufreq_interactive_timer;
 		pcpu->cpu_timer.data = i;
+#ifdef CONFIG_SCHED_FREQ_HINTS
+		pcpu->hint_csd.func = cpufreq_interactive_hint_kick;
+#endif
 	}
 
 	spin_lock_init(&speedchange_cpumask_lock);
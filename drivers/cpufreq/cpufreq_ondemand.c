@@ -25,6 +25,7 @@
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/earlysuspend.h>
 #endif
+#include <trace/events/cpufreq_governor.h>
 
 /*
  * dbs is used in this file as a shortform for demandbased switching
@@ -612,6 +613,8 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	load_at_max_freq = (cur_load * policy->cur)/policy->cpuinfo.max_freq;
 
 	cpufreq_notify_utilization(policy, load_at_max_freq);
+	trace_cpufreq_governor_load(policy->governor->name, policy->cpu,
+				    max_load_freq / policy->cur, policy->cur);
 
 	/* Check for frequency increase */
 	if (max_load_freq > dbs_tuners_ins.up_threshold * policy->cur) {
@@ -660,6 +663,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	if (num_online_cpus() < 2 && cpufreq_gov_lcd_status == 1) {
 		mutex_unlock(&this_dbs_info->timer_mutex);
 		/* hot-plug enable 2nd CPU */
+		trace_cpufreq_governor_hotplug(policy->governor->name, 1, true);
 		cpu_up(1);
 		mutex_lock(&this_dbs_info->timer_mutex);
 		printk("OnDemand - Screen ON Hot-plug!\n");
@@ -667,6 +671,7 @@ static void dbs_check_cpu(struct cpu_dbs_info_s *this_dbs_info)
 	} else if (num_online_cpus() > 1 && cpufreq_gov_lcd_status == 0) {
 		mutex_unlock(&this_dbs_info->timer_mutex);
 		/* hot-unplug 2nd CPU */
+		trace_cpufreq_governor_hotplug(policy->governor->name, 1, false);
 		cpu_down(1);
 		printk("OnDemand - Screen OFF Hot-unplug!\n");
 		mutex_lock(&this_dbs_info->timer_mutex);
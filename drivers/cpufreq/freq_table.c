@@ -14,6 +14,8 @@
 #include <linux/init.h>
 #include <linux/cpufreq.h>
 #include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/rcupdate.h>
 
 /*********************************************************************
  *                     FREQUENCY TABLE HELPERS                       *
@@ -92,12 +94,145 @@ int cpufreq_frequency_table_verify(struct cpufreq_policy *policy,
 EXPORT_SYMBOL_GPL(cpufreq_frequency_table_verify);
 
 
+/*
+ * Governors look up a target frequency on every sample, on every cpu. For
+ * the table registered through cpufreq_frequency_table_get_attr() we keep
+ * the valid entries sorted by frequency, so that a lookup is two binary
+ * searches instead of a scan of the whole table. policy->min/max are
+ * applied at lookup time, so the index never has to be rebuilt when the
+ * limits change.
+ */
+struct cpufreq_freq_index {
+	struct rcu_head rcu;
+	struct cpufreq_frequency_table *table;
+	unsigned int count;
+	struct {
+		unsigned int frequency;
+		unsigned int index;	/* position in table */
+	} entry[0];
+};
+
+static DEFINE_PER_CPU(struct cpufreq_freq_index __rcu *, cpufreq_freq_index);
+
+static struct cpufreq_freq_index *
+cpufreq_freq_index_build(struct cpufreq_frequency_table *table)
+{
+	struct cpufreq_freq_index *idx;
+	unsigned int i, j, count = 0;
+
+	for (i = 0; (table[i].frequency != CPUFREQ_TABLE_END); i++)
+		if (table[i].frequency != CPUFREQ_ENTRY_INVALID)
+			count++;
+
+	idx = kmalloc(sizeof(*idx) + count * sizeof(idx->entry[0]),
+		      GFP_KERNEL);
+	if (!idx)
+		return NULL;
+
+	idx->table = table;
+	idx->count = 0;
+
+	/* insertion sort, stable so equal frequencies keep table order */
+	for (i = 0; (table[i].frequency != CPUFREQ_TABLE_END); i++) {
+		unsigned int freq = table[i].frequency;
+		if (freq == CPUFREQ_ENTRY_INVALID)
+			continue;
+		for (j = idx->count; j && idx->entry[j - 1].frequency > freq; j--)
+			idx->entry[j] = idx->entry[j - 1];
+		idx->entry[j].frequency = freq;
+		idx->entry[j].index = i;
+		idx->count++;
+	}
+
+	return idx;
+}
+
+/* first entry with frequency >= freq, or count if none */
+static unsigned int cpufreq_freq_index_lower(struct cpufreq_freq_index *idx,
+					     unsigned int freq)
+{
+	unsigned int lo = 0, hi = idx->count;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (idx->entry[mid].frequency < freq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* first entry with frequency > freq, or count if none */
+static unsigned int cpufreq_freq_index_upper(struct cpufreq_freq_index *idx,
+					     unsigned int freq)
+{
+	unsigned int lo = 0, hi = idx->count;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (idx->entry[mid].frequency <= freq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Same result as the table scan in cpufreq_frequency_table_target(),
+ * including which of several equal frequencies is picked (the last one).
+ */
+static int cpufreq_freq_index_target(struct cpufreq_freq_index *idx,
+				     struct cpufreq_policy *policy,
+				     unsigned int target_freq,
+				     unsigned int relation,
+				     unsigned int *index)
+{
+	unsigned int n = idx->count;
+	unsigned int i;
+
+	switch (relation) {
+	case CPUFREQ_RELATION_L:
+		/* lowest at or above target, else highest within limits */
+		i = cpufreq_freq_index_lower(idx, max(target_freq, policy->min));
+		if (i < n && idx->entry[i].frequency <= policy->max)
+			break;
+		i = cpufreq_freq_index_upper(idx, policy->max);
+		if (i && idx->entry[i - 1].frequency >= policy->min) {
+			i--;
+			break;
+		}
+		return -EINVAL;
+	case CPUFREQ_RELATION_H:
+		/* highest at or below target, else lowest within limits */
+		i = cpufreq_freq_index_upper(idx, min(target_freq, policy->max));
+		if (i && idx->entry[i - 1].frequency >= policy->min) {
+			i--;
+			break;
+		}
+		i = cpufreq_freq_index_lower(idx, policy->min);
+		if (i < n && idx->entry[i].frequency <= policy->max)
+			break;
+		return -EINVAL;
+	default:
+		return -EINVAL;
+	}
+
+	while (i + 1 < n && idx->entry[i + 1].frequency == idx->entry[i].frequency)
+		i++;
+
+	*index = idx->entry[i].index;
+	return 0;
+}
+
 int cpufreq_frequency_table_target(struct cpufreq_policy *policy,
 				   struct cpufreq_frequency_table *table,
 				   unsigned int target_freq,
 				   unsigned int relation,
 				   unsigned int *index)
 {
+	struct cpufreq_freq_index *idx;
 	struct cpufreq_frequency_table optimal = {
 		.index = ~0,
 		.frequency = 0,
@@ -123,6 +258,20 @@ int cpufreq_frequency_table_target(struct cpufreq_policy *policy,
 	if (!cpu_online(policy->cpu))
 		return -EINVAL;
 
+	rcu_read_lock();
+	idx = rcu_dereference(per_cpu(cpufreq_freq_index, policy->cpu));
+	if (idx && idx->table == table &&
+	    (relation == CPUFREQ_RELATION_L || relation == CPUFREQ_RELATION_H)) {
+		int ret = cpufreq_freq_index_target(idx, policy, target_freq,
+						    relation, index);
+		rcu_read_unlock();
+		if (!ret)
+			pr_debug("target is %u (%u kHz, %u)\n", *index,
+				 table[*index].frequency, table[*index].index);
+		return ret;
+	}
+	rcu_read_unlock();
+
 	for (i = 0; (table[i].frequency != CPUFREQ_TABLE_END); i++) {
 		unsigned int freq = table[i].frequency;
 		if (freq == CPUFREQ_ENTRY_INVALID)
@@ -172,6 +321,64 @@ int cpufreq_frequency_table_target(struct cpufreq_policy *policy,
 }
 EXPORT_SYMBOL_GPL(cpufreq_frequency_table_target);
 
+static void cpufreq_load_map_build(struct cpufreq_policy *policy,
+				   struct cpufreq_frequency_table *table,
+				   struct cpufreq_load_map *map,
+				   unsigned int base_freq,
+				   unsigned int relation)
+{
+	unsigned int load, index;
+
+	for (load = 0; load < CPUFREQ_LOAD_MAP_SIZE; load++) {
+		if (cpufreq_frequency_table_target(policy, table,
+						   base_freq * load / 100,
+						   relation, &index))
+			map->index[load] = -1;
+		else
+			map->index[load] = index;
+	}
+
+	map->table = table;
+	map->base_freq = base_freq;
+	map->min = policy->min;
+	map->max = policy->max;
+	map->relation = relation;
+}
+
+/*
+ * Same result as cpufreq_frequency_table_target() for a target of
+ * base_freq * load / 100, from a map built on first use and again after
+ * any of its inputs change.
+ */
+int cpufreq_frequency_table_load_target(struct cpufreq_policy *policy,
+					struct cpufreq_frequency_table *table,
+					struct cpufreq_load_map *map,
+					unsigned int base_freq,
+					unsigned int load,
+					unsigned int relation,
+					unsigned int *index)
+{
+	if (!cpu_online(policy->cpu))
+		return -EINVAL;
+
+	if (load >= CPUFREQ_LOAD_MAP_SIZE)
+		return cpufreq_frequency_table_target(policy, table,
+						      base_freq * load / 100,
+						      relation, index);
+
+	if (map->table != table || map->base_freq != base_freq ||
+	    map->min != policy->min || map->max != policy->max ||
+	    map->relation != relation)
+		cpufreq_load_map_build(policy, table, map, base_freq, relation);
+
+	if (map->index[load] < 0)
+		return -EINVAL;
+
+	*index = map->index[load];
+	return 0;
+}
+EXPORT_SYMBOL_GPL(cpufreq_frequency_table_load_target);
+
 int cpufreq_frequency_table_next_lowest(struct cpufreq_policy *policy,
 		struct cpufreq_frequency_table *table, int *index)
 {
@@ -283,11 +490,24 @@ EXPORT_SYMBOL_GPL(cpufreq_freq_attr_scaling_available_freqs);
  * if you use these, you must assure that the frequency table is valid
  * all the time between get_attr and put_attr!
  */
+static void cpufreq_freq_index_set(unsigned int cpu,
+				   struct cpufreq_freq_index *idx)
+{
+	struct cpufreq_freq_index *old;
+
+	old = rcu_dereference_protected(per_cpu(cpufreq_freq_index, cpu), 1);
+	rcu_assign_pointer(per_cpu(cpufreq_freq_index, cpu), idx);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
 void cpufreq_frequency_table_get_attr(struct cpufreq_frequency_table *table,
 				      unsigned int cpu)
 {
 	pr_debug("setting show_table for cpu %u to %p\n", cpu, table);
 	per_cpu(cpufreq_show_table, cpu) = table;
+	/* if this fails lookups just fall back to scanning the table */
+	cpufreq_freq_index_set(cpu, cpufreq_freq_index_build(table));
 }
 EXPORT_SYMBOL_GPL(cpufreq_frequency_table_get_attr);
 
@@ -295,6 +515,7 @@ void cpufreq_frequency_table_put_attr(unsigned int cpu)
 {
 	pr_debug("clearing show_table for cpu %u\n", cpu);
 	per_cpu(cpufreq_show_table, cpu) = NULL;
+	cpufreq_freq_index_set(cpu, NULL);
 }
 EXPORT_SYMBOL_GPL(cpufreq_frequency_table_put_attr);
 
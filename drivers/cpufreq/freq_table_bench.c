@@ -0,0 +1,135 @@
+/*
+ * linux/drivers/cpufreq/freq_table_bench.c
+ *
+ * Times the frequency table lookups made from the governor sampling
+ * timers: the full table scan, the sorted index and the per-load map.
+ * Load it with "modprobe freq_table_bench [iterations=N]"; the results
+ * go to the kernel log and the module refuses to stay loaded.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "lookups per method and cpu");
+
+enum { BENCH_SCAN, BENCH_INDEX, BENCH_MAP };
+
+static const char *bench_name[] = { "scan", "index", "load map" };
+
+/* nanoseconds per lookup, sweeping load over 0..100 like a governor */
+static u64 bench_run(int method, struct cpufreq_policy *policy,
+		     struct cpufreq_frequency_table *table,
+		     struct cpufreq_load_map *map)
+{
+	unsigned int i, load, index;
+	u64 start, elapsed;
+
+	start = sched_clock();
+	for (i = 0, load = 0; i < iterations; i++) {
+		switch (method) {
+		case BENCH_SCAN:
+		case BENCH_INDEX:
+			cpufreq_frequency_table_target(policy, table,
+						       policy->max * load / 100,
+						       CPUFREQ_RELATION_H,
+						       &index);
+			break;
+		case BENCH_MAP:
+			cpufreq_frequency_table_load_target(policy, table, map,
+							    policy->max, load,
+							    CPUFREQ_RELATION_H,
+							    &index);
+			break;
+		}
+		if (++load == CPUFREQ_LOAD_MAP_SIZE)
+			load = 0;
+	}
+	elapsed = sched_clock() - start;
+
+	return div_u64(elapsed, iterations);
+}
+
+static void bench_cpu(unsigned int cpu)
+{
+	struct cpufreq_frequency_table *table, *copy;
+	struct cpufreq_policy *policy;
+	struct cpufreq_load_map *map;
+	unsigned int n = 0;
+	int method;
+
+	table = cpufreq_frequency_get_table(cpu);
+	if (!table)
+		return;
+
+	policy = cpufreq_cpu_get(cpu);
+	if (!policy)
+		return;
+
+	while (table[n].frequency != CPUFREQ_TABLE_END)
+		n++;
+
+	/*
+	 * Only the registered table is indexed, so a copy of it takes the
+	 * scan that every lookup used to do.
+	 */
+	copy = kmemdup(table, (n + 1) * sizeof(*table), GFP_KERNEL);
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!copy || !map)
+		goto out;
+
+	for (method = BENCH_SCAN; method <= BENCH_MAP; method++) {
+		u64 ns;
+
+		preempt_disable();
+		ns = bench_run(method, policy,
+			       method == BENCH_SCAN ? copy : table, map);
+		preempt_enable();
+
+		pr_info("cpu%u: %u entries, %s: %llu ns/lookup\n",
+			cpu, n, bench_name[method], ns);
+	}
+
+out:
+	kfree(map);
+	kfree(copy);
+	cpufreq_cpu_put(policy);
+}
+
+static int __init freq_table_bench_init(void)
+{
+	unsigned int cpu;
+
+	if (!iterations)
+		return -EINVAL;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		bench_cpu(cpu);
+	put_online_cpus();
+
+	/* nothing to keep around, the results are in the log */
+	return -EAGAIN;
+}
+
+static void __exit freq_table_bench_exit(void)
+{
+}
+
+module_init(freq_table_bench_init);
+module_exit(freq_table_bench_exit);
+
+MODULE_DESCRIPTION("cpufreq frequency table lookup benchmark");
+MODULE_LICENSE("GPL");
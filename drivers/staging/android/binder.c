@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -107,6 +108,12 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+static unsigned int binder_warm_pages = 4;
+module_param_named(warm_pages, binder_warm_pages, uint, S_IWUSR | S_IRUGO);
+
+static int binder_inherit_rt = 1;
+module_param_named(inherit_rt, binder_inherit_rt, bool, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -232,7 +239,8 @@ struct binder_node {
 	unsigned pending_weak_ref:1;
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
-	unsigned min_priority:8;
+	unsigned sched_policy:2;
+	unsigned min_priority:8;	/* rt priority for SCHED_FIFO/RR */
 	struct list_head async_todo;
 };
 
@@ -275,6 +283,18 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+struct binder_alloc_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	u64 alloc_ns;
+	u64 free_ns;
+	u64 alloc_max_ns;
+	u64 free_max_ns;
+	unsigned long pages_mapped;
+	unsigned long pages_unmapped;
+	unsigned long warm_hits;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -305,6 +325,8 @@ struct binder_proc {
 	struct page **pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	int warm_pages;
+	struct binder_alloc_stats alloc_stats;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
@@ -314,6 +336,8 @@ struct binder_proc {
 	int requested_threads_started;
 	int ready_threads;
 	long default_priority;
+	int default_policy;
+	int default_rt_priority;
 	struct dentry *debugfs_entry;
 };
 
@@ -357,6 +381,10 @@ struct binder_transaction {
 	unsigned int	flags;
 	long	priority;
 	long	saved_priority;
+	int	sched_policy;
+	int	rt_priority;
+	int	saved_policy;
+	int	saved_rt_priority;
 	uid_t	sender_euid;
 };
 
@@ -518,6 +546,91 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+/*
+ * A node minimum of the lowest nice value never raises the handling
+ * thread: synchronous calls run at the caller's nice value and oneway
+ * calls keep the thread's own.
+ */
+#define BINDER_NEUTRAL_NICE	19
+
+static bool binder_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_set_sched(int policy, int rt_priority)
+{
+	struct sched_param param = { .sched_priority = rt_priority };
+
+	if (current->policy == policy && current->rt_priority == rt_priority)
+		return;
+	if (sched_setscheduler_nocheck(current, policy, &param))
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: failed to set policy %d prio %d\n",
+			     current->pid, policy, rt_priority);
+}
+
+/*
+ * Run the thread handling t at least at the caller's RT policy and
+ * priority, and at least at the node's minimum RT priority. Returns
+ * false when neither applies and the nice value rules instead.
+ */
+static bool binder_transaction_set_rt(struct binder_transaction *t,
+				      struct binder_node *node)
+{
+	int policy = SCHED_NORMAL;
+	int prio = 0;
+
+	if (binder_inherit_rt && !(t->flags & TF_ONE_WAY) &&
+	    binder_rt_policy(t->sched_policy)) {
+		policy = t->sched_policy;
+		prio = t->rt_priority;
+	}
+	if (binder_rt_policy(node->sched_policy) && node->min_priority > prio) {
+		policy = node->sched_policy;
+		prio = node->min_priority;
+	}
+	if (!binder_rt_policy(policy))
+		return false;
+	if (!binder_rt_policy(current->policy) || current->rt_priority < prio)
+		binder_set_sched(policy, prio);
+	return true;
+}
+
+/*
+ * Minimum policy requested by the owner of a new node. Without
+ * CAP_SYS_NICE an RT minimum is capped by the owner's RLIMIT_RTPRIO, as
+ * sched_setscheduler() would cap it.
+ */
+static void binder_node_set_sched(struct binder_node *node, __u32 flags)
+{
+	int policy = (flags & FLAT_BINDER_FLAG_SCHED_POLICY_MASK) >>
+		FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT;
+	int prio = flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+
+	node->min_priority = prio;
+	if (!binder_rt_policy(policy))
+		return;
+
+	if (prio > MAX_USER_RT_PRIO - 1)
+		prio = MAX_USER_RT_PRIO - 1;
+	if (!capable(CAP_SYS_NICE) &&
+	    prio > task_rlimit(current, RLIMIT_RTPRIO)) {
+		prio = task_rlimit(current, RLIMIT_RTPRIO);
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: node %d rt priority capped to %d\n",
+			     current->pid, node->debug_id, prio);
+	}
+	if (prio < 1) {
+		/* no RT minimum allowed, and the RT value means nothing as nice */
+		node->sched_policy = SCHED_NORMAL;
+		node->min_priority = BINDER_NEUTRAL_NICE;
+		return;
+	}
+	node->sched_policy = policy;
+	node->min_priority = prio;
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -552,7 +665,9 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 
 		buffer_size = binder_buffer_size(proc, buffer);
 
-		if (new_buffer_size < buffer_size)
+		/* ordered by size, then address */
+		if (new_buffer_size < buffer_size ||
+		    (new_buffer_size == buffer_size && new_buffer < buffer))
 			p = &parent->rb_left;
 		else
 			p = &parent->rb_right;
@@ -610,15 +725,28 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static struct page **binder_page(struct binder_proc *proc, void *page_addr)
+{
+	return &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+}
+
+/*
+ * Pages of freed buffers are kept mapped, up to binder_warm_pages per
+ * proc, so that the next allocation over the same range needs neither a
+ * page allocation nor the target's mmap_sem. Pages that do need mapping
+ * are mapped into the kernel one contiguous run at a time, and released
+ * pages are unmapped with a single zap and kernel unmap.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
 {
-	void *page_addr;
+	void *page_addr, *run_start, *addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
 	struct page **page;
 	struct mm_struct *mm;
+	int warm = 0, mapped = 0;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -627,6 +755,30 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			if (*binder_page(proc, page_addr))
+				warm++;
+		/*
+		 * A free range holds no pages but warm ones; more than were
+		 * kept means the page array is out of sync with the buffers.
+		 */
+		if (WARN_ON(warm > proc->warm_pages))
+			proc->warm_pages = warm;
+		if (warm == (end - start) / PAGE_SIZE) {
+			proc->warm_pages -= warm;
+			proc->alloc_stats.warm_hits += warm;
+			return 0;
+		}
+	} else {
+		while (start < end && proc->warm_pages < binder_warm_pages) {
+			proc->warm_pages++;
+			start += PAGE_SIZE;
+		}
+		if (end <= start)
+			return 0;
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -651,39 +803,56 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		goto err_no_vma;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+	page_addr = start;
+	while (page_addr < end) {
 		int ret;
 		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		if (*binder_page(proc, page_addr)) {
+			page_addr += PAGE_SIZE;
+			continue;
+		}
+
+		run_start = page_addr;
+		for (; page_addr < end && !*binder_page(proc, page_addr);
+		     page_addr += PAGE_SIZE) {
+			page = binder_page(proc, page_addr);
+			*page = alloc_page(GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO);
+			if (*page == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+				       "for page at %p\n", proc->pid, page_addr);
+				goto err_alloc_page_failed;
+			}
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+
+		tmp_area.addr = run_start;
+		tmp_area.size = page_addr - run_start + PAGE_SIZE /* guard page? */;
+		page_array_ptr = binder_page(proc, run_start);
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
+			       "to map pages at %p-%p in kernel\n",
+			       proc->pid, run_start, page_addr);
 			goto err_map_kernel_failed;
 		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+		for (addr = run_start; addr < page_addr; addr += PAGE_SIZE) {
+			user_page_addr =
+				(uintptr_t)addr + proc->user_buffer_offset;
+			ret = vm_insert_page(vma, user_page_addr,
+					     *binder_page(proc, addr));
+			if (ret) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+				       "to map page at %lx in userspace\n",
+				       proc->pid, user_page_addr);
+				goto err_vm_insert_page_failed;
+			}
+			/* vm_insert_page does not seem to increment the refcount */
 		}
-		/* vm_insert_page does not seem to increment the refcount */
+		mapped += (page_addr - run_start) / PAGE_SIZE;
 	}
+	proc->warm_pages -= warm;
+	proc->alloc_stats.warm_hits += warm;
+	proc->alloc_stats.pages_mapped += mapped;
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -691,19 +860,52 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	return 0;
 
 free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+	if (vma)
+		zap_page_range(vma, (uintptr_t)start + proc->user_buffer_offset,
+			       end - start, NULL);
+	unmap_kernel_range((unsigned long)start, end - start);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = binder_page(proc, page_addr);
+		__free_page(*page);
+		*page = NULL;
+		proc->alloc_stats.pages_unmapped++;
+	}
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return 0;
+
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	if (addr > run_start)
+		zap_page_range(vma, (uintptr_t)run_start +
+			       proc->user_buffer_offset, addr - run_start, NULL);
 err_map_kernel_failed:
+	unmap_kernel_range((unsigned long)run_start, page_addr - run_start);
+err_alloc_page_failed:
+	for (addr = run_start; addr < page_addr; addr += PAGE_SIZE) {
+		page = binder_page(proc, addr);
 		__free_page(*page);
 		*page = NULL;
-err_alloc_page_failed:
-		;
+	}
+	/*
+	 * Runs completed before the failure stay mapped as warm pages, up
+	 * to binder_warm_pages. Release the rest.
+	 */
+	proc->warm_pages += mapped;
+	proc->alloc_stats.pages_mapped += mapped;
+	for (addr = start; addr < run_start &&
+	     proc->warm_pages > binder_warm_pages; addr += PAGE_SIZE) {
+		page = binder_page(proc, addr);
+		if (*page == NULL)
+			continue;
+		zap_page_range(vma, (uintptr_t)addr + proc->user_buffer_offset,
+			       PAGE_SIZE, NULL);
+		unmap_kernel_range((unsigned long)addr, PAGE_SIZE);
+		__free_page(*page);
+		*page = NULL;
+		proc->warm_pages--;
+		proc->alloc_stats.pages_unmapped++;
 	}
 err_no_vma:
 	if (mm) {
@@ -713,9 +915,10 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -748,30 +951,29 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	/*
+	 * Take the lowest-addressed of the smallest free buffers that fit,
+	 * so that allocations pack towards the start of the area and large
+	 * free ranges at its end stay intact.
+	 */
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
 		buffer_size = binder_buffer_size(proc, buffer);
 
-		if (size < buffer_size) {
+		if (size <= buffer_size) {
 			best_fit = n;
 			n = n->rb_left;
-		} else if (size > buffer_size)
+		} else
 			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
-		}
 	}
 	if (best_fit == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
-	}
+	buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -779,12 +981,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
-		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
-			buffer_size = size; /* no room for other buffers */
-		else
-			buffer_size = size + sizeof(struct binder_buffer);
-	}
+	if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
+		buffer_size = size; /* no room for other buffers */
+	else
+		buffer_size = size + sizeof(struct binder_buffer);
 	end_page_addr =
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
@@ -819,6 +1019,24 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+	ktime_t start;
+	u64 ns;
+
+	start = ktime_get();
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	proc->alloc_stats.allocs++;
+	proc->alloc_stats.alloc_ns += ns;
+	if (ns > proc->alloc_stats.alloc_max_ns)
+		proc->alloc_stats.alloc_max_ns = ns;
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -876,8 +1094,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -931,6 +1149,21 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	ktime_t start;
+	u64 ns;
+
+	start = ktime_get();
+	__binder_free_buf(proc, buffer);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	proc->alloc_stats.frees++;
+	proc->alloc_stats.free_ns += ns;
+	if (ns > proc->alloc_stats.free_max_ns)
+		proc->alloc_stats.free_max_ns = ns;
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1416,6 +1649,8 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
+		binder_set_sched(in_reply_to->saved_policy,
+				 in_reply_to->saved_rt_priority);
 		binder_set_nice(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
@@ -1555,6 +1790,8 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	t->sched_policy = current->policy;
+	t->rt_priority = current->rt_priority;
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
@@ -1613,7 +1850,7 @@ static void binder_transaction(struct binder_proc *proc,
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				binder_node_set_sched(node, fp->flags);
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -2268,6 +2505,8 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
+		binder_set_sched(proc->default_policy,
+				 proc->default_rt_priority);
 		binder_set_nice(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
@@ -2432,12 +2671,16 @@ retry:
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
 			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			t->saved_policy = current->policy;
+			t->saved_rt_priority = current->rt_priority;
+			if (!binder_transaction_set_rt(t, target_node)) {
+				if (t->priority < target_node->min_priority &&
+				    !(t->flags & TF_ONE_WAY))
+					binder_set_nice(t->priority);
+				else if (!(t->flags & TF_ONE_WAY) ||
+					 t->saved_priority > target_node->min_priority)
+					binder_set_nice(target_node->min_priority);
+			}
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2942,6 +3185,8 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
+	proc->default_policy = current->policy;
+	proc->default_rt_priority = current->rt_priority;
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
@@ -3442,6 +3687,8 @@ static void print_binder_proc_stats(struct seq_file *m,
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	struct binder_alloc_stats alloc_stats;
+	int warm_pages;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3472,7 +3719,23 @@ static void print_binder_proc_stats(struct seq_file *m,
 	count = 0;
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	alloc_stats = proc->alloc_stats;
+	warm_pages = proc->warm_pages;
 	seq_printf(m, "  buffers: %d\n", count);
+	seq_printf(m, "  buffer allocs: %lu avg %llu ns max %llu ns\n",
+		   alloc_stats.allocs,
+		   alloc_stats.allocs ?
+		   div64_u64(alloc_stats.alloc_ns, alloc_stats.allocs) : 0,
+		   alloc_stats.alloc_max_ns);
+	seq_printf(m, "  buffer frees: %lu avg %llu ns max %llu ns\n",
+		   alloc_stats.frees,
+		   alloc_stats.frees ?
+		   div64_u64(alloc_stats.free_ns, alloc_stats.frees) : 0,
+		   alloc_stats.free_max_ns);
+	seq_printf(m, "  pages mapped: %lu unmapped: %lu warm: %d "
+		   "warm hits: %lu\n",
+		   alloc_stats.pages_mapped, alloc_stats.pages_unmapped,
+		   warm_pages, alloc_stats.warm_hits);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
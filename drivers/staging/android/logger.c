@@ -25,16 +25,58 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/lz4.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * Writers do not take log->mutex. Each entry is first staged in a per-cpu
+ * sub-buffer: space is reserved with preemption disabled, so only the owning
+ * cpu ever moves 'head', then the payload is copied in with preemption
+ * enabled and the record is marked done. Every reservation also takes the
+ * next number from the log-wide 'seq' counter. logger_merge() later publishes
+ * records from all cpus into the shared ring strictly in that order, under
+ * log->mutex, whenever a reader looks at the log. It is the only place that
+ * moves 'tail'.
+ *
+ * The payload is copied with page faults disabled, so a record never stays
+ * busy for long. A write whose payload is not resident, or that finds its
+ * sub-buffer full, goes straight into the ring under log->mutex instead. It
+ * takes a number as well and waits for its turn, see logger_wait_turn().
+ * Every record and direct write wakes log->wq when it is done, as a merge
+ * stopped at it may be waiting.
+ */
+#define LOGGER_PCPU_SIZE	(16 * 1024)
+
+enum {
+	LOGGER_STAGED_BUSY,	/* reserved, payload still being copied */
+	LOGGER_STAGED_DONE,	/* ready to be merged */
+	LOGGER_STAGED_FAILED,	/* copy faulted, skipped by the merge */
+	LOGGER_STAGED_PAD,	/* filler up to the end of the sub-buffer */
+};
+
+struct logger_staged {
+	__u32			size;	/* record size, including this header */
+	__u32			state;	/* LOGGER_STAGED_* */
+	__u32			seq;	/* reservation order across all cpus */
+	__u32			__pad;
+	struct logger_entry	entry;	/* followed by the payload */
+};
+
+struct logger_pcpu {
+	unsigned char		*buffer;/* LOGGER_PCPU_SIZE bytes */
+	unsigned long		head;	/* next free byte, owning cpu only */
+	unsigned long		tail;	/* oldest unmerged byte, log->mutex */
+};
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * mutex 'mutex', except for the per-cpu staging heads described above.
  */
 struct logger_log {
 	unsigned char		*buffer;/* the ring buffer itself */
@@ -45,6 +87,19 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_pcpu __percpu *pcpu; /* staging, NULL if unavailable */
+	atomic_t		seq;	/* next staging sequence to hand out */
+	u32			merge_seq; /* next sequence to merge, log->mutex */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct list_head	chunks;	/* compressed history, oldest first */
+	size_t			chunks_size; /* compressed bytes in 'chunks' */
+	unsigned char		*open;	/* entries evicted since the last chunk */
+	size_t			open_len; /* bytes used in 'open' */
+	unsigned long		open_seq; /* sequence 'open' will be sealed as */
+	unsigned char		*cache;	/* last decompressed chunk */
+	unsigned long		cache_seq; /* sequence held in 'cache' */
+	bool			cache_valid;
+#endif
 };
 
 /*
@@ -59,6 +114,9 @@ struct logger_reader {
 	size_t			r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
+	bool			r_hist;	/* reading the compressed history */
+	unsigned long		r_hseq;	/* history chunk being read */
+	size_t			r_hoff;	/* offset into its uncompressed data */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -230,6 +288,364 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 	return off;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * Compressed history. Entries that are about to be overwritten are appended
+ * to the log's open chunk; once it is full it is lz4-compressed into the
+ * log's pool and a new open chunk begins. Chunks are numbered, so a history
+ * reader is just a chunk sequence and an offset into its uncompressed data,
+ * and the end of the newest history is always log->head. All of it is
+ * protected by log->mutex.
+ */
+#define LOGGER_CHUNK_SIZE	(16 * 1024)
+
+struct logger_chunk {
+	struct list_head	list;	/* entry in logger_log's chunks */
+	unsigned long		seq;	/* chunk sequence number */
+	size_t			len;	/* uncompressed length */
+	size_t			zlen;	/* compressed length */
+	unsigned char		data[0];
+};
+
+/* compressed history kept per log, in kilobytes; 0 stops archiving */
+static unsigned int logger_history_kb = 256;
+module_param_named(history_kb, logger_history_kb, uint, S_IWUSR | S_IRUGO);
+
+/* lz4 work memory and output buffer, shared by all logs */
+static DEFINE_MUTEX(logger_zlock);
+static void *logger_zwork;
+static unsigned char *logger_zbuf;
+
+/* logger_copy_out - copies 'count' bytes of 'log' starting at 'off' */
+static void logger_copy_out(struct logger_log *log, size_t off,
+			    unsigned char *dst, size_t count)
+{
+	size_t len = min(count, log->size - off);
+
+	memcpy(dst, log->buffer + off, len);
+	if (count != len)
+		memcpy(dst + len, log->buffer, count - len);
+}
+
+static void logger_hist_drop(struct logger_log *log)
+{
+	struct logger_chunk *chunk;
+
+	chunk = list_first_entry(&log->chunks, struct logger_chunk, list);
+	list_del(&chunk->list);
+	log->chunks_size -= chunk->zlen;
+	kfree(chunk);
+}
+
+/*
+ * logger_hist_seal - compresses the open chunk into the pool, dropping the
+ * oldest chunks to stay within history_kb. If the chunk cannot be stored it
+ * is lost, and readers skip over its sequence number.
+ */
+static void logger_hist_seal(struct logger_log *log)
+{
+	size_t max = (size_t) logger_history_kb << 10;
+	struct logger_chunk *chunk = NULL;
+	size_t zlen;
+
+	mutex_lock(&logger_zlock);
+	if (!lz4_compress(log->open, log->open_len, logger_zbuf, &zlen,
+			  logger_zwork) && zlen <= max) {
+		chunk = kmalloc(sizeof(struct logger_chunk) + zlen,
+				GFP_KERNEL);
+		if (chunk)
+			memcpy(chunk->data, logger_zbuf, zlen);
+	}
+	mutex_unlock(&logger_zlock);
+
+	if (chunk) {
+		chunk->seq = log->open_seq;
+		chunk->len = log->open_len;
+		chunk->zlen = zlen;
+
+		while (!list_empty(&log->chunks) &&
+		       log->chunks_size + zlen > max)
+			logger_hist_drop(log);
+
+		list_add_tail(&chunk->list, &log->chunks);
+		log->chunks_size += zlen;
+	}
+
+	log->open_seq++;
+	log->open_len = 0;
+}
+
+/*
+ * logger_hist_archive - appends the entries from log->head that at least
+ * 'len' bytes of new writes will overwrite to the open chunk. Readers
+ * sitting on one of them follow it into the history instead of being pulled
+ * forward.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_hist_archive(struct logger_log *log, size_t len)
+{
+	size_t off = log->head;
+	size_t count = 0;
+
+	if (!log->open || !logger_history_kb)
+		return;
+
+	do {
+		struct logger_reader *reader;
+		size_t nr = sizeof(struct logger_entry) +
+			get_entry_msg_len(log, off);
+
+		if (log->open_len + nr > LOGGER_CHUNK_SIZE)
+			logger_hist_seal(log);
+
+		list_for_each_entry(reader, &log->readers, list)
+			if (!reader->r_hist && reader->r_off == off) {
+				reader->r_hist = true;
+				reader->r_hseq = log->open_seq;
+				reader->r_hoff = log->open_len;
+			}
+
+		logger_copy_out(log, off, log->open + log->open_len, nr);
+		log->open_len += nr;
+
+		off = logger_offset(off + nr);
+		count += nr;
+	} while (count < len);
+}
+
+/* logger_hist_flush - forgets the whole history, for LOGGER_FLUSH_LOG */
+static void logger_hist_flush(struct logger_log *log)
+{
+	if (!log->open)
+		return;
+
+	while (!list_empty(&log->chunks))
+		logger_hist_drop(log);
+	log->open_seq++;
+	log->open_len = 0;
+}
+
+/* logger_hist_start - starts a new reader at the oldest history we have */
+static void logger_hist_start(struct logger_log *log,
+			      struct logger_reader *reader)
+{
+	reader->r_hist = log->open != NULL;
+	reader->r_hseq = 0;
+	reader->r_hoff = 0;
+}
+
+/*
+ * logger_hist_data - returns the uncompressed data of the chunk 'reader' is
+ * in, and its length in 'len'. A reader whose chunk was dropped is moved to
+ * the start of the oldest chunk still around.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static unsigned char *logger_hist_data(struct logger_log *log,
+				       struct logger_reader *reader,
+				       size_t *len)
+{
+	struct logger_chunk *chunk;
+
+	if (reader->r_hseq == log->open_seq) {
+		*len = log->open_len;
+		return log->open;
+	}
+
+	list_for_each_entry(chunk, &log->chunks, list) {
+		size_t zlen = chunk->zlen;
+
+		if (chunk->seq < reader->r_hseq)
+			continue;
+		if (chunk->seq != reader->r_hseq) {
+			reader->r_hseq = chunk->seq;
+			reader->r_hoff = 0;
+		}
+
+		*len = chunk->len;
+		if (log->cache_valid && log->cache_seq == chunk->seq)
+			return log->cache;
+
+		log->cache_valid = !lz4_decompress(chunk->data, &zlen,
+						   log->cache, chunk->len);
+		log->cache_seq = chunk->seq;
+		if (!log->cache_valid)
+			*len = 0;
+		return log->cache;
+	}
+
+	reader->r_hseq = log->open_seq;
+	reader->r_hoff = 0;
+	*len = log->open_len;
+	return log->open;
+}
+
+/*
+ * logger_hist_entry - returns the next entry a history reader can read, or
+ * NULL once it has caught up with the history, in which case it continues
+ * at log->head.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static struct logger_entry *logger_hist_entry(struct logger_log *log,
+					      struct logger_reader *reader)
+{
+	while (reader->r_hist) {
+		struct logger_entry *entry;
+		unsigned char *data;
+		size_t len;
+
+		data = logger_hist_data(log, reader, &len);
+		if (reader->r_hoff >= len) {
+			if (reader->r_hseq == log->open_seq) {
+				reader->r_hist = false;
+				reader->r_off = log->head;
+				break;
+			}
+			reader->r_hseq++;
+			reader->r_hoff = 0;
+			continue;
+		}
+
+		entry = (struct logger_entry *) (data + reader->r_hoff);
+		if (reader->r_all || entry->euid == current_euid())
+			return entry;
+
+		reader->r_hoff += sizeof(struct logger_entry) + entry->len;
+	}
+
+	return NULL;
+}
+
+/*
+ * logger_hist_len - returns the number of history bytes left for 'reader',
+ * as LOGGER_GET_LOG_LEN would count them.
+ */
+static size_t logger_hist_len(struct logger_log *log,
+			      struct logger_reader *reader)
+{
+	struct logger_chunk *chunk;
+	size_t ret;
+
+	if (!reader->r_hist)
+		return 0;
+
+	ret = log->open_len;
+	list_for_each_entry(chunk, &log->chunks, list)
+		if (chunk->seq >= reader->r_hseq)
+			ret += chunk->len;
+
+	return ret > reader->r_hoff ? ret - reader->r_hoff : 0;
+}
+
+static void __init logger_hist_setup(void)
+{
+	logger_zwork = kmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+	logger_zbuf = kmalloc(LZ4_COMPRESSBOUND(LOGGER_CHUNK_SIZE),
+			      GFP_KERNEL);
+	if (!logger_zwork || !logger_zbuf) {
+		kfree(logger_zwork);
+		kfree(logger_zbuf);
+		logger_zwork = NULL;
+		logger_zbuf = NULL;
+	}
+}
+
+/*
+ * logger_hist_init - sets up the history of 'log'. On failure the log just
+ * has no history.
+ */
+static int __init logger_hist_init(struct logger_log *log)
+{
+	INIT_LIST_HEAD(&log->chunks);
+
+	if (!logger_zwork)
+		return -ENOMEM;
+
+	log->open = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+	log->cache = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+	if (!log->open || !log->cache) {
+		kfree(log->open);
+		kfree(log->cache);
+		log->open = NULL;
+		log->cache = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+#else
+static inline void logger_hist_archive(struct logger_log *log, size_t len)
+{
+}
+
+static inline void logger_hist_flush(struct logger_log *log)
+{
+}
+
+static inline void logger_hist_start(struct logger_log *log,
+				     struct logger_reader *reader)
+{
+	reader->r_hist = false;
+}
+
+static inline struct logger_entry *logger_hist_entry(struct logger_log *log,
+						     struct logger_reader *reader)
+{
+	return NULL;
+}
+
+static inline size_t logger_hist_len(struct logger_log *log,
+				     struct logger_reader *reader)
+{
+	return 0;
+}
+
+static inline void logger_hist_setup(void)
+{
+}
+
+static inline int logger_hist_init(struct logger_log *log)
+{
+	return 0;
+}
+#endif
+
+/*
+ * logger_hist_read - reads the next history entry readable by 'reader' into
+ * the user-space buffer 'buf', like do_read_log_to_user() does for the ring.
+ * Returns 0 if the reader has caught up with the history.
+ *
+ * Caller must hold log->mutex.
+ */
+static ssize_t logger_hist_read(struct logger_log *log,
+				struct logger_reader *reader,
+				char __user *buf, size_t count)
+{
+	struct logger_entry *entry;
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
+	ssize_t ret;
+
+	entry = logger_hist_entry(log, reader);
+	if (!entry)
+		return 0;
+
+	ret = hdr_len + entry->len;
+	if (count < ret)
+		return -EINVAL;
+
+	if (copy_header_to_user(reader->r_ver, entry, buf) ||
+	    copy_to_user(buf + hdr_len, entry->msg, entry->len))
+		return -EFAULT;
+
+	reader->r_hoff += sizeof(struct logger_entry) + entry->len;
+
+	return ret;
+}
+
+static void logger_merge(struct logger_log *log);
+
 /*
  * logger_read - our log's read() method
  *
@@ -255,7 +671,9 @@ start:
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
+		logger_merge(log);
+		ret = !logger_hist_entry(log, reader) &&
+			(log->w_off == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -278,6 +696,12 @@ start:
 		return ret;
 
 	mutex_lock(&log->mutex);
+	logger_merge(log);
+
+	/* entries that fell out of the ring come first */
+	ret = logger_hist_read(log, reader, buf, count);
+	if (ret)
+		goto out;
 
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
@@ -357,11 +781,14 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
 
-	if (clock_interval(old, new, log->head))
+	if (clock_interval(old, new, log->head)) {
+		logger_hist_archive(log, len);
 		log->head = get_next_entry(log, log->head, len);
+	}
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
+		if (!reader->r_hist &&
+		    clock_interval(old, new, reader->r_off))
 			reader->r_off = get_next_entry(log, reader->r_off, len);
 }
 
@@ -384,6 +811,235 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
+/*
+ * logger_peek - returns the oldest record staged in 'pc', whatever its
+ * state, or NULL if there is none. Padding is consumed on the way.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static struct logger_staged *logger_peek(struct logger_pcpu *pc)
+{
+	while (pc->tail != ACCESS_ONCE(pc->head)) {
+		struct logger_staged *rec;
+
+		smp_rmb();
+		rec = (struct logger_staged *)
+			(pc->buffer + (pc->tail & (LOGGER_PCPU_SIZE - 1)));
+
+		if (ACCESS_ONCE(rec->state) != LOGGER_STAGED_PAD)
+			return rec;
+		smp_mb();
+		pc->tail += rec->size;
+	}
+
+	return NULL;
+}
+
+/*
+ * logger_merge - moves staged records out of the per-cpu sub-buffers and into
+ * the shared ring in the order they were reserved. Each sub-buffer holds its
+ * records in increasing sequence, so the next one to merge is always at the
+ * tail of some cpu. Merging stops when that record is still being copied, or
+ * when it is not visible yet because its writer is between taking the
+ * sequence and publishing the reservation, or is waiting to write straight
+ * into the ring. Failed records are dropped in their turn.
+ *
+ * The caller needs to hold log->mutex.
+ */
+static void logger_merge(struct logger_log *log)
+{
+	if (!log->pcpu)
+		return;
+
+	while (1) {
+		struct logger_pcpu *pc, *next_pc = NULL;
+		struct logger_staged *rec, *next = NULL;
+		size_t len;
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			pc = per_cpu_ptr(log->pcpu, cpu);
+			rec = logger_peek(pc);
+			if (rec && rec->seq == log->merge_seq) {
+				next = rec;
+				next_pc = pc;
+				break;
+			}
+		}
+
+		if (!next)
+			break;
+
+		switch (ACCESS_ONCE(next->state)) {
+		case LOGGER_STAGED_BUSY:
+			return;
+		case LOGGER_STAGED_DONE:
+			smp_rmb();
+			len = sizeof(struct logger_entry) + next->entry.len;
+			fix_up_readers(log, len);
+			do_write_log(log, &next->entry, len);
+			break;
+		}
+
+		/* the copy must be done before the writer can reuse the space */
+		smp_mb();
+		next_pc->tail += next->size;
+		log->merge_seq++;
+	}
+}
+
+/*
+ * logger_wait_turn - numbers a write that goes straight into the ring and
+ * waits until everything numbered before it has been merged. The number is
+ * always used, even if the write then fails, so the wait is uninterruptible.
+ *
+ * Returns with log->mutex held.
+ */
+static void logger_wait_turn(struct logger_log *log)
+{
+	DEFINE_WAIT(wait);
+	u32 seq;
+
+	mutex_lock(&log->mutex);
+	if (!log->pcpu)
+		return;
+	seq = atomic_inc_return(&log->seq) - 1;
+
+	while (1) {
+		prepare_to_wait(&log->wq, &wait, TASK_UNINTERRUPTIBLE);
+		logger_merge(log);
+		if (log->merge_seq == seq)
+			break;
+		mutex_unlock(&log->mutex);
+		schedule();
+		mutex_lock(&log->mutex);
+	}
+	finish_wait(&log->wq, &wait);
+}
+
+/*
+ * logger_end_turn - completes the write numbered by logger_wait_turn() and
+ * publishes whatever was staged behind it. Drops log->mutex.
+ */
+static void logger_end_turn(struct logger_log *log)
+{
+	if (log->pcpu) {
+		log->merge_seq++;
+		logger_merge(log);
+	}
+	mutex_unlock(&log->mutex);
+
+	/* wake up blocked readers, and direct writers waiting for their turn */
+	wake_up(&log->wq);
+}
+
+/*
+ * logger_reserve - reserves room for 'header' and its payload in this cpu's
+ * sub-buffer, numbers it and stamps the entry. The sequence is taken with
+ * preemption disabled, after the space is known to be there, so every number
+ * handed out belongs to a record that is about to become visible, and each
+ * sub-buffer stays in sequence order.
+ *
+ * Returns NULL if staging is unavailable or the sub-buffer is full.
+ */
+static struct logger_staged *logger_reserve(struct logger_log *log,
+					    struct logger_entry *header)
+{
+	struct logger_staged *rec = NULL;
+	struct logger_pcpu *pc;
+	struct timespec now;
+	unsigned long head;
+	size_t size, off, pad = 0;
+
+	if (unlikely(!log->pcpu))
+		return NULL;
+
+	size = ALIGN(sizeof(struct logger_staged) + header->len, 8);
+
+	preempt_disable();
+	pc = this_cpu_ptr(log->pcpu);
+	head = pc->head;
+	off = head & (LOGGER_PCPU_SIZE - 1);
+	if (off + size > LOGGER_PCPU_SIZE)
+		pad = LOGGER_PCPU_SIZE - off;
+	if (head + pad + size - ACCESS_ONCE(pc->tail) > LOGGER_PCPU_SIZE)
+		goto out;
+	/* the merge must be done with the space before we write into it */
+	smp_mb();
+
+	if (pad) {
+		rec = (struct logger_staged *) (pc->buffer + off);
+		rec->size = pad;
+		rec->state = LOGGER_STAGED_PAD;
+		off = 0;
+	}
+
+	now = current_kernel_time();
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+
+	rec = (struct logger_staged *) (pc->buffer + off);
+	rec->size = size;
+	rec->state = LOGGER_STAGED_BUSY;
+	rec->seq = atomic_inc_return(&log->seq) - 1;
+	rec->entry = *header;
+
+	smp_wmb();
+	pc->head = head + pad + size;
+out:
+	preempt_enable();
+
+	return rec;
+}
+
+/*
+ * logger_stage_from_user - copies the payload of a reserved record from the
+ * user-space vectors and hands the record over to the merge.
+ *
+ * Returns the payload length on success, negative error code on failure.
+ */
+static ssize_t logger_stage_from_user(struct logger_log *log,
+				      struct logger_staged *rec,
+				      const struct iovec *iov,
+				      unsigned long nr_segs)
+{
+	char *msg = rec->entry.msg;
+	size_t left = rec->entry.len;
+	ssize_t ret = rec->entry.len;
+	__u32 state = LOGGER_STAGED_DONE;
+
+	pagefault_disable();
+	while (nr_segs-- > 0 && left) {
+		size_t len = min_t(size_t, iov->iov_len, left);
+
+		if (len && (!access_ok(VERIFY_READ, iov->iov_base, len) ||
+			    __copy_from_user_inatomic(msg, iov->iov_base, len))) {
+			state = LOGGER_STAGED_FAILED;
+			ret = -EFAULT;
+			break;
+		}
+
+		msg += len;
+		left -= len;
+		iov++;
+	}
+	pagefault_enable();
+
+	smp_wmb();
+	rec->state = state;
+
+	/*
+	 * Wake whoever waits on a merge stopped at this record, even if it
+	 * failed. Pairs with prepare_to_wait() in logger_read() and
+	 * logger_wait_turn().
+	 */
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up(&log->wq);
+
+	return ret;
+}
+
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
  * the log 'log'
@@ -419,17 +1075,14 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	struct logger_staged *rec;
 	struct logger_entry header;
 	struct timespec now;
+	size_t orig;
 	ssize_t ret = 0;
 
-	now = current_kernel_time();
-
 	header.pid = current->tgid;
 	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
 	header.euid = current_euid();
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 	header.hdr_size = sizeof(struct logger_entry);
@@ -438,7 +1091,25 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	rec = logger_reserve(log, &header);
+	if (likely(rec)) {
+		ret = logger_stage_from_user(log, rec, iov, nr_segs);
+		if (likely(ret != -EFAULT))
+			return ret;
+		/* the record was dropped, write it again faulting the payload in */
+		ret = 0;
+	}
+
+	/*
+	 * Our sub-buffer is full, there is none, or the payload is not
+	 * resident: write straight into the shared ring, in turn.
+	 */
+	logger_wait_turn(log);
+
+	now = current_kernel_time();
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+	orig = log->w_off;
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
@@ -461,18 +1132,15 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		nr = do_write_log_from_user(log, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
 			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+			ret = nr;
+			break;
 		}
 
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_end_turn(log);
 
 	return ret;
 }
@@ -512,6 +1180,8 @@ static int logger_open(struct inode *inode, struct file *file)
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
+		logger_merge(log);
+		logger_hist_start(log, reader);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
 		mutex_unlock(&log->mutex);
@@ -568,6 +1238,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	logger_merge(log);
+	if (logger_hist_entry(log, reader))
+		ret |= POLLIN | POLLRDNORM;
+
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
@@ -596,10 +1270,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_entry *entry;
 	long ret = -EINVAL;
+	size_t off;
 	void __user *argp = (void __user *) arg;
 
 	mutex_lock(&log->mutex);
+	logger_merge(log);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -611,10 +1288,15 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		if (reader->r_hist)
+			off = log->head;
+		else
+			off = reader->r_off;
+		if (log->w_off >= off)
+			ret = log->w_off - off;
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = (log->size - off) + log->w_off;
+		ret += logger_hist_len(log, reader);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -623,6 +1305,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
+		entry = logger_hist_entry(log, reader);
+		if (entry) {
+			ret = get_user_hdr_len(reader->r_ver) + entry->len;
+			break;
+		}
+
 		if (!reader->r_all)
 			reader->r_off = get_next_entry_by_uid(log,
 				reader->r_off, current_euid());
@@ -638,9 +1326,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
+		list_for_each_entry(reader, &log->readers, list) {
+			reader->r_hist = false;
 			reader->r_off = log->w_off;
+		}
 		log->head = log->w_off;
+		logger_hist_flush(log);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -695,6 +1386,7 @@ static struct logger_log VAR = { \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.seq = ATOMIC_INIT(0), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -718,10 +1410,49 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+/*
+ * init_log_pcpu - allocates the per-cpu staging sub-buffers of 'log'. On
+ * failure writers simply keep going through log->mutex.
+ */
+static int __init init_log_pcpu(struct logger_log *log)
+{
+	int cpu;
+
+	log->pcpu = alloc_percpu(struct logger_pcpu);
+	if (!log->pcpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_pcpu *pc = per_cpu_ptr(log->pcpu, cpu);
+
+		pc->buffer = kmalloc_node(LOGGER_PCPU_SIZE, GFP_KERNEL,
+					  cpu_to_node(cpu));
+		if (!pc->buffer)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->pcpu, cpu)->buffer);
+	free_percpu(log->pcpu);
+	log->pcpu = NULL;
+	return -ENOMEM;
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	if (init_log_pcpu(log))
+		printk(KERN_WARNING "logger: no per-cpu staging for log "
+		       "'%s'\n", log->misc.name);
+
+	if (logger_hist_init(log))
+		printk(KERN_WARNING "logger: no compressed history for log "
+		       "'%s'\n", log->misc.name);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -739,6 +1470,8 @@ static int __init logger_init(void)
 {
 	int ret;
 
+	logger_hist_setup();
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
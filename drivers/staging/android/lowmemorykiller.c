@@ -17,6 +17,23 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * With CONFIG_ANDROID_LMK_ADJ_INDEX, processes are also kept in buckets by
+ * oom_score_adj. Writing 1 to /sys/module/lowmemorykiller/parameters/batch_kill
+ * then makes the driver pick, in one pass over the buckets, as many processes
+ * (up to batch_max) as needed to bring free memory back above the minfree
+ * level, and not select again until their memory has been freed.
+ *
+ * With CONFIG_ANDROID_LMK_VMPRESSURE, the free page thresholds only bound
+ * when the driver may act. Which oom_score_adj level gets killed follows
+ * the reclaim pressure reported by vmpressure instead: the pressure,
+ * averaged over the last few reclaim windows, is compared against
+ * /sys/module/lowmemorykiller/parameters/pressure, a list of percentages
+ * matching the adj list. For example "100,95,80,60" with adj "0,1,6,12"
+ * kills adj 12 and up once reclaim fails on 60% of the pages it scans.
+ * While reclaim keeps succeeding, nothing is killed until free memory
+ * falls below the lowest minfree level. Writing 0 to use_pressure falls
+ * back to the static thresholds.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -39,6 +56,11 @@
 #include <linux/notifier.h>
 #include <linux/memory.h>
 #include <linux/memory_hotplug.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rculist_nulls.h>
+#include <linux/vmpressure.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,10 +77,32 @@ static int lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+static int lowmem_pressure[6] = {
+	100,
+	95,
+	80,
+	60,
+};
+static int lowmem_pressure_size = 4;
+static uint32_t lowmem_use_pressure = 1;
+#endif
 
 static unsigned int offlining;
 static unsigned long lowmem_deathpending_timeout;
 
+static struct {
+	u32 scans;		/* victim selection passes */
+	u64 scan_ns;		/* total time spent in them */
+	u64 scan_ns_max;
+	u32 kill_events;	/* passes that killed something */
+	u32 kills;
+	u32 kills_max;		/* most kills in one pass */
+	u32 suppressed;		/* passes skipped waiting for victims */
+} lowmem_stats;
+/* shrinkers run concurrently on several cpus */
+static DEFINE_SPINLOCK(lowmem_stats_lock);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -89,6 +133,375 @@ static int lmk_hotplug_callback(struct notifier_block *self,
 }
 #endif
 
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+#define LMK_PRESSURE_WINDOWS	4
+
+/* pressure of the last reclaim windows, see lowmem_current_pressure() */
+static struct {
+	spinlock_t lock;
+	unsigned int samples[LMK_PRESSURE_WINDOWS];
+	unsigned int next;
+	unsigned int nr;
+	unsigned long stamp;
+} lowmem_vmpr = {
+	.lock = __SPIN_LOCK_UNLOCKED(lowmem_vmpr.lock),
+};
+
+static int lowmem_vmpressure_notify(struct notifier_block *nb,
+				    unsigned long pressure, void *data)
+{
+	spin_lock(&lowmem_vmpr.lock);
+	lowmem_vmpr.samples[lowmem_vmpr.next] = pressure;
+	lowmem_vmpr.next = (lowmem_vmpr.next + 1) % LMK_PRESSURE_WINDOWS;
+	if (lowmem_vmpr.nr < LMK_PRESSURE_WINDOWS)
+		lowmem_vmpr.nr++;
+	lowmem_vmpr.stamp = jiffies;
+	spin_unlock(&lowmem_vmpr.lock);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call = lowmem_vmpressure_notify,
+};
+
+/*
+ * Average pressure over the recent reclaim windows. Once reclaim has not
+ * completed a window for a second, the old samples no longer describe
+ * the system and are dropped.
+ */
+static unsigned int lowmem_current_pressure(void)
+{
+	unsigned int i, sum = 0, nr;
+
+	spin_lock(&lowmem_vmpr.lock);
+	if (time_after(jiffies, lowmem_vmpr.stamp + HZ))
+		lowmem_vmpr.nr = 0;
+	nr = lowmem_vmpr.nr;
+	for (i = 0; i < nr; i++)
+		sum += lowmem_vmpr.samples[i];
+	spin_unlock(&lowmem_vmpr.lock);
+
+	return nr ? sum / nr : 0;
+}
+
+/*
+ * Pick the minimum oom_score_adj to kill from the reclaim pressure. Only
+ * acts below the highest minfree level, and the lowest minfree level
+ * still applies as a floor when reclaim has not reported any pressure.
+ */
+static int lowmem_pressure_adj(int other_free, int other_file,
+			       int array_size, int *minfree)
+{
+	unsigned int pressure;
+	int i;
+
+	if (lowmem_pressure_size < array_size)
+		array_size = lowmem_pressure_size;
+	if (!array_size ||
+	    other_free >= lowmem_minfree[array_size - 1])
+		return OOM_SCORE_ADJ_MAX + 1;
+
+	if (other_free < lowmem_minfree[0] &&
+	    other_file < lowmem_minfree[0]) {
+		*minfree = lowmem_minfree[0];
+		return lowmem_adj[0];
+	}
+
+	pressure = lowmem_current_pressure();
+	for (i = 0; i < array_size; i++) {
+		if (pressure >= lowmem_pressure[i]) {
+			lowmem_print(3, "lowmem_shrink pressure %u, adj %d\n",
+				     pressure, lowmem_adj[i]);
+			*minfree = lowmem_minfree[i];
+			return lowmem_adj[i];
+		}
+	}
+	return OOM_SCORE_ADJ_MAX + 1;
+}
+#endif /* CONFIG_ANDROID_LMK_VMPRESSURE */
+
+static void lowmem_account_suppressed(void)
+{
+	spin_lock(&lowmem_stats_lock);
+	lowmem_stats.suppressed++;
+	spin_unlock(&lowmem_stats_lock);
+}
+
+static void lowmem_account_scan(ktime_t start, int kills)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&lowmem_stats_lock);
+	lowmem_stats.scans++;
+	lowmem_stats.scan_ns += ns;
+	if (ns > lowmem_stats.scan_ns_max)
+		lowmem_stats.scan_ns_max = ns;
+	if (kills) {
+		lowmem_stats.kill_events++;
+		lowmem_stats.kills += kills;
+		if (kills > lowmem_stats.kills_max)
+			lowmem_stats.kills_max = kills;
+	}
+	spin_unlock(&lowmem_stats_lock);
+}
+
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+
+/* one bucket for every valid oom_score_adj, see lmk_adj_bucket() */
+#define LMK_ADJ_BUCKETS		(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+#define LMK_MAX_VICTIMS		8
+
+/*
+ * Thread group leaders hashed by oom_score_adj. Writers hold
+ * lmk_adj_lock; the killer walks the buckets under RCU. A leader moves to
+ * another bucket when its adj changes, so each bucket ends in its own
+ * nulls value and a walk that ends on a foreign one is restarted.
+ */
+static struct hlist_nulls_head lmk_adj_index[LMK_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lmk_adj_lock);
+static bool lmk_adj_index_ready;
+
+static uint32_t lowmem_batch_kill;
+static uint32_t lowmem_batch_max = 4;
+
+/* processes killed by the last batch whose memory is not freed yet */
+static struct task_struct *lowmem_victims[LMK_MAX_VICTIMS];
+static int lowmem_nr_victims;
+static DEFINE_MUTEX(lowmem_batch_lock);
+
+static int lmk_adj_bucket(struct task_struct *p)
+{
+	int adj = p->signal->oom_score_adj;
+
+	return clamp(adj, OOM_SCORE_ADJ_MIN, OOM_SCORE_ADJ_MAX) -
+			OOM_SCORE_ADJ_MIN;
+}
+
+/* @p is a new thread group leader; its node may hold a copy of the parent's */
+void lmk_adj_index_add(struct task_struct *p)
+{
+	if (!lmk_adj_index_ready || (p->flags & PF_KTHREAD))
+		return;
+
+	spin_lock(&lmk_adj_lock);
+	hlist_nulls_add_head_rcu(&p->lmk_adj_node,
+				 &lmk_adj_index[lmk_adj_bucket(p)]);
+	spin_unlock(&lmk_adj_lock);
+}
+
+void lmk_adj_index_del(struct task_struct *p)
+{
+	if (!lmk_adj_index_ready || (p->flags & PF_KTHREAD))
+		return;
+
+	spin_lock(&lmk_adj_lock);
+	hlist_nulls_del_init_rcu(&p->lmk_adj_node);
+	spin_unlock(&lmk_adj_lock);
+}
+
+/* Move @p's thread group to the bucket of its current oom_score_adj */
+void lmk_adj_index_update(struct task_struct *p)
+{
+	if (!lmk_adj_index_ready)
+		return;
+
+	spin_lock(&lmk_adj_lock);
+	p = p->group_leader;
+	if (!(p->flags & PF_KTHREAD) &&
+	    !hlist_nulls_unhashed(&p->lmk_adj_node)) {
+		hlist_nulls_del_init_rcu(&p->lmk_adj_node);
+		hlist_nulls_add_head_rcu(&p->lmk_adj_node,
+					 &lmk_adj_index[lmk_adj_bucket(p)]);
+	}
+	spin_unlock(&lmk_adj_lock);
+}
+
+static int __init lmk_adj_index_init(void)
+{
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LMK_ADJ_BUCKETS; i++)
+		INIT_HLIST_NULLS_HEAD(&lmk_adj_index[i], i);
+
+	/* pick up the processes forked before the index was ready */
+	write_lock_irq(&tasklist_lock);
+	lmk_adj_index_ready = true;
+	for_each_process(p)
+		lmk_adj_index_add(p);
+	write_unlock_irq(&tasklist_lock);
+
+	return 0;
+}
+core_initcall(lmk_adj_index_init);
+
+/*
+ * Returns true while a process killed by the previous batch still holds
+ * its memory, dropping the ones that have let go of it.
+ */
+static bool lowmem_victims_pending(void)
+{
+	int i, n = 0;
+
+	rcu_read_lock();
+	for (i = 0; i < lowmem_nr_victims; i++) {
+		struct task_struct *p = find_lock_task_mm(lowmem_victims[i]);
+
+		if (p) {
+			task_unlock(p);
+			lowmem_victims[n++] = lowmem_victims[i];
+		} else {
+			put_task_struct(lowmem_victims[i]);
+		}
+	}
+	rcu_read_unlock();
+	lowmem_nr_victims = n;
+
+	if (n && time_after(jiffies, lowmem_deathpending_timeout)) {
+		/* stuck; stop waiting for them */
+		while (n--)
+			put_task_struct(lowmem_victims[n]);
+		lowmem_nr_victims = 0;
+	}
+
+	return lowmem_nr_victims;
+}
+
+struct lowmem_candidate {
+	struct task_struct *leader;
+	struct task_struct *p;		/* thread holding the mm */
+	int oom_score_adj;
+	int tasksize;
+};
+
+/* Keep @c sorted by adj, then size, both descending, at most @max long */
+static void lowmem_add_candidate(struct lowmem_candidate *c, int *nr, int max,
+				 struct lowmem_candidate *new)
+{
+	int i, pos;
+
+	for (i = 0; i < *nr; i++)
+		if (c[i].leader == new->leader)
+			return;
+
+	for (pos = *nr; pos > 0; pos--) {
+		if (c[pos - 1].oom_score_adj > new->oom_score_adj)
+			break;
+		if (c[pos - 1].oom_score_adj == new->oom_score_adj &&
+		    c[pos - 1].tasksize >= new->tasksize)
+			break;
+	}
+	if (pos >= max)
+		return;
+
+	if (*nr < max)
+		(*nr)++;
+	for (i = *nr - 1; i > pos; i--)
+		c[i] = c[i - 1];
+	c[pos] = *new;
+}
+
+/*
+ * Select, from the highest oom_score_adj bucket down to @min_score_adj, the
+ * fewest processes whose rss covers @deficit pages and kill them together.
+ * Returns the number of pages expected back, 0 if the index offered no
+ * process at or above @min_score_adj, or -1 if an earlier kill is still
+ * pending.
+ */
+static int lowmem_batch_shrink(int min_score_adj, int deficit)
+{
+	struct lowmem_candidate cand[LMK_MAX_VICTIMS];
+	int max = clamp_t(int, lowmem_batch_max, 1, LMK_MAX_VICTIMS);
+	int nr = 0, covered = 0, killed = 0, freed = 0;
+	ktime_t start;
+	int adj, i;
+
+	if (!mutex_trylock(&lowmem_batch_lock))
+		return -1;
+
+	if (lowmem_victims_pending()) {
+		lowmem_account_suppressed();
+		mutex_unlock(&lowmem_batch_lock);
+		return -1;
+	}
+
+	start = ktime_get();
+	rcu_read_lock();
+	for (adj = OOM_SCORE_ADJ_MAX; adj >= min_score_adj; adj--) {
+		unsigned long bucket = adj - OOM_SCORE_ADJ_MIN;
+		struct hlist_nulls_node *pos;
+		struct task_struct *tsk;
+
+		/* lower buckets cannot beat what is already selected */
+		if (nr == max || covered >= deficit)
+			break;
+restart:
+		hlist_nulls_for_each_entry_rcu(tsk, pos, &lmk_adj_index[bucket],
+					       lmk_adj_node) {
+			struct lowmem_candidate new;
+
+			new.p = find_lock_task_mm(tsk);
+			if (!new.p)
+				continue;
+
+			if (test_tsk_thread_flag(new.p, TIF_MEMDIE) &&
+			    time_before_eq(jiffies,
+					   lowmem_deathpending_timeout)) {
+				task_unlock(new.p);
+				rcu_read_unlock();
+				mutex_unlock(&lowmem_batch_lock);
+				return -1;
+			}
+			new.oom_score_adj = new.p->signal->oom_score_adj;
+			new.tasksize = get_mm_rss(new.p->mm);
+			task_unlock(new.p);
+			if (new.oom_score_adj < min_score_adj ||
+			    new.tasksize <= 0)
+				continue;
+
+			new.leader = tsk;
+			lowmem_add_candidate(cand, &nr, max, &new);
+		}
+		/* the walk ended in another bucket: it moved under us */
+		if (get_nulls_value(pos) != bucket)
+			goto restart;
+
+		for (covered = 0, i = 0; i < nr; i++)
+			covered += cand[i].tasksize;
+	}
+
+	if (!nr) {
+		rcu_read_unlock();
+		mutex_unlock(&lowmem_batch_lock);
+		return 0;
+	}
+
+	for (i = 0; i < nr && freed < deficit; i++) {
+		struct task_struct *p = cand[i].p;
+
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+			     p->pid, p->comm, cand[i].oom_score_adj,
+			     cand[i].tasksize);
+		send_sig(SIGKILL, p, 0);
+		set_tsk_thread_flag(p, TIF_MEMDIE);
+		get_task_struct(p);
+		lowmem_victims[lowmem_nr_victims++] = p;
+		freed += cand[i].tasksize;
+		killed++;
+	}
+	if (killed)
+		lowmem_deathpending_timeout = jiffies + HZ;
+	rcu_read_unlock();
+
+	lowmem_account_scan(start, killed);
+	mutex_unlock(&lowmem_batch_lock);
+
+	return freed;
+}
+
+#endif /* CONFIG_ANDROID_LMK_ADJ_INDEX */
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *tsk;
@@ -97,9 +510,11 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	int tasksize;
 	int i;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
+	int minfree __maybe_unused = 0;
 	int selected_tasksize = 0;
 	int selected_oom_score_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
+	ktime_t start;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
@@ -122,10 +537,17 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+	if (lowmem_use_pressure)
+		min_score_adj = lowmem_pressure_adj(other_free, other_file,
+						    array_size, &minfree);
+	else
+#endif
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
 			min_score_adj = lowmem_adj[i];
+			minfree = lowmem_minfree[i];
 			break;
 		}
 	}
@@ -144,6 +566,32 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+	if (lowmem_batch_kill) {
+		/*
+		 * A level picked from reclaim pressure can come with free
+		 * memory still above its minfree; kill at least one victim.
+		 */
+		int freed = lowmem_batch_shrink(min_score_adj,
+						max(minfree - other_free, 1));
+
+		if (freed < 0)
+			return 0;
+		if (freed > 0) {
+			rem -= freed;
+			lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
+				     sc->nr_to_scan, sc->gfp_mask, rem);
+			return rem;
+		}
+		/*
+		 * The index offered nobody, e.g. because a leader was
+		 * between buckets while its adj changed: scan every
+		 * process rather than kill nothing.
+		 */
+	}
+#endif
+
+	start = ktime_get();
 	rcu_read_lock();
 	for_each_process(tsk) {
 		struct task_struct *p;
@@ -160,6 +608,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
 			task_unlock(p);
 			rcu_read_unlock();
+			lowmem_account_suppressed();
 			return 0;
 		}
 		oom_score_adj = p->signal->oom_score_adj;
@@ -196,9 +645,72 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
 	rcu_read_unlock();
+	lowmem_account_scan(start, selected ? 1 : 0);
 	return rem;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int lowmem_stats_show(struct seq_file *s, void *unused)
+{
+	typeof(lowmem_stats) st;
+
+	spin_lock(&lowmem_stats_lock);
+	st = lowmem_stats;
+	spin_unlock(&lowmem_stats_lock);
+
+	seq_printf(s, "scans: %u\n", st.scans);
+	seq_printf(s, "scan_time_ns_total: %llu\n", st.scan_ns);
+	seq_printf(s, "scan_time_ns_max: %llu\n", st.scan_ns_max);
+	seq_printf(s, "scan_time_ns_avg: %llu\n",
+		   st.scans ? div_u64(st.scan_ns, st.scans) : 0);
+	seq_printf(s, "kill_events: %u\n", st.kill_events);
+	seq_printf(s, "kills: %u\n", st.kills);
+	seq_printf(s, "kills_per_event_max: %u\n", st.kills_max);
+	seq_printf(s, "suppressed: %u\n", st.suppressed);
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+	seq_printf(s, "pressure: %u\n", lowmem_current_pressure());
+#endif
+
+	return 0;
+}
+
+static int lowmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_stats_show, NULL);
+}
+
+static const struct file_operations lowmem_stats_fops = {
+	.open = lowmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *lowmem_debugfs;
+
+static void lowmem_debugfs_init(void)
+{
+	lowmem_debugfs = debugfs_create_dir("lowmemorykiller", NULL);
+	if (IS_ERR_OR_NULL(lowmem_debugfs))
+		return;
+	debugfs_create_file("stats", S_IRUGO, lowmem_debugfs, NULL,
+			    &lowmem_stats_fops);
+}
+
+static void lowmem_debugfs_exit(void)
+{
+	debugfs_remove_recursive(lowmem_debugfs);
+}
+#else
+static void lowmem_debugfs_init(void)
+{
+}
+
+static void lowmem_debugfs_exit(void)
+{
+}
+#endif
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -209,12 +721,20 @@ static int __init lowmem_init(void)
 	register_shrinker(&lowmem_shrinker);
 #ifdef CONFIG_MEMORY_HOTPLUG
 	hotplug_memory_notifier(lmk_hotplug_callback, 0);
+#endif
+	lowmem_debugfs_init();
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+	vmpressure_register_notifier(&lowmem_vmpressure_nb);
 #endif
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+	vmpressure_unregister_notifier(&lowmem_vmpressure_nb);
+#endif
+	lowmem_debugfs_exit();
 	unregister_shrinker(&lowmem_shrinker);
 }
 
@@ -224,6 +744,16 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+#ifdef CONFIG_ANDROID_LMK_VMPRESSURE
+module_param_array_named(pressure, lowmem_pressure, int, &lowmem_pressure_size,
+			 S_IRUGO | S_IWUSR);
+module_param_named(use_pressure, lowmem_use_pressure, uint,
+		   S_IRUGO | S_IWUSR);
+#endif
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+module_param_named(batch_kill, lowmem_batch_kill, uint, S_IRUGO | S_IWUSR);
+module_param_named(batch_max, lowmem_batch_max, uint, S_IRUGO | S_IWUSR);
+#endif
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -27,7 +27,9 @@
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
+#include <linux/hash.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/cpu.h>
@@ -55,22 +57,39 @@ static void zram_stat_dec(u32 *v)
 	*v = *v - 1;
 }
 
+static void zram_stat64_add(struct zram *zram, atomic64_t *v, u64 inc)
+{
+	atomic64_add(inc, v);
+}
+
+static void zram_stat64_sub(struct zram *zram, atomic64_t *v, u64 dec)
+{
+	atomic64_sub(dec, v);
+}
+
+static void zram_stat64_inc(struct zram *zram, atomic64_t *v)
+{
+	atomic64_inc(v);
+}
+
 /* Cryptographic API features */
 static char *zram_compressor = ZRAM_COMPRESSOR_DEFAULT;
-static struct crypto_comp * __percpu *zram_comp_pcpu_tfms;
 
 enum comp_op {
 	ZRAM_COMPOP_COMPRESS,
 	ZRAM_COMPOP_DECOMPRESS
 };
 
-static int zram_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
-			u8 *dst, unsigned int *dlen)
+static int zram_comp_op(struct zram *zram, enum comp_op op, const u8 *src,
+			unsigned int slen, u8 *dst, unsigned int *dlen)
 {
 	struct crypto_comp *tfm;
+#ifdef CONFIG_ZRAM_COMP_TIMING
+	ktime_t start = ktime_get();
+#endif
 	int ret;
 
-	tfm = *per_cpu_ptr(zram_comp_pcpu_tfms, get_cpu());
+	tfm = *per_cpu_ptr(zram->comp_tfms, get_cpu());
 	switch (op) {
 	case ZRAM_COMPOP_COMPRESS:
 		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
@@ -83,9 +102,18 @@ static int zram_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
 	}
 	put_cpu();
 
+#ifdef CONFIG_ZRAM_COMP_TIMING
+	zram_stat64_add(zram, op == ZRAM_COMPOP_COMPRESS ?
+			&zram->stats.compr_ns : &zram->stats.decompr_ns,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+#endif
+	if (op == ZRAM_COMPOP_DECOMPRESS)
+		zram_stat64_inc(zram, &zram->stats.num_decompr);
+
 	return ret;
 }
 
+/* Validate the module-wide default used for newly created devices */
 static int __init zram_comp_init(void)
 {
 	int ret;
@@ -97,175 +125,412 @@ static int __init zram_comp_init(void)
 		if (!ret)
 			return -ENODEV;
 	}
-	pr_info("using %s compressor\n", zram_compressor);
+	pr_info("using %s compressor by default\n", zram_compressor);
+
+	return 0;
+}
+
+static void zram_comp_free(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->comp_tfms)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = *per_cpu_ptr(zram->comp_tfms, cpu);
+
+		if (tfm)
+			crypto_free_comp(tfm);
+	}
 
-	/* alloc percpu transforms */
-	zram_comp_pcpu_tfms = alloc_percpu(struct crypto_comp *);
-	if (!zram_comp_pcpu_tfms)
+	free_percpu(zram->comp_tfms);
+	zram->comp_tfms = NULL;
+}
+
+/* Allocate one transform per possible cpu for zram->compressor */
+static int zram_comp_alloc(struct zram *zram)
+{
+	struct crypto_comp *tfm;
+	int cpu;
+
+	zram->comp_tfms = alloc_percpu(struct crypto_comp *);
+	if (!zram->comp_tfms)
 		return -ENOMEM;
 
+	for_each_possible_cpu(cpu) {
+		tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(tfm)) {
+			zram_comp_free(zram);
+			return PTR_ERR(tfm);
+		}
+		*per_cpu_ptr(zram->comp_tfms, cpu) = tfm;
+	}
+
 	return 0;
 }
+/* end of Cryptographic API features */
 
-static inline void zram_comp_exit(void)
+static int zram_test_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
 {
-	/* free percpu transforms */
-	if (zram_comp_pcpu_tfms)
-		free_percpu(zram_comp_pcpu_tfms);
+	return zram->table[index].flags & BIT(flag);
 }
 
+static void zram_set_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	zram->table[index].flags |= BIT(flag);
+}
 
-/* Crypto API features: percpu code */
-#define ZRAM_DSTMEM_ORDER 1
-static DEFINE_PER_CPU(u8 *, zram_dstmem);
+static void zram_clear_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	zram->table[index].flags &= ~BIT(flag);
+}
 
-static int zram_comp_cpu_up(int cpu)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
-	struct crypto_comp *tfm;
+	unsigned int pos;
+	unsigned long *page;
+
+	page = (unsigned long *)ptr;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page) - 1; pos++) {
+		if (page[pos] != page[pos + 1])
+			return 0;
+	}
 
-	tfm = crypto_alloc_comp(zram_compressor, 0, 0);
-	if (IS_ERR(tfm))
-		return NOTIFY_BAD;
-	*per_cpu_ptr(zram_comp_pcpu_tfms, cpu) = tfm;
-	return NOTIFY_OK;
+	*element = page[0];
+	return 1;
 }
 
-static void zram_comp_cpu_down(int cpu)
+static void zram_fill_page(void *ptr, unsigned int len, unsigned long value)
 {
-	struct crypto_comp *tfm;
+	unsigned int pos;
+	unsigned long *page;
 
-	tfm = *per_cpu_ptr(zram_comp_pcpu_tfms, cpu);
-	crypto_free_comp(tfm);
-	*per_cpu_ptr(zram_comp_pcpu_tfms, cpu) = NULL;
+	if (likely(!value)) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+	for (pos = 0; pos < len / sizeof(*page); pos++)
+		page[pos] = value;
 }
 
-static int zram_cpu_notifier(struct notifier_block *nb,
-				unsigned long action, void *pcpu)
+/* Content based deduplication of compressed pages */
+static struct kmem_cache *zram_entry_cache;
+
+static u32 zram_dedup_checksum(void *mem)
 {
-	int ret;
-	int cpu = (long) pcpu;
-
-	switch (action) {
-	case CPU_UP_PREPARE:
-		ret = zram_comp_cpu_up(cpu);
-		if (ret != NOTIFY_OK) {
-			pr_err("zram: can't allocate compressor xform\n");
-			return ret;
-		}
-		per_cpu(zram_dstmem, cpu) = (void *)__get_free_pages(
-			GFP_KERNEL | __GFP_REPEAT, ZRAM_DSTMEM_ORDER);
-		break;
-	case CPU_DEAD:
-	case CPU_UP_CANCELED:
-		zram_comp_cpu_down(cpu);
-		free_pages((unsigned long) per_cpu(zram_dstmem, cpu),
-			    ZRAM_DSTMEM_ORDER);
-		per_cpu(zram_dstmem, cpu) = NULL;
-		break;
-	default:
-		break;
-	}
-	return NOTIFY_OK;
+	return jhash2(mem, PAGE_SIZE / sizeof(u32), 0);
 }
 
-static struct notifier_block zram_cpu_notifier_block = {
-	.notifier_call = zram_cpu_notifier
-};
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[hash_32(checksum, zram->dedup_bits)];
+}
 
-/* Helper function releasing tfms from online cpus */
-static inline void zram_comp_cpus_down(void)
+/*
+ * Checksums only select candidates: compare the full page content,
+ * decompressing the candidate into @buf if needed.
+ */
+static int zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+			    void *mem, void *buf)
 {
-	int cpu;
+	int match = 0;
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *cmem;
 
-	get_online_cpus();
-	for_each_online_cpu(cpu) {
-		void *pcpu = (void *)(long)cpu;
-		zram_cpu_notifier(&zram_cpu_notifier_block,
-				  CPU_UP_CANCELED, pcpu);
-	}
-	put_online_cpus();
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->len == PAGE_SIZE)
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+	else if (!zram_comp_op(zram, ZRAM_COMPOP_DECOMPRESS, cmem,
+			       entry->len, buf, &clen))
+		match = !memcmp(mem, buf, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
 }
 
-static int zram_cpu_init(void)
+/* Drop a reference, freeing the object with the last one */
+static bool zram_dedup_release(struct zram *zram, struct zram_entry *entry)
 {
-	int ret;
-	unsigned int cpu;
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return false;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
 
-	ret = register_cpu_notifier(&zram_cpu_notifier_block);
-	if (ret) {
-		pr_err("zram: can't register cpu notifier\n");
-		goto out;
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+	return true;
+}
+
+/*
+ * Find a stored page identical to @mem. The entry is returned with
+ * a reference held for the caller.
+ *
+ * The candidate is pinned and compared without dedup_lock, so writers
+ * do not serialize behind a decompress and memcmp. Only the first
+ * candidate with a matching checksum is compared: a 32-bit checksum
+ * collision within one bucket is rare, and giving up on it only costs
+ * one unshared copy.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram, void *mem,
+					  u32 checksum, void *buf)
+{
+	struct zram_entry *entry, *found = NULL;
+	struct hlist_node *pos;
+
+	zram_stat64_inc(zram, &zram->stats.dedup_checks);
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, zram_dedup_bucket(zram, checksum),
+			     node) {
+		if (entry->checksum == checksum) {
+			entry->refcount++;
+			found = entry;
+			break;
+		}
 	}
+	spin_unlock(&zram->dedup_lock);
 
-	get_online_cpus();
-	for_each_online_cpu(cpu) {
-		void *pcpu = (void *)(long)cpu;
-		if (zram_cpu_notifier(&zram_cpu_notifier_block,
-				      CPU_UP_PREPARE, pcpu) != NOTIFY_OK)
-			goto cleanup;
+	if (!found)
+		return NULL;
+
+	if (!zram_dedup_match(zram, found, mem, buf)) {
+		zram_dedup_release(zram, found);
+		return NULL;
 	}
-	put_online_cpus();
-	return ret;
 
-cleanup:
-	zram_comp_cpus_down();
+	zram_stat64_inc(zram, &zram->stats.dedup_hits);
+	zram_stat64_add(zram, &zram->stats.dedup_saved, found->len);
+	return found;
+}
 
-out:
-	put_online_cpus();
-	return -ENOMEM;
+/* Make a freshly stored object available for sharing */
+static struct zram_entry *zram_dedup_insert(struct zram *zram,
+			unsigned long handle, u16 len, u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->len = len;
+	entry->checksum = checksum;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
 }
-/* end of Cryptographic API features */
 
-static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+static void zram_dedup_put(struct zram *zram, struct zram_entry *entry)
 {
-	spin_lock(&zram->stat64_lock);
-	*v = *v + inc;
-	spin_unlock(&zram->stat64_lock);
+	/* len never changes once the entry is hashed */
+	u16 len = entry->len;
+
+	if (!zram_dedup_release(zram, entry))
+		zram_stat64_sub(zram, &zram->stats.dedup_saved, len);
 }
 
-static void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
+static int zram_dedup_init(struct zram *zram, size_t num_pages)
 {
-	spin_lock(&zram->stat64_lock);
-	*v = *v - dec;
-	spin_unlock(&zram->stat64_lock);
+	/* Roughly one bucket per four pages */
+	zram->dedup_bits = max_t(int, ilog2(num_pages) - 2, 8);
+	zram->dedup_hash = vzalloc(sizeof(struct hlist_head) <<
+				   zram->dedup_bits);
+	if (!zram->dedup_hash)
+		return -ENOMEM;
+
+	return 0;
 }
 
-static void zram_stat64_inc(struct zram *zram, u64 *v)
+/* Backing device for pages written back from memory */
+static struct workqueue_struct *zram_bdev_wq;
+
+/* Block 0 is never handed out, so a zero handle stays invalid */
+static unsigned long zram_alloc_bdev_block(struct zram *zram)
 {
-	zram_stat64_add(zram, v, 1);
+	unsigned long blk;
+
+	do {
+		blk = find_next_zero_bit(zram->bdev_map,
+					 zram->bdev_nr_blocks, 1);
+		if (blk >= zram->bdev_nr_blocks)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bdev_map));
+
+	return blk;
 }
 
-static int zram_test_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static void zram_free_bdev_block(struct zram *zram, unsigned long blk)
 {
-	return zram->table[index].flags & BIT(flag);
+	clear_bit(blk, zram->bdev_map);
 }
 
-static void zram_set_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+static void zram_bdev_end_io(struct bio *bio, int err)
 {
-	zram->table[index].flags |= BIT(flag);
+	complete(bio->bi_private);
 }
 
-static void zram_clear_flag(struct zram *zram, u32 index,
-			enum zram_pageflags flag)
+/* Synchronous single page I/O on the backing device */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk, int rw)
 {
-	zram->table[index].flags &= ~BIT(flag);
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *bw =
+		container_of(work, struct zram_bdev_work, work);
+
+	bw->ret = zram_bdev_rw(bw->zram, bw->page, bw->blk, READ);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Bios submitted from within zram_make_request() are only issued
+ * after it returns, so waiting for one there would deadlock. Bounce
+ * such reads to a worker.
+ */
+static int zram_bdev_read_sync(struct zram *zram, struct page *page,
+			       unsigned long blk)
 {
-	unsigned int pos;
-	unsigned long *page;
+	struct zram_bdev_work bw;
 
-	page = (unsigned long *)ptr;
+	if (!current->bio_list)
+		return zram_bdev_rw(zram, page, blk, READ);
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
-			return 0;
+	bw.zram = zram;
+	bw.page = page;
+	bw.blk = blk;
+	INIT_WORK_ONSTACK(&bw.work, zram_bdev_read_work);
+	queue_work(zram_bdev_wq, &bw.work);
+	flush_work(&bw.work);
+	destroy_work_on_stack(&bw.work);
+
+	return bw.ret;
+}
+
+static int zram_bdev_read(struct zram *zram, char *mem, unsigned long blk)
+{
+	struct page *page;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_bdev_read_sync(zram, page, blk);
+	if (!ret) {
+		memcpy(mem, page_address(page), PAGE_SIZE);
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
 	}
+	__free_page(page);
 
-	return 1;
+	return ret;
+}
+
+static void zram_release_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(zram->bdev_map);
+	zram->bdev = NULL;
+	zram->bdev_map = NULL;
+	zram->bdev_nr_blocks = 0;
+}
+
+/* @path is a block device node, or "none" to detach the current one */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev = NULL;
+	unsigned long *map = NULL, nr_blocks = 0;
+
+	if (strcmp(path, "none")) {
+		bdev = blkdev_get_by_path(path,
+				FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+		if (IS_ERR(bdev))
+			return PTR_ERR(bdev);
+
+		nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+		map = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+		if (!map) {
+			blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+			return -ENOMEM;
+		}
+	}
+
+	down_write(&zram->init_lock);
+	if (zram->init_done) {
+		up_write(&zram->init_lock);
+		if (bdev) {
+			vfree(map);
+			blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		}
+		return -EBUSY;
+	}
+
+	zram_release_backing_dev(zram);
+	zram->bdev = bdev;
+	zram->bdev_map = map;
+	zram->bdev_nr_blocks = nr_blocks;
+	up_write(&zram->init_lock);
+
+	return 0;
+}
+
+/* zsmalloc handle of a compressed page, whether shared or not */
+static unsigned long zram_get_handle(struct zram *zram, u32 index)
+{
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		return ((struct zram_entry *)zram->table[index].handle)->handle;
+
+	return zram->table[index].handle;
 }
 
 static void zram_free_page(struct zram *zram, size_t index)
@@ -273,22 +538,48 @@ static void zram_free_page(struct zram *zram, size_t index)
 	unsigned long handle = zram->table[index].handle;
 	u16 size = zram->table[index].size;
 
-	if (unlikely(!handle)) {
+	/* A writeback in flight for the old content is now stale */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	if (zram->idle_map)
+		clear_bit(index, zram->idle_map);
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
 		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
+		 * No memory is allocated for same filled pages.
+		 * Simply clear the flag and the fill value.
 		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		if (handle)
+			zram_stat_dec(&zram->stats.pages_same);
+		else
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
+		zram->table[index].handle = 0;
+		return;
+	}
+
+	if (unlikely(!handle))
+		return;
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		/* see zram_bvec_read_bdev() */
+		atomic_inc(&zram->bdev_frees);
+		zram_free_bdev_block(zram, handle);
+		zram_stat_dec(&zram->stats.pages_wb);
+		zram_stat_dec(&zram->stats.pages_stored);
+		zram->table[index].handle = 0;
 		return;
 	}
 
 	if (unlikely(size > max_zpage_size))
 		zram_stat_dec(&zram->stats.bad_compress);
 
-	zs_free(zram->mem_pool, handle);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		zram_dedup_put(zram, (struct zram_entry *)handle);
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
 
 	if (size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
@@ -301,13 +592,13 @@ static void zram_free_page(struct zram *zram, size_t index)
 	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -325,19 +616,24 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	unsigned char *cmem;
 	unsigned long handle = zram->table[index].handle;
 
-	if (!handle || zram_test_flag(zram, index, ZRAM_ZERO)) {
-		memset(mem, 0, PAGE_SIZE);
+	if (!handle || zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_fill_page(mem, PAGE_SIZE, handle);
 		return 0;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
-	if (zram->table[index].size == PAGE_SIZE)
-		memcpy(mem, cmem, PAGE_SIZE);
-	else
-		ret = zram_comp_op(ZRAM_COMPOP_DECOMPRESS, cmem,
-				zram->table[index].size, mem, &clen);
-
-	zs_unmap_object(zram->mem_pool, handle);
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		ret = zram_bdev_read(zram, mem, handle);
+	} else {
+		handle = zram_get_handle(zram, index);
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+		if (zram->table[index].size == PAGE_SIZE)
+			memcpy(mem, cmem, PAGE_SIZE);
+		else
+			ret = zram_comp_op(zram, ZRAM_COMPOP_DECOMPRESS, cmem,
+					zram->table[index].size, mem, &clen);
+
+		zs_unmap_object(zram->mem_pool, handle);
+	}
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret != 0)) {
@@ -349,6 +645,67 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+/*
+ * Pages on the backing device are bounced through a temporary buffer.
+ *
+ * Called with zram->lock held for read, which is dropped around the disk
+ * read so that writers and the writeback sweep do not wait for it. A
+ * block is only handed out again after the slot owning it was freed,
+ * which bumps bdev_frees under the write lock. If that happened during
+ * the read, the data may be stale and the slot is read again in
+ * whatever state it is in now.
+ */
+static int zram_bvec_read_bdev(struct zram *zram, struct bio_vec *bvec,
+			       u32 index, int offset)
+{
+	int ret, tries = 0;
+	struct page *page = bvec->bv_page;
+	unsigned char *user_mem;
+	char *uncmem;
+
+	uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+	if (!uncmem) {
+		pr_info("Unable to allocate temp memory\n");
+		return -ENOMEM;
+	}
+
+	while (zram_test_flag(zram, index, ZRAM_WB) &&
+	       tries++ < ZRAM_BDEV_READ_TRIES) {
+		unsigned long blk = zram->table[index].handle;
+		int frees = atomic_read(&zram->bdev_frees);
+
+		up_read(&zram->lock);
+		ret = zram_bdev_read(zram, uncmem, blk);
+		down_read(&zram->lock);
+
+		if (atomic_read(&zram->bdev_frees) == frees) {
+			if (unlikely(ret)) {
+				pr_err("Backing device read failed! err=%d, "
+				       "page=%u\n", ret, index);
+				zram_stat64_inc(zram, &zram->stats.failed_reads);
+			}
+			goto done;
+		}
+	}
+
+	/*
+	 * The page is back in memory, or its block keeps being recycled
+	 * under us: read it with the lock held.
+	 */
+	ret = zram_decompress_page(zram, uncmem, index);
+done:
+	if (!ret) {
+		user_mem = kmap_atomic(page);
+		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
+		       bvec->bv_len);
+		kunmap_atomic(user_mem);
+		flush_dcache_page(page);
+	}
+
+	kfree(uncmem);
+	return ret;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
@@ -358,12 +715,19 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 
 	page = bvec->bv_page;
 
+	if (zram->idle_map)
+		clear_bit(index, zram->idle_map);
+
 	if (unlikely(!zram->table[index].handle) ||
-			zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
+			zram_test_flag(zram, index, ZRAM_SAME)) {
+		handle_same_page(bvec, zram->table[index].handle);
 		return 0;
 	}
 
+	/* Reading back from the backing device may sleep */
+	if (zram_test_flag(zram, index, ZRAM_WB))
+		return zram_bvec_read_bdev(zram, bvec, index, offset);
+
 	if (is_partial_io(bvec))
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
@@ -399,22 +763,75 @@ out_cleanup:
 	return ret;
 }
 
+/*
+ * Frees the slots queued by zram_slot_free_notify(). Must run before a
+ * slot is written again, so a late free cannot drop the new content.
+ *
+ * zram->lock must be held for write.
+ */
+static void zram_handle_pending_free(struct zram *zram)
+{
+	struct zram_slot_free *free_rq, *next;
+	unsigned long index;
+
+	spin_lock(&zram->slot_free_lock);
+	free_rq = zram->slot_free_rq;
+	zram->slot_free_rq = NULL;
+	spin_unlock(&zram->slot_free_lock);
+
+	for (; free_rq; free_rq = next) {
+		next = free_rq->next;
+		zram_free_page(zram, free_rq->index);
+		kfree(free_rq);
+	}
+
+	if (!test_and_clear_bit(0, &zram->free_map_pending))
+		return;
+
+	for_each_set_bit(index, zram->free_map, zram->disksize >> PAGE_SHIFT) {
+		clear_bit(index, zram->free_map);
+		zram_free_page(zram, index);
+	}
+}
+
+/* Forget queued slot frees, the table they refer to is going away */
+static void zram_drop_pending_free(struct zram *zram)
+{
+	struct zram_slot_free *free_rq, *next;
+
+	spin_lock(&zram->slot_free_lock);
+	free_rq = zram->slot_free_rq;
+	zram->slot_free_rq = NULL;
+	spin_unlock(&zram->slot_free_lock);
+
+	for (; free_rq; free_rq = next) {
+		next = free_rq->next;
+		kfree(free_rq);
+	}
+
+	clear_bit(0, &zram->free_map_pending);
+}
+
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
-			   int offset)
+			   int offset, unsigned char *src)
 {
+	bool locked = false;
 	int ret = 0;
-	size_t clen;
-	unsigned long handle;
+	size_t clen = 0;
+	u32 checksum = 0;
+	unsigned long handle = 0, element = 0;
+	struct zram_entry *entry = NULL;
 	struct page *page;
-	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
+	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
-		 * before to write the changes.
+		 * before to write the changes, and keep the table locked
+		 * until the merged page is stored, or a concurrent partial
+		 * write to the same page would lose its update.
 		 */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
@@ -422,19 +839,14 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
+		down_write(&zram->lock);
+		locked = true;
+		zram_handle_pending_free(zram);
 		ret = zram_decompress_page(zram, uncmem, index);
 		if (ret)
 			goto out;
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec)) {
@@ -446,16 +858,26 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		uncmem = user_mem;
 	}
 
-	if (page_zero_filled(uncmem)) {
+	if (page_same_filled(uncmem, &element)) {
 		if (!is_partial_io(bvec))
 			kunmap_atomic(user_mem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
-		goto out;
+		goto store;
+	}
+
+	if (zram->dedup) {
+		/* src is not in use yet, use it for candidate compares */
+		checksum = zram_dedup_checksum(uncmem);
+		entry = zram_dedup_find(zram, uncmem, checksum, src);
+		if (entry) {
+			if (!is_partial_io(bvec))
+				kunmap_atomic(user_mem);
+			handle = entry->handle;
+			clen = entry->len;
+			goto store;
+		}
 	}
 
-	ret = zram_comp_op(ZRAM_COMPOP_COMPRESS, uncmem,
+	ret = zram_comp_op(zram, ZRAM_COMPOP_COMPRESS, uncmem,
 			   PAGE_SIZE, src, &clen);
 
 	if (!is_partial_io(bvec)) {
@@ -469,8 +891,11 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		goto out;
 	}
 
+	zram_stat64_inc(zram, &zram->stats.compr_ratio[min_t(size_t,
+		clen * ZRAM_RATIO_BUCKETS / PAGE_SIZE, ZRAM_RATIO_BUCKETS - 1)]);
+
 	if (unlikely(clen > max_zpage_size)) {
-		zram_stat_inc(&zram->stats.bad_compress);
+		zram_stat64_inc(zram, &zram->stats.incompressible);
 		clen = PAGE_SIZE;
 		src = NULL;
 		if (is_partial_io(bvec))
@@ -494,16 +919,59 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	zs_unmap_object(zram->mem_pool, handle);
 
-	zram->table[index].handle = handle;
+	/* Without an entry the object is simply kept unshared */
+	if (zram->dedup)
+		entry = zram_dedup_insert(zram, handle, clen, checksum);
+
+store:
+	/*
+	 * Only the table update needs the device lock; compression above
+	 * runs concurrently when writes come from several workers.
+	 * Partial writes hold it from the read of the old page on.
+	 */
+	if (!locked) {
+		down_write(&zram->lock);
+		locked = true;
+		zram_handle_pending_free(zram);
+	}
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	if (zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_SAME))
+		zram_free_page(zram, index);
+
+	if (!handle) {
+		if (element)
+			zram_stat_inc(&zram->stats.pages_same);
+		else
+			zram_stat_inc(&zram->stats.pages_zero);
+		zram->table[index].handle = element;
+		zram_set_flag(zram, index, ZRAM_SAME);
+		goto out;
+	}
+
+	if (entry) {
+		zram->table[index].handle = (unsigned long)entry;
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	} else {
+		zram->table[index].handle = handle;
+	}
 	zram->table[index].size = clen;
 
 	/* Update stats */
 	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
+	if (unlikely(clen > max_zpage_size))
+		zram_stat_inc(&zram->stats.bad_compress);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
 
 out:
+	if (locked)
+		up_write(&zram->lock);
 	if (is_partial_io(bvec))
 		kfree(uncmem);
 
@@ -512,8 +980,12 @@ out:
 	return ret;
 }
 
+/*
+ * @cbuf is the compression buffer owned by the calling write worker,
+ * or NULL for inline writes which share zram->compress_buffer.
+ */
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
-			int offset, struct bio *bio, int rw)
+			int offset, struct bio *bio, int rw, void *cbuf)
 {
 	int ret;
 
@@ -521,10 +993,13 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 		down_read(&zram->lock);
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 		up_read(&zram->lock);
+	} else if (cbuf) {
+		ret = zram_bvec_write(zram, bvec, index, offset, cbuf);
 	} else {
-		down_write(&zram->lock);
-		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
+		mutex_lock(&zram->buffer_lock);
+		ret = zram_bvec_write(zram, bvec, index, offset,
+				      zram->compress_buffer);
+		mutex_unlock(&zram->buffer_lock);
 	}
 
 	return ret;
@@ -537,7 +1012,8 @@ static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
 	*offset = (*offset + bvec->bv_len) % PAGE_SIZE;
 }
 
-static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
+static void __zram_make_request(struct zram *zram, struct bio *bio, int rw,
+				void *cbuf)
 {
 	int i, offset;
 	u32 index;
@@ -569,16 +1045,18 @@ static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 			bv.bv_len = max_transfer_size;
 			bv.bv_offset = bvec->bv_offset;
 
-			if (zram_bvec_rw(zram, &bv, index, offset, bio, rw) < 0)
+			if (zram_bvec_rw(zram, &bv, index, offset, bio, rw,
+					 cbuf) < 0)
 				goto out;
 
 			bv.bv_len = bvec->bv_len - max_transfer_size;
 			bv.bv_offset += max_transfer_size;
-			if (zram_bvec_rw(zram, &bv, index+1, 0, bio, rw) < 0)
+			if (zram_bvec_rw(zram, &bv, index+1, 0, bio, rw,
+					 cbuf) < 0)
 				goto out;
 		} else
-			if (zram_bvec_rw(zram, bvec, index, offset, bio, rw)
-			    < 0)
+			if (zram_bvec_rw(zram, bvec, index, offset, bio, rw,
+					 cbuf) < 0)
 				goto out;
 
 		update_position(&index, &offset, bvec);
@@ -609,6 +1087,137 @@ static inline int valid_io_request(struct zram *zram, struct bio *bio)
 	return 1;
 }
 
+/* Parallel write path: per-cpu compression workers */
+static struct workqueue_struct *zram_write_wq;
+
+static void zram_wqueue_work(struct work_struct *work)
+{
+	struct zram_wqueue *wq = container_of(work, struct zram_wqueue, work);
+	struct zram *zram = wq->zram;
+	struct bio *bio;
+
+	for (;;) {
+		spin_lock(&wq->lock);
+		bio = bio_list_pop(&wq->bios);
+		spin_unlock(&wq->lock);
+		if (!bio)
+			break;
+
+		/* The device may have been reset while the bio was queued */
+		down_read(&zram->init_lock);
+		if (likely(zram->init_done))
+			__zram_make_request(zram, bio, WRITE,
+					    wq->compress_buffer);
+		else
+			bio_io_error(bio);
+		up_read(&zram->init_lock);
+
+		atomic_dec(&wq->depth);
+		wake_up(&zram->wqueue_wait);
+	}
+}
+
+/* Pick the least loaded online worker, preferring the local one */
+static struct zram_wqueue *zram_pick_wqueue(struct zram *zram)
+{
+	struct zram_wqueue *wq, *best;
+	int cpu;
+
+	best = this_cpu_ptr(zram->wqueues);
+	for_each_online_cpu(cpu) {
+		wq = per_cpu_ptr(zram->wqueues, cpu);
+		if (atomic_read(&wq->depth) < atomic_read(&best->depth))
+			best = wq;
+	}
+
+	return best;
+}
+
+/*
+ * Hand a write bio over to a compression worker. Blocks while every
+ * worker already has ZRAM_WQUEUE_DEPTH bios outstanding so that a
+ * swap-out storm cannot queue unbounded amounts of memory.
+ * Must be called without zram->init_lock held.
+ */
+static void zram_queue_write(struct zram *zram, struct bio *bio)
+{
+	struct zram_wqueue *wq;
+
+	for (;;) {
+		preempt_disable();
+		wq = zram_pick_wqueue(zram);
+		preempt_enable();
+
+		if (atomic_inc_return(&wq->depth) <= ZRAM_WQUEUE_DEPTH)
+			break;
+
+		atomic_dec(&wq->depth);
+		zram_stat64_inc(zram, &zram->stats.write_stalls);
+		wait_event(zram->wqueue_wait,
+			   atomic_read(&wq->depth) < ZRAM_WQUEUE_DEPTH);
+	}
+
+	spin_lock(&wq->lock);
+	bio_list_add(&wq->bios, bio);
+	spin_unlock(&wq->lock);
+
+	queue_work_on(wq->cpu, zram_write_wq, &wq->work);
+}
+
+static void zram_free_wqueues(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->wqueues)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_wqueue *wq = per_cpu_ptr(zram->wqueues, cpu);
+
+		free_pages((unsigned long)wq->compress_buffer, 1);
+	}
+
+	free_percpu(zram->wqueues);
+	zram->wqueues = NULL;
+}
+
+/*
+ * Workers and their buffers outlive device resets, since queued work
+ * can still reference them; they are only freed in destroy_device().
+ */
+static int zram_alloc_wqueues(struct zram *zram)
+{
+	int cpu;
+
+	if (zram->wqueues)
+		return 0;
+
+	zram->wqueues = alloc_percpu(struct zram_wqueue);
+	if (!zram->wqueues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_wqueue *wq = per_cpu_ptr(zram->wqueues, cpu);
+
+		wq->zram = zram;
+		wq->cpu = cpu;
+		spin_lock_init(&wq->lock);
+		bio_list_init(&wq->bios);
+		atomic_set(&wq->depth, 0);
+		INIT_WORK(&wq->work, zram_wqueue_work);
+		wq->compress_buffer =
+			(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+		if (!wq->compress_buffer)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	zram_free_wqueues(zram);
+	return -ENOMEM;
+}
+
 /*
  * Handler function for all zram I/O requests.
  */
@@ -625,7 +1234,13 @@ static void zram_make_request(struct request_queue *queue, struct bio *bio)
 		goto error;
 	}
 
-	__zram_make_request(zram, bio, bio_data_dir(bio));
+	if (zram->parallel_write && bio_data_dir(bio) == WRITE) {
+		up_read(&zram->init_lock);
+		zram_queue_write(zram, bio);
+		return;
+	}
+
+	__zram_make_request(zram, bio, bio_data_dir(bio), NULL);
 	up_read(&zram->init_lock);
 
 	return;
@@ -635,6 +1250,127 @@ error:
 	bio_io_error(bio);
 }
 
+static int zram_wb_candidate(struct zram *zram, u32 index, int mode)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram->table[index].size == PAGE_SIZE;
+
+	return test_bit(index, zram->idle_map);
+}
+
+/*
+ * Move the pages selected by zram->wb_mode to the backing device and
+ * free their memory. The device lock is dropped around each write, so
+ * a page rewritten or freed meanwhile loses ZRAM_UNDER_WB and is
+ * skipped.
+ */
+static void zram_writeback_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_work);
+	unsigned long blk = 0;
+	struct page *page;
+	size_t index;
+	int ret;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev)
+		goto out;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!blk) {
+			blk = zram_alloc_bdev_block(zram);
+			if (!blk) {
+				pr_info("Backing device is full\n");
+				break;
+			}
+		}
+
+		down_write(&zram->lock);
+		if (!zram_wb_candidate(zram, index, zram->wb_mode) ||
+		    zram_decompress_page(zram, page_address(page), index)) {
+			up_write(&zram->lock);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		up_write(&zram->lock);
+
+		ret = zram_bdev_rw(zram, page, blk, WRITE);
+
+		down_write(&zram->lock);
+		if (!ret && zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			/* Drop the in-memory copy; the page is still stored */
+			zram_free_page(zram, index);
+			zram_stat_inc(&zram->stats.pages_stored);
+			zram_stat_inc(&zram->stats.pages_wb);
+			zram->table[index].handle = blk;
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram_stat64_inc(zram, &zram->stats.bd_writes);
+			blk = 0;
+		}
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		up_write(&zram->lock);
+	}
+
+	if (blk)
+		zram_free_bdev_block(zram, blk);
+out:
+	up_read(&zram->init_lock);
+	__free_page(page);
+}
+
+/* Queue an asynchronous writeback sweep, see zram_writeback_work() */
+int zram_writeback(struct zram *zram, int mode)
+{
+	int ret = 0;
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	zram->wb_mode = mode;
+	queue_work(zram_bdev_wq, &zram->wb_work);
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+/* Mark every page held in memory idle until it is next accessed */
+int zram_mark_idle(struct zram *zram)
+{
+	int ret = 0;
+	size_t index;
+
+	down_read(&zram->init_lock);
+	if (!zram->init_done || !zram->idle_map) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	down_read(&zram->lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_SAME) &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			set_bit(index, zram->idle_map);
+	}
+	up_read(&zram->lock);
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
 void __zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -644,6 +1380,8 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
+	zram_drop_pending_free(zram);
+
 	/* Free various per-device buffers */
 	kfree(zram->compress_workmem);
 	free_pages((unsigned long)zram->compress_buffer, 1);
@@ -651,18 +1389,35 @@ void __zram_reset_device(struct zram *zram)
 	zram->compress_workmem = NULL;
 	zram->compress_buffer = NULL;
 
+	zram_comp_free(zram);
+
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		unsigned long handle = zram->table[index].handle;
-		if (!handle)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		zs_free(zram->mem_pool, handle);
+		if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, (struct zram_entry *)handle);
+		else
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
+	vfree(zram->free_map);
+	zram->free_map = NULL;
+
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+
+	vfree(zram->idle_map);
+	zram->idle_map = NULL;
+	if (zram->bdev_map)
+		bitmap_zero(zram->bdev_map, zram->bdev_nr_blocks);
+
 	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
@@ -705,7 +1460,13 @@ int zram_init_device(struct zram *zram)
 	if (!zram->compress_buffer) {
 		pr_err("Error allocating compressor buffer space\n");
 		ret = -ENOMEM;
-		goto fail_no_table;
+		goto fail;
+	}
+
+	ret = zram_comp_alloc(zram);
+	if (ret) {
+		pr_err("Error allocating %s compressor\n", zram->compressor);
+		goto fail_buffer;
 	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
@@ -713,17 +1474,47 @@ int zram_init_device(struct zram *zram)
 	if (!zram->table) {
 		pr_err("Error allocating zram address table\n");
 		ret = -ENOMEM;
-		goto fail_no_table;
+		goto fail_comp;
+	}
+
+	zram->free_map = vzalloc(BITS_TO_LONGS(num_pages) * sizeof(long));
+	if (!zram->free_map) {
+		pr_err("Error allocating free slot map\n");
+		ret = -ENOMEM;
+		goto fail_table;
+	}
+
+	if (zram->dedup && zram_dedup_init(zram, num_pages)) {
+		pr_err("Error allocating dedup hash table\n");
+		ret = -ENOMEM;
+		goto fail_free_map;
+	}
+
+	if (zram->bdev) {
+		zram->idle_map = vzalloc(BITS_TO_LONGS(num_pages) *
+					 sizeof(long));
+		if (!zram->idle_map) {
+			pr_err("Error allocating idle page map\n");
+			ret = -ENOMEM;
+			goto fail_dedup;
+		}
+	}
+
+	/* The write queues outlive resets, see zram_alloc_wqueues() */
+	if (zram->parallel_write && zram_alloc_wqueues(zram)) {
+		pr_err("Error allocating parallel write queues\n");
+		ret = -ENOMEM;
+		goto fail_idle;
 	}
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name, GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
-		goto fail;
+		goto fail_idle;
 	}
 
 	zram->init_done = 1;
@@ -731,22 +1522,77 @@ int zram_init_device(struct zram *zram)
 	pr_debug("Initialization done!\n");
 	return 0;
 
-fail_no_table:
-	/* To prevent accessing table entries during cleanup */
-	zram->disksize = 0;
+	/*
+	 * Nothing is stored yet, so unlike __zram_reset_device() only the
+	 * allocations made so far need to be undone.
+	 */
+fail_idle:
+	vfree(zram->idle_map);
+	zram->idle_map = NULL;
+fail_dedup:
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+fail_free_map:
+	vfree(zram->free_map);
+	zram->free_map = NULL;
+fail_table:
+	vfree(zram->table);
+	zram->table = NULL;
+fail_comp:
+	zram_comp_free(zram);
+fail_buffer:
+	free_pages((unsigned long)zram->compress_buffer, 1);
+	zram->compress_buffer = NULL;
 fail:
-	__zram_reset_device(zram);
+	zram->disksize = 0;
+	set_capacity(zram->disk, 0);
 	pr_err("Initialization failed: err=%d\n", ret);
 	return ret;
 }
 
+static void zram_slot_free_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, free_work);
+
+	down_read(&zram->init_lock);
+	if (zram->init_done) {
+		down_write(&zram->lock);
+		zram_handle_pending_free(zram);
+		up_write(&zram->lock);
+	} else {
+		zram_drop_pending_free(zram);
+	}
+	up_read(&zram->init_lock);
+}
+
+/*
+ * Called with swap_lock held, so zram->lock cannot be taken here. The
+ * slot is queued and freed from a work item, or by the next write,
+ * whichever comes first.
+ */
 static void zram_slot_free_notify(struct block_device *bdev,
 				unsigned long index)
 {
+	struct zram_slot_free *free_rq;
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
-	zram_free_page(zram, index);
+
+	free_rq = kmalloc(sizeof(*free_rq), GFP_ATOMIC);
+	if (free_rq) {
+		free_rq->index = index;
+		spin_lock(&zram->slot_free_lock);
+		free_rq->next = zram->slot_free_rq;
+		zram->slot_free_rq = free_rq;
+		spin_unlock(&zram->slot_free_lock);
+	} else {
+		/* Without memory, mark the slot in the preallocated map */
+		set_bit(index, zram->free_map);
+		smp_mb__after_clear_bit();
+		set_bit(0, &zram->free_map_pending);
+	}
+
+	schedule_work(&zram->free_work);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -761,7 +1607,13 @@ static int create_device(struct zram *zram, int device_id)
 
 	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
-	spin_lock_init(&zram->stat64_lock);
+	mutex_init(&zram->buffer_lock);
+	init_waitqueue_head(&zram->wqueue_wait);
+	spin_lock_init(&zram->dedup_lock);
+	INIT_WORK(&zram->wb_work, zram_writeback_work);
+	spin_lock_init(&zram->slot_free_lock);
+	INIT_WORK(&zram->free_work, zram_slot_free_work);
+	strlcpy(zram->compressor, zram_compressor, sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -824,6 +1676,13 @@ static void destroy_device(struct zram *zram)
 	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
 			&zram_disk_attr_group);
 
+	flush_workqueue(zram_write_wq);
+	zram_free_wqueues(zram);
+
+	cancel_work_sync(&zram->wb_work);
+	cancel_work_sync(&zram->free_work);
+	zram_release_backing_dev(zram);
+
 	if (zram->disk) {
 		del_gendisk(zram->disk);
 		put_disk(zram->disk);
@@ -846,28 +1705,44 @@ static int __init zram_init(void)
 	pr_info("Loading Crypto API features\n");
 	if (zram_comp_init()) {
 		pr_err("Compressor initialization failed\n");
-		ret = -ENOMEM;
+		ret = -ENODEV;
 		goto out;
 	}
 
-	if (zram_cpu_init()) {
-		pr_err("Per-cpu initialization failed\n");
-		ret = -ENOMEM;
-		goto free_comp;
-	}
-
 	if (num_devices > max_num_devices) {
 		pr_warn("Invalid value for num_devices: %u\n",
 				num_devices);
 		ret = -EINVAL;
-		goto free_cpu_comp;
+		goto out;
+	}
+
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		pr_err("Unable to create dedup entry cache\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	zram_write_wq = alloc_workqueue("zram_write",
+				WQ_MEM_RECLAIM | WQ_CPU_INTENSIVE, 0);
+	if (!zram_write_wq) {
+		pr_err("Unable to create write workqueue\n");
+		ret = -ENOMEM;
+		goto free_cache;
+	}
+
+	zram_bdev_wq = alloc_workqueue("zram_bdev", WQ_MEM_RECLAIM, 0);
+	if (!zram_bdev_wq) {
+		pr_err("Unable to create backing device workqueue\n");
+		ret = -ENOMEM;
+		goto destroy_write_wq;
 	}
 
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warn("Unable to get major number\n");
 		ret = -EBUSY;
-		goto free_cpu_comp;
+		goto destroy_bdev_wq;
 	}
 
 	/* Allocate the device array and initialize each one */
@@ -893,10 +1768,12 @@ free_devices:
 	kfree(zram_devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
-free_cpu_comp:
-	zram_comp_cpus_down();
-free_comp:
-	zram_comp_exit();
+destroy_bdev_wq:
+	destroy_workqueue(zram_bdev_wq);
+destroy_write_wq:
+	destroy_workqueue(zram_write_wq);
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -914,10 +1791,11 @@ static void __exit zram_exit(void)
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	destroy_workqueue(zram_bdev_wq);
+	destroy_workqueue(zram_write_wq);
 
 	kfree(zram_devices);
-	zram_comp_cpus_down();
-	zram_comp_exit();
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
@@ -928,7 +1806,7 @@ module_init(zram_init);
 module_exit(zram_exit);
 
 module_param_named(compressor, zram_compressor, charp, 0);
-MODULE_PARM_DESC(compressor, "Compressor type");
+MODULE_PARM_DESC(compressor, "Default compressor for new devices");
 
 MODULE_LICENSE("Dual BSD/GPL");
 MODULE_AUTHOR("Nitin Gupta <ngupta@vflare.org>");
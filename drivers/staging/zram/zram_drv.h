@@ -17,6 +17,10 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/bio.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include "../zsmalloc/zsmalloc.h"
 
@@ -40,6 +44,24 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
  * otherwise, xv_malloc() would always return failure.
  */
 
+/*
+ * Maximum number of write bios queued on a single per-cpu compression
+ * worker before zram_make_request() blocks the submitter.
+ */
+#define ZRAM_WQUEUE_DEPTH	64
+
+/*
+ * Compressed sizes are accounted in this many equally sized buckets
+ * between 0 and PAGE_SIZE.
+ */
+#define ZRAM_RATIO_BUCKETS	8
+
+/*
+ * Reads from the backing device are retried without zram->lock this
+ * many times when the block is recycled meanwhile, then done with it.
+ */
+#define ZRAM_BDEV_READ_TRIES	3
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -53,12 +75,24 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page consists entirely of one repeated word, kept in handle */
+	ZRAM_SAME,
+	/* handle points to a struct zram_entry shared by identical pages */
+	ZRAM_DEDUP,
+	/* Page lives on the backing device, handle is the block index */
+	ZRAM_WB,
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/* Writeback sweep selectors, see writeback_store() */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,	/* pages that did not compress */
+	ZRAM_WB_IDLE,	/* pages not accessed since the last idle mark */
+};
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
@@ -69,28 +103,76 @@ struct table {
 	u8 flags;
 } __aligned(4);
 
+/* Compressed object shared by all pages with identical content */
+struct zram_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	u32 checksum;		/* of the uncompressed page */
+	u16 len;
+	unsigned int refcount;	/* protected by zram->dedup_lock */
+};
+
+/* Swap slot freed in atomic context, applied later under zram->lock */
+struct zram_slot_free {
+	unsigned long index;
+	struct zram_slot_free *next;
+};
+
 struct zram_stats {
-	u64 compr_size;		/* compressed size of pages stored */
-	u64 num_reads;		/* failed + successful */
-	u64 num_writes;		/* --do-- */
-	u64 failed_reads;	/* should NEVER! happen */
-	u64 failed_writes;	/* can happen when memory is too low */
-	u64 invalid_io;		/* non-page-aligned I/O requests */
-	u64 notify_free;	/* no. of swap slot free notifications */
+	atomic64_t compr_size;	/* compressed size of pages stored */
+	atomic64_t num_reads;	/* failed + successful */
+	atomic64_t num_writes;	/* --do-- */
+	atomic64_t failed_reads;	/* should NEVER! happen */
+	atomic64_t failed_writes;	/* can happen when memory is too low */
+	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
+	atomic64_t notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of pages filled with a non-zero word */
+	u32 pages_wb;		/* no. of pages on the backing device */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 bad_compress;	/* % of pages with compression ratio>=75% */
+	atomic64_t write_stalls;	/* writers throttled on full write queues */
+	atomic64_t compr_ns;	/* time spent compressing pages */
+	atomic64_t decompr_ns;	/* time spent decompressing pages */
+	atomic64_t num_decompr;	/* no. of decompressions */
+	atomic64_t incompressible;	/* pages stored uncompressed */
+	/* histogram of compressed sizes */
+	atomic64_t compr_ratio[ZRAM_RATIO_BUCKETS];
+	atomic64_t dedup_checks;	/* no. of dedup lookups */
+	atomic64_t dedup_hits;	/* no. of pages stored by sharing an object */
+	atomic64_t dedup_saved;	/* compressed bytes currently saved by sharing */
+	atomic64_t bd_reads;	/* pages read from the backing device */
+	atomic64_t bd_writes;	/* pages written to the backing device */
+};
+
+/*
+ * Per-cpu write queue, used when parallel compression is enabled.
+ * Each queue owns its compression buffer, so workers running on
+ * different CPUs compress concurrently and only serialize on the
+ * table update.
+ */
+struct zram_wqueue {
+	struct zram *zram;
+	spinlock_t lock;	/* protects bios */
+	struct bio_list bios;
+	atomic_t depth;		/* bios queued or being processed */
+	struct work_struct work;
+	void *compress_buffer;
+	int cpu;
 };
 
 struct zram {
 	struct zs_pool *mem_pool;
+	/* Compressor name, can only be changed before initialization */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	struct crypto_comp * __percpu *comp_tfms;
 	void *compress_workmem;
 	void *compress_buffer;
+	struct mutex buffer_lock; /* serialize inline users of compress_buffer */
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table against concurrent
+				   * read and writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -101,6 +183,39 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/*
+	 * Fan write bios out to per-cpu compression workers. Can only
+	 * be changed before the device is initialized.
+	 */
+	int parallel_write;
+	struct zram_wqueue __percpu *wqueues;
+	wait_queue_head_t wqueue_wait;	/* writers waiting for queue space */
+	/*
+	 * Share compressed objects between pages with identical content.
+	 * Can only be changed before the device is initialized.
+	 */
+	int dedup;
+	struct hlist_head *dedup_hash;	/* zram_entry buckets by checksum */
+	unsigned int dedup_bits;
+	spinlock_t dedup_lock;		/* protects dedup_hash and refcounts */
+	/*
+	 * Optional backing device for pages written back from memory.
+	 * Can only be changed before the device is initialized.
+	 */
+	struct block_device *bdev;
+	unsigned long *bdev_map;	/* allocated backing device blocks */
+	unsigned long bdev_nr_blocks;
+	unsigned long *idle_map;	/* pages not accessed since idle mark */
+	atomic_t bdev_frees;		/* backing blocks freed from slots */
+	struct work_struct wb_work;
+	int wb_mode;			/* ZRAM_WB_* for the pending sweep */
+	/* Swap slot frees waiting for zram->lock */
+	spinlock_t slot_free_lock;	/* protects slot_free_rq */
+	struct zram_slot_free *slot_free_rq;
+	/* Slots whose free notification found no memory for a request */
+	unsigned long *free_map;
+	unsigned long free_map_pending;	/* bit 0: free_map has set bits */
+	struct work_struct free_work;
 
 	struct zram_stats stats;
 };
@@ -113,5 +228,8 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, int mode);
 
 #endif
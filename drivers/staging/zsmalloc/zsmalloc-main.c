@@ -56,6 +56,9 @@
  *	PG_private: identifies the first component page
  *	PG_private2: identifies the last component page
  *
+ * Objects can be moved between zspages of their class by compaction,
+ * so zs_malloc() hands out an indirect handle rather than the object
+ * location itself (see OBJ_ALLOCATED_TAG in zsmalloc_int.h).
  */
 
 #ifdef CONFIG_ZSMALLOC_DEBUG
@@ -76,6 +79,9 @@
 #include <linux/cpu.h>
 #include <linux/vmalloc.h>
 #include <linux/hardirq.h>
+#include <linux/bit_spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "zsmalloc.h"
 #include "zsmalloc_int.h"
@@ -92,6 +98,13 @@
 /* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+/* slots backing the handles returned by zs_malloc() */
+static struct kmem_cache *zs_handle_cache;
+
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zs_stat_root;
+#endif
+
 static int is_first_page(struct page *page)
 {
 	return PagePrivate(page);
@@ -124,6 +137,12 @@ static void set_zspage_mapping(struct page *page, unsigned int class_idx,
 	page->mapping = (struct address_space *)m;
 }
 
+/* Huge classes hold a single object per zspage and are never compacted */
+static int class_huge(struct size_class *class)
+{
+	return class->objs_per_zspage == 1;
+}
+
 static int get_size_class_index(int size)
 {
 	int idx = 0;
@@ -279,28 +298,66 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single obj value */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
-		return NULL;
+		return 0;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
 
-	return (void *)handle;
+	return obj << OBJ_TAG_BITS;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(unsigned long handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given obj value */
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	*page = pfn_to_page(handle >> OBJ_INDEX_BITS);
-	*obj_idx = handle & OBJ_INDEX_MASK;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long cache_alloc_handle(struct zs_pool *pool)
+{
+	return (unsigned long)kmem_cache_alloc(zs_handle_cache,
+					pool->flags & ~__GFP_HIGHMEM);
+}
+
+static void cache_free_handle(unsigned long handle)
+{
+	kmem_cache_free(zs_handle_cache, (void *)handle);
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
+
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj;
+}
+
+/* A pinned object is left alone by compaction */
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -377,7 +434,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = (void *)location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -388,7 +445,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = (void *)location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -442,9 +499,9 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
-	first_page->objects = class->pages_per_zspage * PAGE_SIZE / class->size;
+	first_page->objects = class->objs_per_zspage;
 
 	error = 0; /* Success */
 
@@ -471,6 +528,58 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+/*
+ * Take the first free object off @first_page's freelist and, unless the
+ * class is huge, record @handle in its header. Called under class->lock.
+ */
+static unsigned long obj_malloc(struct size_class *class,
+				struct page *first_page, unsigned long handle)
+{
+	unsigned long obj;
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	link = (struct link_free *)kmap_atomic(m_page) +
+					m_offset / sizeof(*link);
+	first_page->freelist = link->next;
+	if (!class_huge(class))
+		link->handle = handle | OBJ_ALLOCATED_TAG;
+	else
+		memset(link, POISON_INUSE, sizeof(*link));
+	kunmap_atomic(link);
+
+	first_page->inuse++;
+	class->objs_inuse++;
+
+	return obj;
+}
+
+/* Put @obj back on its zspage's freelist. Called under class->lock. */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+	link->next = first_page->freelist;
+	kunmap_atomic(link);
+	first_page->freelist = (void *)obj;
+
+	first_page->inuse--;
+	class->objs_inuse--;
+}
+
 static void zs_copy_map_object(char *buf, struct page *page,
 				int off, int size)
 {
@@ -517,6 +626,389 @@ static void zs_copy_unmap_object(char *buf, struct page *page,
 	kunmap_atomic(addr);
 }
 
+static void zs_read_object(char *buf, struct page *page, int off, int size)
+{
+	void *addr;
+
+	if (off + size > PAGE_SIZE) {
+		zs_copy_map_object(buf, page, off, size);
+		return;
+	}
+
+	addr = kmap_atomic(page);
+	memcpy(buf, addr + off, size);
+	kunmap_atomic(addr);
+}
+
+static void zs_write_object(char *buf, struct page *page, int off, int size)
+{
+	void *addr;
+
+	if (off + size > PAGE_SIZE) {
+		zs_copy_unmap_object(buf, page, off, size);
+		return;
+	}
+
+	addr = kmap_atomic(page);
+	memcpy(addr + off, buf, size);
+	kunmap_atomic(addr);
+}
+
+/*
+ * Compaction
+ *
+ * Allocation and free patterns leave many zspages of a class sparsely
+ * used, and a zspage is only returned to the system once its last
+ * object is freed. Compaction takes the zspages of a class one at a
+ * time, moves their objects into free slots of the other zspages of
+ * the same class and frees them once empty. Only the handle slot is
+ * rewritten, so users of the pool never see their handles change.
+ * Objects that are mapped or being freed are pinned and left alone.
+ */
+
+/* Number of zspages the class could give back if it were packed tightly */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_allocated;
+
+	if (class_huge(class))
+		return 0;
+
+	obj_allocated = (unsigned long)class->pages_allocated /
+			class->pages_per_zspage * class->objs_per_zspage;
+
+	return (obj_allocated - class->objs_inuse) / class->objs_per_zspage;
+}
+
+/*
+ * Take the sparsest-looking zspage off the fullness lists so that it
+ * cannot be picked as a migration target. Called under class->lock.
+ */
+static struct page *isolate_source_page(struct size_class *class)
+{
+	struct page *page;
+	unsigned int class_idx;
+	enum fullness_group fg;
+
+	page = class->fullness_list[ZS_ALMOST_EMPTY];
+	if (!page)
+		page = class->fullness_list[ZS_ALMOST_FULL];
+	if (!page)
+		return NULL;
+
+	get_zspage_mapping(page, &class_idx, &fg);
+	remove_zspage(page, class, fg);
+
+	return page;
+}
+
+/* Return an isolated zspage to the list matching its new fullness */
+static enum fullness_group putback_zspage(struct size_class *class,
+					struct page *first_page)
+{
+	enum fullness_group fg;
+
+	fg = get_fullness_group(first_page);
+	insert_zspage(first_page, class, fg);
+	set_zspage_mapping(first_page, class->index, fg);
+
+	return fg;
+}
+
+/*
+ * Move every allocated object of the isolated @src_page into the other
+ * zspages of @class. Returns 0 once @src_page is empty, -EBUSY if some
+ * object was pinned and -ENOSPC if the class ran out of free slots.
+ * Called under class->lock.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+				struct page *src_page)
+{
+	struct page *page = src_page;
+	unsigned long off = 0, obj_idx = 0;
+	int i, ret = 0;
+
+	for (i = 0; i < class->objs_per_zspage && src_page->inuse; i++) {
+		struct page *dst_page, *d_page;
+		unsigned long head, handle, old_obj, new_obj;
+		unsigned long d_objidx, d_offset;
+		void *addr;
+
+		if (off >= PAGE_SIZE) {
+			page = get_next_page(page);
+			off = page->index;
+			obj_idx = 0;
+		}
+
+		addr = kmap_atomic(page);
+		head = *(unsigned long *)(addr + off);
+		kunmap_atomic(addr);
+
+		if (!(head & OBJ_ALLOCATED_TAG))
+			goto next;
+
+		handle = head & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_tag(handle)) {
+			ret = -EBUSY;
+			goto next;
+		}
+
+		dst_page = find_get_zspage(class);
+		if (!dst_page) {
+			unpin_tag(handle);
+			ret = -ENOSPC;
+			break;
+		}
+
+		old_obj = location_to_obj(page, obj_idx);
+		new_obj = obj_malloc(class, dst_page, handle);
+		obj_to_location(new_obj, &d_page, &d_objidx);
+		d_offset = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+		zs_read_object(pool->compact_buf, page, off, class->size);
+		zs_write_object(pool->compact_buf, d_page, d_offset,
+				class->size);
+
+		/* keep the pin bit set until the object is fully moved */
+		record_obj(handle, new_obj | (1UL << HANDLE_PIN_BIT));
+		unpin_tag(handle);
+
+		obj_free(class, old_obj);
+		fix_fullness_group(pool, dst_page);
+next:
+		off += class->size;
+		obj_idx++;
+	}
+
+	if (!ret && src_page->inuse)
+		ret = -EBUSY;
+
+	return ret;
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+					struct size_class *class)
+{
+	unsigned long freed = 0;
+
+	while (1) {
+		struct page *src_page;
+		enum fullness_group fg;
+		int ret;
+
+		spin_lock(&class->lock);
+		if (!zs_can_compact(class)) {
+			spin_unlock(&class->lock);
+			break;
+		}
+
+		src_page = isolate_source_page(class);
+		if (!src_page) {
+			spin_unlock(&class->lock);
+			break;
+		}
+
+		ret = migrate_zspage(pool, class, src_page);
+		fg = putback_zspage(class, src_page);
+		if (fg == ZS_EMPTY)
+			class->pages_allocated -= class->pages_per_zspage;
+		spin_unlock(&class->lock);
+
+		if (fg == ZS_EMPTY) {
+			free_zspage(src_page);
+			freed += class->pages_per_zspage;
+		}
+
+		if (ret)
+			break;
+		cond_resched();
+	}
+
+	return freed;
+}
+
+/* Called with pool->compact_lock held */
+static unsigned long __zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	pool->pages_compacted += freed;
+
+	return freed;
+}
+
+static unsigned long zs_freeable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		pages += zs_can_compact(class) * class->pages_per_zspage;
+	}
+
+	return pages;
+}
+
+/*
+ * Compact the pool when the VM is reclaiming. The count reported back
+ * is the number of pages compaction could still give back.
+ */
+static int zs_shrinker(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+						shrinker);
+
+	if (sc->nr_to_scan && mutex_trylock(&pool->compact_lock)) {
+		__zs_compact(pool);
+		mutex_unlock(&pool->compact_lock);
+	}
+
+	return min_t(unsigned long, zs_freeable_pages(pool), INT_MAX);
+}
+
+#ifdef CONFIG_DEBUG_FS
+
+static unsigned long zs_count_zspages(struct size_class *class,
+					enum fullness_group fg)
+{
+	struct page *head = class->fullness_list[fg];
+	struct page *page;
+	unsigned long count;
+
+	if (!head)
+		return 0;
+
+	count = 1;
+	list_for_each_entry(page, &head->lru, lru)
+		count++;
+
+	return count;
+}
+
+static int zs_stats_classes_show(struct seq_file *s, void *v)
+{
+	struct zs_pool *pool = s->private;
+	unsigned long total_allocated = 0, total_used = 0, total_pages = 0;
+	int i;
+
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s %6s\n",
+			"class", "size", "almost_full", "almost_empty",
+			"obj_allocated", "obj_used", "pages_used",
+			"pages_per_zspage", "frag%");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long almost_full, almost_empty;
+		unsigned long obj_allocated, obj_used, pages_used;
+
+		spin_lock(&class->lock);
+		almost_full = zs_count_zspages(class, ZS_ALMOST_FULL);
+		almost_empty = zs_count_zspages(class, ZS_ALMOST_EMPTY);
+		pages_used = (unsigned long)class->pages_allocated;
+		obj_used = class->objs_inuse;
+		spin_unlock(&class->lock);
+
+		obj_allocated = pages_used / class->pages_per_zspage *
+				class->objs_per_zspage;
+
+		seq_printf(s, " %5u %5u %11lu %12lu %13lu %10lu %10lu %16d %6lu\n",
+			class->index, class->size, almost_full, almost_empty,
+			obj_allocated, obj_used, pages_used,
+			class->pages_per_zspage, obj_allocated ?
+			(obj_allocated - obj_used) * 100 / obj_allocated : 0);
+
+		total_allocated += obj_allocated;
+		total_used += obj_used;
+		total_pages += pages_used;
+	}
+
+	seq_puts(s, "\n");
+	seq_printf(s, " %5s %5s %11s %12s %13lu %10lu %10lu %16s %6lu\n",
+			"Total", "", "", "", total_allocated, total_used,
+			total_pages, "", total_allocated ?
+			(total_allocated - total_used) * 100 /
+			total_allocated : 0);
+
+	return 0;
+}
+
+static int zs_stats_classes_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_classes_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_classes_fops = {
+	.owner = THIS_MODULE,
+	.open = zs_stats_classes_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	struct dentry *dir;
+
+	if (!zs_stat_root)
+		return;
+
+	dir = debugfs_create_dir(pool->name, zs_stat_root);
+	if (IS_ERR_OR_NULL(dir)) {
+		pr_warning("zsmalloc: debugfs dir <%s> creation failed\n",
+				pool->name);
+		return;
+	}
+	pool->stat_dentry = dir;
+
+	debugfs_create_file("classes", S_IRUGO, dir, pool,
+				&zs_stats_classes_fops);
+	debugfs_create_u64("pages_compacted", S_IRUGO, dir,
+				&pool->pages_compacted);
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->stat_dentry);
+}
+
+static void zs_stat_init(void)
+{
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+	if (IS_ERR(zs_stat_root))
+		zs_stat_root = NULL;
+}
+
+static void zs_stat_exit(void)
+{
+	debugfs_remove_recursive(zs_stat_root);
+}
+
+#else /* CONFIG_DEBUG_FS */
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+}
+
+static void zs_stat_init(void)
+{
+}
+
+static void zs_stat_exit(void)
+{
+}
+
+#endif /* CONFIG_DEBUG_FS */
+
 static int zs_cpu_notifier(struct notifier_block *nb, unsigned long action,
 				void *pcpu)
 {
@@ -560,12 +1052,23 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
+	zs_stat_exit();
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
+	zs_stat_init();
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -604,12 +1107,26 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 		class->index = i;
 		spin_lock_init(&class->lock);
 		class->pages_per_zspage = get_pages_per_zspage(size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / size;
+	}
 
+	pool->compact_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+	if (!pool->compact_buf) {
+		kfree(pool);
+		return NULL;
 	}
+	mutex_init(&pool->compact_lock);
 
 	pool->flags = flags;
 	pool->name = name;
 
+	pool->shrinker.shrink = zs_shrinker;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	zs_pool_stat_create(pool);
+
 	return pool;
 }
 EXPORT_SYMBOL_GPL(zs_create_pool);
@@ -618,6 +1135,9 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	zs_pool_stat_destroy(pool);
+	unregister_shrinker(&pool->shrinker);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -630,6 +1150,7 @@ void zs_destroy_pool(struct zs_pool *pool)
 			}
 		}
 	}
+	kfree(pool->compact_buf);
 	kfree(pool);
 }
 EXPORT_SYMBOL_GPL(zs_destroy_pool);
@@ -645,17 +1166,20 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  */
 unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 {
-	unsigned long obj;
-	struct link_free *link;
+	unsigned long handle, obj;
 	int class_idx;
 	struct size_class *class;
-
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	struct page *first_page;
 
 	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
 		return 0;
 
+	handle = cache_alloc_handle(pool);
+	if (!handle)
+		return 0;
+
+	/* room for the object header; huge classes store none */
+	size = min_t(size_t, size + ZS_HANDLE_SIZE, ZS_MAX_ALLOC_SIZE);
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -666,69 +1190,62 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			cache_free_handle(handle);
 			return 0;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->pages_per_zspage;
 	}
 
-	obj = (unsigned long)first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
+	obj = obj_malloc(class, first_page, handle);
+	/* must be visible before compaction can find the object */
+	record_obj(handle, obj);
 
-	first_page->inuse++;
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, unsigned long obj)
+void zs_free(struct zs_pool *pool, unsigned long handle)
 {
-	struct link_free *link;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
+	unsigned long obj, f_objidx;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* the object must not move while we look up its class */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
 
 	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = (void *)obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
 
 	if (fullness == ZS_EMPTY)
 		class->pages_allocated -= class->pages_per_zspage;
 
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	cache_free_handle(handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
@@ -745,7 +1262,8 @@ EXPORT_SYMBOL_GPL(zs_free);
  * zs_unmap_object.
  *
  * Only one object can be mapped per cpu at a time. There is no protection
- * against nested mappings.
+ * against nested mappings. A mapped object is pinned and will not be
+ * moved by compaction.
  *
  * This function returns with preemption and page faults disabled.
 */
@@ -753,12 +1271,13 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 			enum zs_mapmode mm)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
+	int hdr;
 
 	BUG_ON(!handle);
 
@@ -769,16 +1288,21 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 	 */
 	BUG_ON(in_interrupt());
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	pin_tag(handle);
+
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
+	hdr = class_huge(class) ? 0 : ZS_HANDLE_SIZE;
 
 	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
 	if (off + class->size <= PAGE_SIZE) {
 		/* this object is contained entirely within a page */
 		area->vm_addr = kmap_atomic(page);
-		return area->vm_addr + off;
+		return area->vm_addr + off + hdr;
 	}
 
 	/* disable page faults to match kmap_atomic() return conditions */
@@ -787,20 +1311,22 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 	if (mm != ZS_MM_WO)
 		zs_copy_map_object(area->vm_buf, page, off, class->size);
 	area->vm_addr = NULL;
-	return area->vm_buf;
+	return area->vm_buf + hdr;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
 void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
 	struct size_class *class;
 	struct mapping_area *area;
 
+	BUG_ON(!handle);
+
 	area = &__get_cpu_var(zs_map_area);
 	/* single-page object fastpath */
 	if (area->vm_addr) {
@@ -812,13 +1338,16 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 	if (area->vm_mm == ZS_MM_RO)
 		goto pfenable;
 
-	BUG_ON(!handle);
-
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
 
+	/* a write-only mapping never copied the header in */
+	if (!class_huge(class))
+		((struct link_free *)area->vm_buf)->handle =
+					handle | OBJ_ALLOCATED_TAG;
 	zs_copy_unmap_object(area->vm_buf, page, off, class->size);
 
 pfenable:
@@ -826,6 +1355,7 @@ pfenable:
 	pagefault_enable();
 out:
 	put_cpu_var(zs_map_area);
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -841,6 +1371,24 @@ u64 zs_get_total_size_bytes(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
 
+/**
+ * zs_compact - move objects to free sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Returns the number of pages given back to the system. May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed;
+
+	mutex_lock(&pool->compact_lock);
+	freed = __zs_compact(pool);
+	mutex_unlock(&pool->compact_lock);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
 module_init(zs_init);
 module_exit(zs_exit);
 
@@ -14,6 +14,8 @@
 #define _ZS_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -34,12 +36,16 @@
 
 /*
  * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * as single (unsigned long) obj value.
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
  * to a zspage, obj_idx starts with 0.
  *
+ * The lowest OBJ_TAG_BITS of an obj value are kept clear so that
+ * free-list links and allocated object headers can be told apart
+ * (see OBJ_ALLOCATED_TAG).
+ *
  * This is made more complicated by various memory models and PAE.
  */
 
@@ -55,9 +61,26 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
+/*
+ * Handles given out by zs_malloc() do not encode the object location
+ * directly; they point to a slot holding the current obj value, so
+ * compaction can move the object by rewriting the slot. Bit 0 of the
+ * slot is a lock bit that pins the object while it is mapped or freed.
+ *
+ * Every allocated object in a non-huge class starts with a header
+ * word holding its handle, tagged with OBJ_ALLOCATED_TAG, which lets
+ * compaction find the handle of an object from its location. Huge
+ * classes (one object per zspage) are never compacted and store no
+ * header, so a full PAGE_SIZE object still fits.
+ */
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
 /* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
 #define ZS_MIN_ALLOC_SIZE \
@@ -126,10 +149,14 @@ struct size_class {
 	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
 	int pages_per_zspage;
 
+	/* Maximum number of objects a zspage of this class can store */
+	int objs_per_zspage;
+
 	spinlock_t lock;
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long objs_inuse;
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
@@ -141,8 +168,12 @@ struct size_class {
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* Next free chunk (encodes <PFN, obj_idx>) */
+		void *next;
+		/* Handle of an allocated object, with OBJ_ALLOCATED_TAG */
+		unsigned long handle;
+	};
 };
 
 struct zs_pool {
@@ -150,6 +181,16 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+
+	/* compaction */
+	struct shrinker shrinker;
+	struct mutex compact_lock;	/* serializes compaction runs */
+	char *compact_buf;		/* bounce buffer for moving objects */
+	u64 pages_compacted;
+
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *stat_dentry;
+#endif
 };
 
 #endif
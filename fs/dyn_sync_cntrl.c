@@ -23,9 +23,17 @@
 #include <linux/notifier.h>
 #include <linux/reboot.h>
 #include <linux/writeback.h>
+#include <linux/fs.h>
+#include <linux/backing-dev.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 
 #define DYN_FSYNC_VERSION_MAJOR 1
-#define DYN_FSYNC_VERSION_MINOR 2
+#define DYN_FSYNC_VERSION_MINOR 3
 
 /*
  * fsync_mutex protects dyn_fsync_active during early suspend / late resume
@@ -36,6 +44,179 @@ static DEFINE_MUTEX(fsync_mutex);
 bool early_suspend_active __read_mostly = false;
 bool dyn_fsync_active __read_mostly = true;
 
+/*
+ * Group commit mode: instead of dropping fsync/fdatasync while the screen
+ * is on, callers join the open commit group of their superblock and sleep
+ * until that group has been written out by a single sync_filesystem().
+ * A group is closed and committed commit_interval_ms after its first
+ * member joined, or right away once the backing device has more than
+ * dirty_thresh_kb of dirty page cache.
+ */
+bool dyn_fsync_group_commit __read_mostly = false;
+static unsigned int dyn_fsync_commit_interval_ms = 50;
+static unsigned int dyn_fsync_dirty_thresh_kb = 4096;
+
+struct dyn_fsync_group {
+	struct list_head list;		/* on dyn_fsync_groups */
+	struct super_block *sb;
+	struct delayed_work work;
+	wait_queue_head_t wait;
+	unsigned int seq_open;		/* group new members join */
+	unsigned int seq_done;		/* last group made durable */
+	unsigned int members;		/* members of the open group */
+	unsigned int users;		/* waiters plus a running commit */
+	int err;			/* result of the last commit */
+};
+
+struct dyn_fsync_group_stats {
+	unsigned long commits;
+	unsigned long forced;		/* closed early by dirty_thresh_kb */
+	unsigned long members;
+	unsigned int max_members;
+	u64 total_us;
+	unsigned int max_us;
+};
+
+/* dyn_fsync_group_lock protects dyn_fsync_groups, every group and stats */
+static DEFINE_SPINLOCK(dyn_fsync_group_lock);
+static LIST_HEAD(dyn_fsync_groups);
+static struct dyn_fsync_group_stats group_stats;
+static struct workqueue_struct *dyn_fsync_wq;
+
+static void dyn_fsync_group_put(struct dyn_fsync_group *g)
+{
+	unsigned long flags;
+	bool release;
+
+	spin_lock_irqsave(&dyn_fsync_group_lock, flags);
+	release = !--g->users && !g->members;
+	if (release)
+		list_del(&g->list);
+	spin_unlock_irqrestore(&dyn_fsync_group_lock, flags);
+
+	if (release)
+		kfree(g);
+}
+
+static void dyn_fsync_group_work(struct work_struct *work)
+{
+	struct dyn_fsync_group *g =
+		container_of(work, struct dyn_fsync_group, work.work);
+	struct super_block *sb = g->sb;
+	unsigned int seq, members, us;
+	unsigned long flags;
+	ktime_t start;
+	int err;
+
+	/*
+	 * Close the open group. Its members are asleep holding a reference
+	 * on a file of this superblock, so sb stays valid until they are
+	 * woken below.
+	 */
+	spin_lock_irqsave(&dyn_fsync_group_lock, flags);
+	seq = g->seq_open++;
+	members = g->members;
+	g->members = 0;
+	g->users++;
+	spin_unlock_irqrestore(&dyn_fsync_group_lock, flags);
+
+	start = ktime_get();
+	down_read(&sb->s_umount);
+	err = sync_filesystem(sb);
+	up_read(&sb->s_umount);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	spin_lock_irqsave(&dyn_fsync_group_lock, flags);
+	g->err = err;
+	g->seq_done = seq;
+	group_stats.commits++;
+	group_stats.members += members;
+	group_stats.max_members = max(group_stats.max_members, members);
+	group_stats.total_us += us;
+	group_stats.max_us = max(group_stats.max_us, us);
+	spin_unlock_irqrestore(&dyn_fsync_group_lock, flags);
+
+	wake_up_all(&g->wait);
+	dyn_fsync_group_put(g);
+}
+
+static struct dyn_fsync_group *dyn_fsync_group_find(struct super_block *sb)
+{
+	struct dyn_fsync_group *g;
+
+	list_for_each_entry(g, &dyn_fsync_groups, list)
+		if (g->sb == sb)
+			return g;
+	return NULL;
+}
+
+static bool dyn_fsync_over_dirty_thresh(struct super_block *sb)
+{
+	unsigned long dirty = bdi_stat(sb->s_bdi, BDI_RECLAIMABLE);
+
+	return (dirty << (PAGE_SHIFT - 10)) >= dyn_fsync_dirty_thresh_kb;
+}
+
+/*
+ * Join the open commit group of file's superblock and wait until it is
+ * durable. Returns the result of the sync_filesystem() that covered us,
+ * or -ENOMEM if the superblock had no group and none could be allocated;
+ * the caller then syncs the file on its own.
+ */
+int dyn_fsync_group_sync(struct file *file)
+{
+	struct super_block *sb = file->f_mapping->host->i_sb;
+	struct dyn_fsync_group *g, *new = NULL;
+	unsigned long flags;
+	unsigned int seq;
+	bool forced;
+	int err;
+
+	if (sb->s_bdi == &noop_backing_dev_info || !dyn_fsync_wq)
+		return 0;
+
+	forced = dyn_fsync_over_dirty_thresh(sb);
+
+	spin_lock_irqsave(&dyn_fsync_group_lock, flags);
+	while (!(g = dyn_fsync_group_find(sb))) {
+		if (new) {
+			g = new;
+			new = NULL;
+			g->sb = sb;
+			g->seq_done = -1;
+			INIT_DELAYED_WORK(&g->work, dyn_fsync_group_work);
+			init_waitqueue_head(&g->wait);
+			list_add(&g->list, &dyn_fsync_groups);
+			break;
+		}
+		/* first fsync on this superblock, or its group was released */
+		spin_unlock_irqrestore(&dyn_fsync_group_lock, flags);
+		new = kzalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+		spin_lock_irqsave(&dyn_fsync_group_lock, flags);
+	}
+	seq = g->seq_open;
+	g->users++;
+	if (forced) {
+		group_stats.forced++;
+		cancel_delayed_work(&g->work);
+		queue_delayed_work(dyn_fsync_wq, &g->work, 0);
+	} else if (!g->members) {
+		queue_delayed_work(dyn_fsync_wq, &g->work,
+			msecs_to_jiffies(dyn_fsync_commit_interval_ms));
+	}
+	g->members++;
+	spin_unlock_irqrestore(&dyn_fsync_group_lock, flags);
+	kfree(new);
+
+	wait_event(g->wait, (int)(ACCESS_ONCE(g->seq_done) - seq) >= 0);
+	err = ACCESS_ONCE(g->err);
+
+	dyn_fsync_group_put(g);
+	return err;
+}
+
 static ssize_t dyn_fsync_active_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
@@ -78,6 +259,89 @@ static ssize_t dyn_fsync_earlysuspend_show(struct kobject *kobj,
 	return sprintf(buf, "early suspend active: %u\n", early_suspend_active);
 }
 
+static ssize_t dyn_fsync_group_commit_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", (dyn_fsync_group_commit ? 1 : 0));
+}
+
+static ssize_t dyn_fsync_group_commit_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if (sscanf(buf, "%u\n", &data) != 1 || data > 1)
+		return -EINVAL;
+
+	dyn_fsync_group_commit = data;
+	return count;
+}
+
+static ssize_t dyn_fsync_commit_interval_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dyn_fsync_commit_interval_ms);
+}
+
+static ssize_t dyn_fsync_commit_interval_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if (sscanf(buf, "%u\n", &data) != 1 || !data || data > 10000)
+		return -EINVAL;
+
+	dyn_fsync_commit_interval_ms = data;
+	return count;
+}
+
+static ssize_t dyn_fsync_dirty_thresh_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dyn_fsync_dirty_thresh_kb);
+}
+
+static ssize_t dyn_fsync_dirty_thresh_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if (sscanf(buf, "%u\n", &data) != 1)
+		return -EINVAL;
+
+	dyn_fsync_dirty_thresh_kb = data;
+	return count;
+}
+
+static ssize_t dyn_fsync_group_stats_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct dyn_fsync_group_stats st;
+	unsigned long flags;
+	unsigned long avg_size = 0;
+	u64 avg_us = 0;
+
+	spin_lock_irqsave(&dyn_fsync_group_lock, flags);
+	st = group_stats;
+	spin_unlock_irqrestore(&dyn_fsync_group_lock, flags);
+
+	if (st.commits) {
+		avg_size = st.members / st.commits;
+		avg_us = div_u64(st.total_us, st.commits);
+	}
+
+	return sprintf(buf, "commits: %lu\n"
+			"forced by dirty threshold: %lu\n"
+			"fsyncs: %lu\n"
+			"group size avg: %lu\n"
+			"group size max: %u\n"
+			"commit latency avg: %llu us\n"
+			"commit latency max: %u us\n",
+			st.commits, st.forced, st.members, avg_size,
+			st.max_members, (unsigned long long)avg_us,
+			st.max_us);
+}
+
 static struct kobj_attribute dyn_fsync_active_attribute = 
 	__ATTR(Dyn_fsync_active, 0666,
 		dyn_fsync_active_show,
@@ -89,11 +353,33 @@ static struct kobj_attribute dyn_fsync_version_attribute =
 static struct kobj_attribute dyn_fsync_earlysuspend_attribute = 
 	__ATTR(Dyn_fsync_earlysuspend, 0444, dyn_fsync_earlysuspend_show, NULL);
 
+static struct kobj_attribute dyn_fsync_group_commit_attribute =
+	__ATTR(Dyn_fsync_group_commit, 0644,
+		dyn_fsync_group_commit_show,
+		dyn_fsync_group_commit_store);
+
+static struct kobj_attribute dyn_fsync_commit_interval_attribute =
+	__ATTR(Dyn_fsync_commit_interval_ms, 0644,
+		dyn_fsync_commit_interval_show,
+		dyn_fsync_commit_interval_store);
+
+static struct kobj_attribute dyn_fsync_dirty_thresh_attribute =
+	__ATTR(Dyn_fsync_dirty_thresh_kb, 0644,
+		dyn_fsync_dirty_thresh_show,
+		dyn_fsync_dirty_thresh_store);
+
+static struct kobj_attribute dyn_fsync_group_stats_attribute =
+	__ATTR(Dyn_fsync_group_stats, 0444, dyn_fsync_group_stats_show, NULL);
+
 static struct attribute *dyn_fsync_active_attrs[] =
 	{
 		&dyn_fsync_active_attribute.attr,
 		&dyn_fsync_version_attribute.attr,
 		&dyn_fsync_earlysuspend_attribute.attr,
+		&dyn_fsync_group_commit_attribute.attr,
+		&dyn_fsync_commit_interval_attribute.attr,
+		&dyn_fsync_dirty_thresh_attribute.attr,
+		&dyn_fsync_group_stats_attribute.attr,
 		NULL,
 	};
 
@@ -170,6 +456,10 @@ static int dyn_fsync_init(void)
 {
 	int sysfs_result;
 
+	dyn_fsync_wq = alloc_workqueue("dyn_fsync", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!dyn_fsync_wq)
+		pr_err("%s dyn_fsync group commit unavailable!\n", __FUNCTION__);
+
 	register_early_suspend(&dyn_fsync_early_suspend_handler);
 	register_reboot_notifier(&dyn_fsync_notifier);
 	atomic_notifier_chain_register(&panic_notifier_list,
@@ -200,6 +490,9 @@ static void dyn_fsync_exit(void)
 
 	if (dyn_fsync_kobj != NULL)
 		kobject_put(dyn_fsync_kobj);
+
+	if (dyn_fsync_wq)
+		destroy_workqueue(dyn_fsync_wq);
 }
 
 module_init(dyn_fsync_init);
@@ -956,6 +956,8 @@ static int de_thread(struct task_struct *tsk)
 
 		list_replace_rcu(&leader->tasks, &tsk->tasks);
 		list_replace_init(&leader->sibling, &tsk->sibling);
+		lmk_adj_index_del(leader);
+		lmk_adj_index_add(tsk);
 
 		tsk->group_leader = tsk;
 		leader->group_leader = tsk;
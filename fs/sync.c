@@ -24,6 +24,19 @@
 #ifdef CONFIG_DYNAMIC_FSYNC
 extern bool early_suspend_active;
 extern bool dyn_fsync_active;
+extern bool dyn_fsync_group_commit;
+extern int dyn_fsync_group_sync(struct file *file);
+
+/*
+ * A group commit syncs the whole filesystem, which only stands in for
+ * ->fsync of a regular file on a block device backed superblock.
+ */
+static inline bool dyn_fsync_groupable(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+
+	return S_ISREG(inode->i_mode) && inode->i_sb->s_bdev;
+}
 #endif
 
 #define VALID_FLAGS (SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE| \
@@ -237,16 +250,21 @@ SYSCALL_DEFINE1(syncfs, int, fd)
 int vfs_fsync_range(struct file *file, loff_t start, loff_t end, int datasync)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (likely(dyn_fsync_active && !early_suspend_active))
-		return 0;
-	else {
+	if (likely(dyn_fsync_active && !early_suspend_active)) {
+		if (!dyn_fsync_group_commit)
+			return 0;
+		if (dyn_fsync_groupable(file)) {
+			int err = dyn_fsync_group_sync(file);
+
+			/* no memory for a commit group: sync the file alone */
+			if (err != -ENOMEM)
+				return err;
+		}
+	}
 #endif
 	if (!file->f_op || !file->f_op->fsync)
 		return -EINVAL;
 	return file->f_op->fsync(file, start, end, datasync);
-#ifdef CONFIG_DYNAMIC_FSYNC
-	}
-#endif
 }
 EXPORT_SYMBOL(vfs_fsync_range);
 
@@ -376,7 +394,8 @@ no_async:
 SYSCALL_DEFINE1(fsync, unsigned int, fd)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (likely(dyn_fsync_active && !early_suspend_active))
+	if (likely(dyn_fsync_active && !early_suspend_active &&
+		   !dyn_fsync_group_commit))
 		return 0;
 	else
 #endif
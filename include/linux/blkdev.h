@@ -131,6 +131,10 @@ struct request {
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+#endif
+#ifdef CONFIG_BLK_LATENCY_HIST
+	u64 lat_insert_ns;	/* added to the elevator */
+	u64 lat_dispatch_ns;	/* fetched by the driver */
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -228,6 +232,41 @@ enum blk_queue_state {
 	Queue_up,
 };
 
+#ifdef CONFIG_BLK_CPU_STAGING
+/*
+ * Requests from unplugged submitters, staged on the submitting CPU before
+ * they are added to the elevator in a batch.
+ */
+struct blk_cpu_stage {
+	spinlock_t		lock;
+	struct list_head	list;
+	unsigned int		count;
+};
+
+/* queue_lock usage by the submission path */
+struct blk_queue_lock_stats {
+	u64			acquired;
+	u64			contended;
+	u64			hold_ns;
+	u64			hold_ns_max;
+};
+#endif
+
+#ifdef CONFIG_BLK_LATENCY_HIST
+enum {
+	BLK_LAT_INSERT,		/* insertion to dispatch */
+	BLK_LAT_DISPATCH,	/* dispatch to completion */
+	BLK_LAT_PHASES,
+};
+
+#define BLK_LAT_BUCKETS	32
+
+/* Per-CPU request latency histograms, indexed [phase][sync][rw][log2 us] */
+struct blk_lat_hist {
+	u32			buckets[BLK_LAT_PHASES][2][2][BLK_LAT_BUCKETS];
+};
+#endif
+
 struct blk_queue_tag {
 	struct request **tag_index;	/* map of busy tags */
 	unsigned long *tag_map;		/* bit map of free/busy tags */
@@ -398,6 +437,17 @@ struct request_queue {
 	/* Throttle data */
 	struct throtl_data *td;
 #endif
+
+#ifdef CONFIG_BLK_CPU_STAGING
+	struct blk_cpu_stage __percpu	*cpu_stage;
+	struct work_struct	stage_work;
+	unsigned int		stage_batch;
+	struct blk_queue_lock_stats lock_stats;
+#endif
+
+#ifdef CONFIG_BLK_LATENCY_HIST
+	struct blk_lat_hist __percpu	*lat_hist;
+#endif
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
@@ -419,6 +469,7 @@ struct request_queue {
 #define QUEUE_FLAG_ADD_RANDOM  16	/* Contributes to random pool */
 #define QUEUE_FLAG_SECDISCARD  17	/* supports SECDISCARD */
 #define QUEUE_FLAG_SAME_FORCE  18	/* force complete on same CPU */
+#define QUEUE_FLAG_CPU_STAGING 19	/* stage unplugged requests per CPU */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_STACKABLE)	|	\
@@ -497,6 +548,8 @@ static inline void queue_flag_clear(unsigned int flag, struct request_queue *q)
 #define blk_queue_noxmerges(q)	\
 	test_bit(QUEUE_FLAG_NOXMERGES, &(q)->queue_flags)
 #define blk_queue_nonrot(q)	test_bit(QUEUE_FLAG_NONROT, &(q)->queue_flags)
+#define blk_queue_cpu_staging(q)	\
+	test_bit(QUEUE_FLAG_CPU_STAGING, &(q)->queue_flags)
 #define blk_queue_io_stat(q)	test_bit(QUEUE_FLAG_IO_STAT, &(q)->queue_flags)
 #define blk_queue_add_random(q)	test_bit(QUEUE_FLAG_ADD_RANDOM, &(q)->queue_flags)
 #define blk_queue_stackable(q)	\
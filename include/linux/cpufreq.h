@@ -407,6 +407,30 @@ int cpufreq_frequency_table_target(struct cpufreq_policy *policy,
 				   unsigned int relation,
 				   unsigned int *index);
 
+/*
+ * Cached table index for every load percentage, for governors whose target
+ * is base_freq * load / 100. The owner serialises access; the map rebuilds
+ * itself when the table, base_freq, relation or policy limits change.
+ */
+#define CPUFREQ_LOAD_MAP_SIZE	101
+
+struct cpufreq_load_map {
+	struct cpufreq_frequency_table *table;
+	unsigned int	base_freq;
+	unsigned int	min;
+	unsigned int	max;
+	unsigned int	relation;
+	int		index[CPUFREQ_LOAD_MAP_SIZE];	/* -1: no target */
+};
+
+int cpufreq_frequency_table_load_target(struct cpufreq_policy *policy,
+					struct cpufreq_frequency_table *table,
+					struct cpufreq_load_map *map,
+					unsigned int base_freq,
+					unsigned int load,
+					unsigned int relation,
+					unsigned int *index);
+
 /* the following 3 funtions are for cpufreq core use only */
 struct cpufreq_frequency_table *cpufreq_frequency_get_table(unsigned int cpu);
 struct cpufreq_policy *cpufreq_cpu_get(unsigned int cpu);
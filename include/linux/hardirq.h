@@ -141,12 +141,9 @@ extern void account_system_vtime(struct task_struct *tsk);
 
 #if defined(CONFIG_JRCU)
 extern int rcu_nmi_seen;
-# define rcu_irq_enter() do { } while (0)
-# define rcu_irq_exit() do { } while (0)
 # define rcu_nmi_enter() do { rcu_nmi_seen = 1; } while (0)
 # define rcu_nmi_exit() do { } while (0)
-#endif
-#if defined(CONFIG_TINY_RCU) || defined(CONFIG_TINY_PREEMPT_RCU)
+#elif defined(CONFIG_TINY_RCU) || defined(CONFIG_TINY_PREEMPT_RCU)
 
 static inline void rcu_nmi_enter(void)
 {
@@ -33,18 +33,24 @@ extern void call_rcu_sched(struct rcu_head *head, void (*func)(struct rcu_head *
 #define call_rcu_bh                            call_rcu_sched
 #define call_rcu                               call_rcu_sched
 
+static inline void kfree_call_rcu(struct rcu_head *head,
+                                  void (*func)(struct rcu_head *rcu))
+{
+       call_rcu(head, func);
+}
+
 extern void rcu_barrier(void);
 
 #define rcu_barrier_sched                      rcu_barrier
 #define rcu_barrier_bh                         rcu_barrier
 
 extern void synchronize_sched(void);
+extern void synchronize_sched_expedited(void);
 
 #define synchronize_rcu                                synchronize_sched
 #define synchronize_rcu_bh                     synchronize_sched
-#define synchronize_rcu_expedited              synchronize_sched
-#define synchronize_rcu_bh_expedited           synchronize_sched
-#define synchronize_sched_expedited            synchronize_sched
+#define synchronize_rcu_expedited              synchronize_sched_expedited
+#define synchronize_rcu_bh_expedited           synchronize_sched_expedited
 
 #define rcu_init(cpu)                          do { } while (0)
 #define rcu_init_sched()                       do { } while (0)
@@ -65,6 +71,10 @@ extern void rcu_force_quiescent_state(void);
 
 #define rcu_enter_nohz()                       do { } while (0)
 #define rcu_exit_nohz()                                do { } while (0)
+#define rcu_idle_enter()                       do { } while (0)
+#define rcu_idle_exit()                                do { } while (0)
+#define rcu_irq_enter()                                do { } while (0)
+#define rcu_irq_exit()                         do { } while (0)
 
 extern void rcu_note_context_switch(int cpu);
 
@@ -81,4 +81,14 @@ int lz4_decompress(const unsigned char *src, size_t *src_len,
  */
 int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
 		unsigned char *dest, size_t *dest_len);
+
+/*
+ * Variants of the above using unaligned word copies, built with
+ * CONFIG_LZ4_DECOMPRESS_WIDE. Callers must make sure the CPU handles
+ * unaligned word accesses.
+ */
+int lz4_decompress_wide(const unsigned char *src, size_t *src_len,
+		unsigned char *dest, size_t actual_dest_len);
+int lz4_decompress_unknownoutputsize_wide(const unsigned char *src,
+		size_t src_len, unsigned char *dest, size_t *dest_len);
 #endif
@@ -27,6 +27,10 @@ int lzo1x_1_compress(const unsigned char *src, size_t src_len,
 int lzo1x_decompress_safe(const unsigned char *src, size_t src_len,
 			  unsigned char *dst, size_t *dst_len);
 
+/* same, using unaligned word copies (CONFIG_LZO_DECOMPRESS_WIDE) */
+int lzo1x_decompress_safe_wide(const unsigned char *src, size_t src_len,
+			       unsigned char *dst, size_t *dst_len);
+
 /*
  * Return values (< 0 = Error)
  */
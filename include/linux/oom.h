@@ -71,6 +71,29 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * Index of thread group leaders by oom_score_adj kept for the Android low
+ * memory killer. Callers serialize against exit: fork and exec under the
+ * write-locked tasklist_lock, adj changes under the task's siglock.
+ */
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+extern void lmk_adj_index_add(struct task_struct *p);
+extern void lmk_adj_index_del(struct task_struct *p);
+extern void lmk_adj_index_update(struct task_struct *p);
+#else
+static inline void lmk_adj_index_add(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_index_del(struct task_struct *p)
+{
+}
+
+static inline void lmk_adj_index_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
@@ -80,6 +80,7 @@ struct sched_param {
 #include <linux/seccomp.h>
 #include <linux/rcupdate.h>
 #include <linux/rculist.h>
+#include <linux/list_nulls.h>
 #include <linux/rtmutex.h>
 
 #include <linux/time.h>
@@ -143,6 +144,11 @@ extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
 
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
+/* time-weighted nr_running averages, in FSHIFT fixed point */
+extern unsigned long avg_nr_running(void);
+extern unsigned long avg_cpu_nr_running(unsigned int cpu);
+#endif
 
 extern void calc_global_load(unsigned long ticks);
 
@@ -1194,6 +1200,9 @@ struct sched_entity {
 	u64			prev_sum_exec_runtime;
 
 	u64			nr_migrations;
+#ifdef CONFIG_SCHED_FREQ_HINTS
+	u64			hint_migrations;	/* nr_migrations at last enqueue */
+#endif
 
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
@@ -1302,6 +1311,10 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+#ifdef CONFIG_ANDROID_LMK_ADJ_INDEX
+	/* thread group leaders only, see lowmemorykiller.c */
+	struct hlist_nulls_node lmk_adj_node;
+#endif
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
@@ -2059,6 +2072,33 @@ static inline void sched_autogroup_exit(struct signal_struct *sig) { }
 extern unsigned int sysctl_sched_cfs_bandwidth_slice;
 #endif
 
+/*
+ * Runqueue load change hints, for cpufreq governors that want to react
+ * to load arriving on (or leaving) a cpu before their next sample.
+ *
+ * The notifier is called with the runqueue lock of @cpu held and
+ * interrupts disabled, so callbacks must not take any scheduler lock
+ * or wake up tasks; typically they just kick a timer.
+ */
+enum sched_load_event {
+	SCHED_LOAD_ENQUEUE,
+	SCHED_LOAD_DEQUEUE,
+	SCHED_LOAD_MIGRATE,
+};
+
+struct sched_load_hint {
+	int cpu;
+	unsigned long load;	/* cfs runnable load average of cpu */
+	long delta;		/* change since the previous hint */
+};
+
+#ifdef CONFIG_SCHED_FREQ_HINTS
+extern unsigned int sysctl_sched_load_hint_delta;
+
+extern int register_sched_load_notifier(struct notifier_block *nb);
+extern int unregister_sched_load_notifier(struct notifier_block *nb);
+#endif
+
 #ifdef CONFIG_RT_MUTEXES
 extern int rt_mutex_getprio(struct task_struct *p);
 extern void rt_mutex_setprio(struct task_struct *p, int prio);
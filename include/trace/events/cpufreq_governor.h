@@ -0,0 +1,92 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_governor
+
+#if !defined(_TRACE_CPUFREQ_GOVERNOR_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_GOVERNOR_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Common events for all cpufreq governors, so that runs of different
+ * governors can be compared and replayed offline (tools/power/cpufreq).
+ *
+ * load is the percentage of the current frequency's capacity that was in
+ * use over the last sample, as the governor computed it for its decision.
+ */
+TRACE_EVENT(cpufreq_governor_load,
+	    TP_PROTO(const char *governor, unsigned int cpu_id,
+		     unsigned int load, unsigned int curfreq),
+	    TP_ARGS(governor, cpu_id, load, curfreq),
+
+	    TP_STRUCT__entry(
+		    __string(governor, governor)
+		    __field(unsigned int, cpu_id  )
+		    __field(unsigned int, load    )
+		    __field(unsigned int, curfreq )
+	    ),
+
+	    TP_fast_assign(
+		    __assign_str(governor, governor);
+		    __entry->cpu_id = cpu_id;
+		    __entry->load = load;
+		    __entry->curfreq = curfreq;
+	    ),
+
+	    TP_printk("governor=%s cpu=%u load=%u cur=%u",
+		      __get_str(governor), __entry->cpu_id, __entry->load,
+		      __entry->curfreq)
+);
+
+/* A frequency request, emitted from __cpufreq_driver_target() */
+TRACE_EVENT(cpufreq_governor_target,
+	    TP_PROTO(const char *governor, unsigned int cpu_id,
+		     unsigned int curfreq, unsigned int targfreq,
+		     unsigned int relation),
+	    TP_ARGS(governor, cpu_id, curfreq, targfreq, relation),
+
+	    TP_STRUCT__entry(
+		    __string(governor, governor)
+		    __field(unsigned int, cpu_id   )
+		    __field(unsigned int, curfreq  )
+		    __field(unsigned int, targfreq )
+		    __field(unsigned int, relation )
+	    ),
+
+	    TP_fast_assign(
+		    __assign_str(governor, governor);
+		    __entry->cpu_id = cpu_id;
+		    __entry->curfreq = curfreq;
+		    __entry->targfreq = targfreq;
+		    __entry->relation = relation;
+	    ),
+
+	    TP_printk("governor=%s cpu=%u cur=%u targ=%u relation=%u",
+		      __get_str(governor), __entry->cpu_id, __entry->curfreq,
+		      __entry->targfreq, __entry->relation)
+);
+
+/* A governor bringing a cpu online or taking it offline */
+TRACE_EVENT(cpufreq_governor_hotplug,
+	    TP_PROTO(const char *governor, unsigned int cpu_id, bool online),
+	    TP_ARGS(governor, cpu_id, online),
+
+	    TP_STRUCT__entry(
+		    __string(governor, governor)
+		    __field(unsigned int, cpu_id )
+		    __field(bool,         online )
+	    ),
+
+	    TP_fast_assign(
+		    __assign_str(governor, governor);
+		    __entry->cpu_id = cpu_id;
+		    __entry->online = online;
+	    ),
+
+	    TP_printk("governor=%s cpu=%u online=%d",
+		      __get_str(governor), __entry->cpu_id, __entry->online)
+);
+
+#endif /* _TRACE_CPUFREQ_GOVERNOR_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -55,6 +55,9 @@
 /*
  * This RCU maintains three callback lists: the current batch (per cpu),
  * the previous batch (also per cpu), and the pending list (global).
+ * With CONFIG_JRCU_CB_THREADS an ended batch goes to a fourth list, the
+ * done list (per cpu), instead of the pending list whenever the cpu has
+ * a callback thread to invoke it.
  */
 
 #include <linux/bug.h>
@@ -65,6 +68,7 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/percpu.h>
+#include <linux/slab.h>
 #include <linux/stddef.h>
 #include <linux/string.h>
 #include <linux/preempt.h>
@@ -72,6 +76,14 @@
 #include <linux/compiler.h>
 #include <linux/irqflags.h>
 #include <linux/rcupdate.h>
+#include <linux/cpu.h>
+#include <linux/err.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/notifier.h>
+#include <linux/delay.h>
+#include <linux/stop_machine.h>
 
 #include <asm/system.h>
 
@@ -136,6 +148,15 @@ struct rcu_data {
                                 * the retirement of the current batch */
        struct rcu_list cblist[2]; /* current & previous callback lists */
        s64 nqueued;            /* #callbacks queued (stats-n-debug) */
+#ifdef CONFIG_JRCU_CB_THREADS
+       raw_spinlock_t cb_lock; /* protects done, cb_thread & nhanded */
+       struct rcu_list done;   /* ended batches waiting for cb_thread */
+       struct task_struct *cb_thread;
+       unsigned long nhanded;  /* #callbacks handed to cb_thread */
+       unsigned long ninvoked; /* #callbacks invoked by cb_thread */
+       unsigned long max_run_us; /* longest cb_thread run between
+                                  * rescheduling points */
+#endif
 } ____cacheline_aligned_in_smp;
 
 static struct rcu_data rcu_data[NR_CPUS];
@@ -148,10 +169,18 @@ static struct rcu_stats {
        unsigned nmis;          /* #passes discarded due to NMI */
        atomic_t nbarriers;     /* #rcu barriers processed */
        atomic_t nsyncs;        /* #rcu syncs processed */
+       atomic_t nexpedited;    /* #expedited syncs processed */
+       atomic_t nexpfallback;  /* #expedited syncs that fell back */
        s64 ninvoked;           /* #invoked (ie, finished) callbacks */
        unsigned nforced;       /* #forced eobs (should be zero) */
 } rcu_stats;
 
+#ifdef CONFIG_JRCU_CB_THREADS
+static void rcu_cb_threads_flush(void);
+#else
+static inline void rcu_cb_threads_flush(void) { }
+#endif
+
 #define RCU_HZ                 (20)
 #define RCU_HZ_PERIOD_US       (USEC_PER_SEC / RCU_HZ)
 #define RCU_HZ_DELTA_US                (USEC_PER_SEC / HZ)
@@ -234,23 +263,92 @@ EXPORT_SYMBOL(rcu_note_might_resched);
 
 void synchronize_sched(void)
 {
-       struct rcu_synchronize rcu;
-
        if (!rcu_scheduler_active)
                return;
 
-       init_completion(&rcu.completion);
-       call_rcu(&rcu.head, wakeme_after_rcu);
-       wait_for_completion(&rcu.completion);
+       wait_rcu_gp(call_rcu_sched);
        atomic_inc(&rcu_stats.nsyncs);
 
 }
 EXPORT_SYMBOL_GPL(synchronize_sched);
 
+/*
+ * Expedited grace periods.  A jRCU read-side critical section is a region
+ * of non-zero preempt_count(), so once every online cpu has been through
+ * a context switch all readers that were running have finished.  Force
+ * that switch by running the cpu stopper on each cpu, rather than waiting
+ * for the batch machinery to notice a quiescent state on its own; this
+ * takes microseconds instead of one to two RCU_HZ periods.
+ *
+ * This is the ticket scheme of the TREE_RCU version: callers that were
+ * covered by someone else's stop_cpus pass return without doing their own.
+ */
+static atomic_t rcu_exp_started = ATOMIC_INIT(0);
+static atomic_t rcu_exp_done = ATOMIC_INIT(0);
+
+static int rcu_exp_cpu_stop(void *data)
+{
+       /* try_stop_cpus() implies this, but do not depend on it */
+       smp_mb();
+       return 0;
+}
+
+void synchronize_sched_expedited(void)
+{
+       int firstsnap, s, snap, trycount = 0;
+
+       if (!rcu_scheduler_active)
+               return;
+
+       /* atomic_inc_return() implies a full memory barrier */
+       firstsnap = snap = atomic_inc_return(&rcu_exp_started);
+       get_online_cpus();
+
+       while (try_stop_cpus(cpu_online_mask, rcu_exp_cpu_stop,
+                       NULL) == -EAGAIN) {
+               put_online_cpus();
+
+               /* Someone else is stopping cpus; back off, or give up */
+               if (trycount++ < 10) {
+                       udelay(trycount * num_online_cpus());
+               } else {
+                       atomic_inc(&rcu_stats.nexpfallback);
+                       synchronize_sched();
+                       return;
+               }
+
+               /* Did someone else's pass cover us? */
+               s = atomic_read(&rcu_exp_done);
+               if (UINT_CMP_GE((unsigned)s, (unsigned)firstsnap)) {
+                       smp_mb(); /* test before the caller frees */
+                       return;
+               }
+
+               /* Let callers that came in meanwhile ride on our pass */
+               get_online_cpus();
+               snap = atomic_read(&rcu_exp_started);
+               smp_mb(); /* read before try_stop_cpus() */
+       }
+
+       /* Publish our pass, unless a later one has already been published */
+       do {
+               s = atomic_read(&rcu_exp_done);
+               if (UINT_CMP_GE((unsigned)s, (unsigned)snap)) {
+                       smp_mb(); /* test before the caller frees */
+                       break;
+               }
+       } while (atomic_cmpxchg(&rcu_exp_done, s, snap) != s);
+
+       put_online_cpus();
+       atomic_inc(&rcu_stats.nexpedited);
+}
+EXPORT_SYMBOL_GPL(synchronize_sched_expedited);
+
 void rcu_barrier(void)
 {
        synchronize_sched();
        synchronize_sched();
+       rcu_cb_threads_flush();
        atomic_inc(&rcu_stats.nbarriers);
 }
 EXPORT_SYMBOL_GPL(rcu_barrier);
@@ -291,6 +389,16 @@ void call_rcu_sched(struct rcu_head *cb, void (*func)(struct rcu_head *rcu))
 }
 EXPORT_SYMBOL_GPL(call_rcu_sched);
 
+static inline void rcu_invoke_callback(struct rcu_head *curr)
+{
+       unsigned long offset = (unsigned long)curr->func;
+
+       if (__is_kfree_rcu_offset(offset))
+               kfree((void *)curr - offset);
+       else
+               curr->func(curr);
+}
+
 /*
  * Invoke all callbacks on the passed-in list.
  */
@@ -299,17 +407,227 @@ static void rcu_invoke_callbacks(struct rcu_list *pending)
        struct rcu_head *curr, *next;
 
        for (curr = pending->head; curr;) {
-               unsigned long offset = (unsigned long)curr->func;
                next = curr->next;
-               if (__is_kfree_rcu_offset(offset))
-                       kfree((void *)curr - offset);
-               else
-                       curr->func(curr);
+               rcu_invoke_callback(curr);
                curr = next;
                rcu_stats.ninvoked++;
        }
 }
 
+/* ------------------ callback thread section ------------------- */
+
+#ifdef CONFIG_JRCU_CB_THREADS
+
+/*
+ * Each online cpu has a thread, jrcuc/N, that invokes the callbacks that
+ * cpu queued once their batch has ended.  It invokes at most rcu_cb_batch
+ * of them with bottom halves disabled (as they would be in softirq), then
+ * offers to reschedule before going on with the next lot.
+ */
+#define RCU_CB_BATCH           (16)
+
+static int rcu_cb_batch = RCU_CB_BATCH;
+
+/* rcu_barrier() waits here for the threads to catch up */
+static DECLARE_WAIT_QUEUE_HEAD(rcu_cb_flush_wq);
+
+/*
+ * Hand a cpu's ended batch over to its callback thread.  Returns zero if
+ * that cpu has no thread and the caller must invoke the batch itself.
+ * Called by the batch delimiter with interrupts disabled.
+ */
+static int rcu_cb_handoff(int cpu, struct rcu_list *plist)
+{
+       struct rcu_data *rd = &rcu_data[cpu];
+       int handed = 0;
+
+       raw_spin_lock(&rd->cb_lock);
+       if (rd->cb_thread && cpu_online(cpu)) {
+               rcu_list_join(&rd->done, plist);
+               rd->nhanded += plist->count;
+               wake_up_process(rd->cb_thread);
+               handed = 1;
+       }
+       raw_spin_unlock(&rd->cb_lock);
+       return handed;
+}
+
+static void rcu_cb_invoke_batched(struct rcu_data *rd, struct rcu_list *list)
+{
+       struct rcu_head *curr, *next;
+       unsigned long run_us;
+       ktime_t start;
+       int n;
+
+       for (curr = list->head; curr;) {
+               start = ktime_get();
+               local_bh_disable();
+               for (n = 0; curr && n < rcu_cb_batch; n++) {
+                       next = curr->next;
+                       rcu_invoke_callback(curr);
+                       curr = next;
+               }
+               local_bh_enable();
+
+               run_us = ktime_us_delta(ktime_get(), start);
+               if (run_us > rd->max_run_us)
+                       rd->max_run_us = run_us;
+               rd->ninvoked += n;
+               cond_resched();
+       }
+
+       if (waitqueue_active(&rcu_cb_flush_wq))
+               wake_up_all(&rcu_cb_flush_wq);
+}
+
+static int rcu_cb_thread_func(void *arg)
+{
+       struct rcu_data *rd = &rcu_data[(long)arg];
+       struct rcu_list list;
+
+       set_current_state(TASK_INTERRUPTIBLE);
+       while (!kthread_should_stop()) {
+               if (!ACCESS_ONCE(rd->done.head)) {
+                       schedule();
+                       set_current_state(TASK_INTERRUPTIBLE);
+                       continue;
+               }
+               __set_current_state(TASK_RUNNING);
+
+               raw_spin_lock_irq(&rd->cb_lock);
+               list = rd->done;
+               rcu_list_init(&rd->done);
+               raw_spin_unlock_irq(&rd->cb_lock);
+
+               rcu_cb_invoke_batched(rd, &list);
+               set_current_state(TASK_INTERRUPTIBLE);
+       }
+       __set_current_state(TASK_RUNNING);
+       return 0;
+}
+
+/*
+ * Wait until every callback handed to a thread so far has been invoked.
+ */
+static void rcu_cb_threads_flush(void)
+{
+       struct rcu_data *rd;
+       unsigned long handed;
+       unsigned long flags;
+       int cpu;
+
+       for_each_possible_cpu(cpu) {
+               rd = &rcu_data[cpu];
+               raw_spin_lock_irqsave(&rd->cb_lock, flags);
+               handed = rd->nhanded;
+               raw_spin_unlock_irqrestore(&rd->cb_lock, flags);
+
+               wait_event(rcu_cb_flush_wq,
+                       (long)(ACCESS_ONCE(rd->ninvoked) - handed) >= 0);
+       }
+}
+
+/*
+ * Stop a cpu's callback thread and invoke whatever it left behind.
+ */
+static void rcu_cb_thread_stop(int cpu)
+{
+       struct rcu_data *rd = &rcu_data[cpu];
+       struct task_struct *p;
+       struct rcu_list list;
+
+       raw_spin_lock_irq(&rd->cb_lock);
+       p = rd->cb_thread;
+       rd->cb_thread = NULL;
+       raw_spin_unlock_irq(&rd->cb_lock);
+
+       if (!p)
+               return;
+       kthread_stop(p);
+
+       raw_spin_lock_irq(&rd->cb_lock);
+       list = rd->done;
+       rcu_list_init(&rd->done);
+       raw_spin_unlock_irq(&rd->cb_lock);
+
+       rcu_cb_invoke_batched(rd, &list);
+}
+
+static int __cpuinit rcu_cb_cpu_callback(struct notifier_block *nfb,
+                                        unsigned long action, void *hcpu)
+{
+       int cpu = (long)hcpu;
+       struct task_struct *p;
+
+       switch (action) {
+       case CPU_UP_PREPARE:
+       case CPU_UP_PREPARE_FROZEN:
+               p = kthread_create(rcu_cb_thread_func, hcpu,
+                               "jrcuc/%d", cpu);
+               if (IS_ERR(p)) {
+                       pr_warn("JRCU: no callback thread for cpu %d\n", cpu);
+                       break;  /* its callbacks get invoked inline */
+               }
+               kthread_bind(p, cpu);
+               raw_spin_lock_irq(&rcu_data[cpu].cb_lock);
+               rcu_data[cpu].cb_thread = p;
+               raw_spin_unlock_irq(&rcu_data[cpu].cb_lock);
+               break;
+       case CPU_ONLINE:
+       case CPU_ONLINE_FROZEN:
+               if (rcu_data[cpu].cb_thread)
+                       wake_up_process(rcu_data[cpu].cb_thread);
+               break;
+#ifdef CONFIG_HOTPLUG_CPU
+       case CPU_UP_CANCELED:
+       case CPU_UP_CANCELED_FROZEN:
+               if (rcu_data[cpu].cb_thread)
+                       kthread_bind(rcu_data[cpu].cb_thread,
+                               cpumask_any(cpu_online_mask));
+               /* fall through */
+       case CPU_DEAD:
+       case CPU_DEAD_FROZEN:
+               rcu_cb_thread_stop(cpu);
+               break;
+#endif
+       }
+       return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata rcu_cb_cpu_nfb = {
+       .notifier_call = rcu_cb_cpu_callback,
+};
+
+static void __init rcu_cb_threads_init(void)
+{
+       int cpu;
+
+       for_each_possible_cpu(cpu)
+               raw_spin_lock_init(&rcu_data[cpu].cb_lock);
+}
+
+static __init int rcu_cb_threads_spawn(void)
+{
+       void *cpu = (void *)(long)smp_processor_id();
+
+       rcu_cb_cpu_callback(&rcu_cb_cpu_nfb, CPU_UP_PREPARE, cpu);
+       rcu_cb_cpu_callback(&rcu_cb_cpu_nfb, CPU_ONLINE, cpu);
+       register_cpu_notifier(&rcu_cb_cpu_nfb);
+       return 0;
+}
+early_initcall(rcu_cb_threads_spawn);
+
+#else /* CONFIG_JRCU_CB_THREADS */
+
+static inline int rcu_cb_handoff(int cpu, struct rcu_list *plist)
+{
+       return 0;
+}
+
+static inline void rcu_cb_threads_init(void) { }
+
+#endif /* CONFIG_JRCU_CB_THREADS */
+
 /*
  * Check if the conditions for ending the current batch are true. If
  * so then end it.
@@ -392,9 +710,11 @@ static void __rcu_delimit_batches(struct rcu_list *pending)
        for_each_present_cpu(cpu) {
                rd = &rcu_data[cpu];
                plist = &rd->cblist[prev];
-               /* Chain previous batch of callbacks, if any, to the pending list */
+               /* Chain previous batch of callbacks, if any, to the pending
+                * list, unless this cpu's callback thread will take them */
                if (plist->head) {
-                       rcu_list_join(pending, plist);
+                       if (!rcu_cb_handoff(cpu, plist))
+                               rcu_list_join(pending, plist);
                        rcu_list_init(plist);
                }
                if (cpu_online(cpu)) /* wins race with offlining every time */
@@ -493,6 +813,7 @@ static void rcu_timer_stop(void)
 
 void __init rcu_scheduler_starting(void)
 {
+       rcu_cb_threads_init();
        rcu_timer_init();
 }
 
@@ -599,11 +920,16 @@ static int rcu_hz = RCU_HZ;
 static int rcu_debugfs_show(struct seq_file *m, void *unused)
 {
        int cpu, q;
-       s64 nqueued;
+       s64 nqueued, ninvoked;
 
        nqueued = 0;
-       for_each_present_cpu(cpu)
+       ninvoked = rcu_stats.ninvoked;
+       for_each_present_cpu(cpu) {
                nqueued += rcu_data[cpu].nqueued;
+#ifdef CONFIG_JRCU_CB_THREADS
+               ninvoked += rcu_data[cpu].ninvoked;
+#endif
+       }
 
        seq_printf(m, "%14u: hz, %s\n",
                rcu_hz,
@@ -619,6 +945,9 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
        else
                seq_printf(m, "%14s: daemon priority\n", "none, no daemon");
 #endif
+#ifdef CONFIG_JRCU_CB_THREADS
+       seq_printf(m, "%14u: callback thread batch limit\n", rcu_cb_batch);
+#endif
 
        seq_printf(m, "\n");
        seq_printf(m, "%14u: #passes\n",
@@ -639,10 +968,14 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
                atomic_read(&rcu_stats.nbarriers));
        seq_printf(m, "%14u: #syncs\n",
                atomic_read(&rcu_stats.nsyncs));
+       seq_printf(m, "%14u: #expedited syncs\n",
+               atomic_read(&rcu_stats.nexpedited));
+       seq_printf(m, "%14u: #expedited syncs fallen back (0 is best)\n",
+               atomic_read(&rcu_stats.nexpfallback));
        seq_printf(m, "%14llu: #callbacks invoked\n",
-               rcu_stats.ninvoked);
+               ninvoked);
        seq_printf(m, "%14d: #callbacks left to invoke\n",
-               (int)(nqueued - rcu_stats.ninvoked));
+               (int)(nqueued - ninvoked));
        seq_printf(m, "\n");
 
        for_each_online_cpu(cpu)
@@ -670,6 +1003,17 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
        seq_printf(m, "  I - cpu idle, W - cpu waiting for end-of-batch,\n");
        seq_printf(m, "  * - the current Q, other is the previous Q.\n");
 
+#ifdef CONFIG_JRCU_CB_THREADS
+       seq_printf(m, "\n%4s %14s %14s %14s %14s\n", "CPU",
+               "queued", "invoked", "waiting", "max run (us)");
+       for_each_present_cpu(cpu) {
+               struct rcu_data *rd = &rcu_data[cpu];
+               seq_printf(m, "%4d %14lld %14lu %14lu %14lu\n", cpu,
+                       rd->nqueued, rd->ninvoked,
+                       rd->nhanded - rd->ninvoked, rd->max_run_us);
+       }
+#endif
+
        return 0;
 }
 
@@ -721,6 +1065,14 @@ next:
                rcu_hz_period_us = USEC_PER_SEC / rcu_hz;
        } else if (!strncmp(token, "precise=", 8)) {
                sscanf(&token[8], "%d", &rcu_hz_precise);
+#ifdef CONFIG_JRCU_CB_THREADS
+       } else if (!strncmp(token, "batch=", 6)) {
+               int batch = -1;
+               sscanf(&token[6], "%d", &batch);
+               if (batch < 1 || batch > 10000)
+                       return -EINVAL;
+               rcu_cb_batch = batch;
+#endif
        } else if (!strncmp(token, "wdog=", 5)) {
                int wdog = -1;
                sscanf(&token[5], "%d", &wdog);
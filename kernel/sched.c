@@ -643,6 +643,10 @@ struct rq {
 	u64 age_stamp;
 	u64 idle_stamp;
 	u64 avg_idle;
+#ifdef CONFIG_SCHED_FREQ_HINTS
+	/* cfs runnable load at the last load hint */
+	unsigned long load_hint_last;
+#endif
 #endif
 
 #ifdef CONFIG_IRQ_TIME_ACCOUNTING
@@ -689,8 +693,20 @@ struct rq {
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
-#ifdef CONFIG_INTELLI_PLUG
-DEFINE_PER_CPU_SHARED_ALIGNED(struct nr_stats_s, runqueue_stats);
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
+struct nr_stats_s {
+	/* time-based average load */
+	u64 nr_last_stamp;
+	unsigned int ave_nr_running;
+	seqcount_t ave_seqcnt;
+};
+
+#define NR_AVE_PERIOD_EXP	28
+#define NR_AVE_SCALE(x)		((x) << FSHIFT)
+#define NR_AVE_PERIOD		(1 << NR_AVE_PERIOD_EXP)
+#define NR_AVE_DIV_PERIOD(x)	((x) >> NR_AVE_PERIOD_EXP)
+
+static DEFINE_PER_CPU_SHARED_ALIGNED(struct nr_stats_s, runqueue_stats);
 #endif
 
 static void check_preempt_curr(struct rq *rq, struct task_struct *p, int flags);
@@ -726,22 +742,6 @@ static inline int cpu_of(struct rq *rq)
 #define cpu_curr(cpu)		(cpu_rq(cpu)->curr)
 #define raw_rq()		(&__raw_get_cpu_var(runqueues))
 
-#ifdef CONFIG_INTELLI_PLUG
-struct nr_stats_s {
-	/* time-based average load */
-	u64 nr_last_stamp;
-	unsigned int ave_nr_running;
-	seqcount_t ave_seqcnt;
-};
-
-#define NR_AVE_PERIOD_EXP	28
-#define NR_AVE_SCALE(x)		((x) << FSHIFT)
-#define NR_AVE_PERIOD		(1 << NR_AVE_PERIOD_EXP)
-#define NR_AVE_DIV_PERIOD(x)	((x) >> NR_AVE_PERIOD_EXP)
-
-DECLARE_PER_CPU(struct nr_stats_s, runqueue_stats);
-#endif
-
 #ifdef CONFIG_CGROUP_SCHED
 
 /*
@@ -804,7 +804,7 @@ static void update_rq_clock(struct rq *rq)
 	update_rq_clock_task(rq, delta);
 }
 
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 static inline unsigned int do_avg_nr_running(struct rq *rq)
 {
 
@@ -1998,34 +1998,34 @@ static const struct sched_class rt_sched_class;
 
 static void inc_nr_running(struct rq *rq)
 {
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 	struct nr_stats_s *nr_stats = &per_cpu(runqueue_stats, rq->cpu);
 #endif
 
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 	write_seqcount_begin(&nr_stats->ave_seqcnt);
 	nr_stats->ave_nr_running = do_avg_nr_running(rq);
 	nr_stats->nr_last_stamp = rq->clock_task;
 #endif
 	rq->nr_running++;
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 	write_seqcount_end(&nr_stats->ave_seqcnt);
 #endif
 }
 
 static void dec_nr_running(struct rq *rq)
 {
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 	struct nr_stats_s *nr_stats = &per_cpu(runqueue_stats, rq->cpu);
 #endif
 
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 	write_seqcount_begin(&nr_stats->ave_seqcnt);
 	nr_stats->ave_nr_running = do_avg_nr_running(rq);
 	nr_stats->nr_last_stamp = rq->clock_task;
 #endif
 	rq->nr_running--;
-#ifdef CONFIG_INTELLI_PLUG
+#ifdef CONFIG_SCHED_AVG_NR_RUNNING
 	write_seqcount_end(&nr_stats->ave_seqcnt);
 #endif
 }
@@ -3059,6 +3059,9 @@ static void __sched_fork(struct task_struct *p)
 	p->se.sum_exec_runtime		= 0;
 	p->se.prev_sum_exec_runtime	= 0;
 	p->se.nr_migrations		= 0;
+#ifdef CONFIG_SCHED_FREQ_HINTS
+	p->se.hint_migrations		= 0;
+#endif
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
@@ -103,6 +103,15 @@ unsigned int __read_mostly sysctl_sched_shares_window = 10000000UL;
 unsigned int sysctl_sched_cfs_bandwidth_slice = 5000UL;
 #endif
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+/*
+ * Smallest change of a cpu's cfs runnable load average that is reported
+ * to the sched_load notifiers, in load weight units.
+ * (default: a quarter of a nice-0 task)
+ */
+unsigned int sysctl_sched_load_hint_delta = NICE_0_LOAD / 4;
+#endif
+
 static const struct sched_class fair_sched_class;
 
 /**************************************************************
@@ -2223,6 +2232,66 @@ static inline void hrtick_update(struct rq *rq)
 }
 #endif
 
+#ifdef CONFIG_SCHED_FREQ_HINTS
+static ATOMIC_NOTIFIER_HEAD(sched_load_notifier_head);
+
+int register_sched_load_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&sched_load_notifier_head, nb);
+}
+EXPORT_SYMBOL_GPL(register_sched_load_notifier);
+
+int unregister_sched_load_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&sched_load_notifier_head, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_sched_load_notifier);
+
+/*
+ * Tell the sched_load notifiers about a significant change of rq's cfs
+ * runnable load since the last hint.  Called with rq->lock held.
+ */
+static void sched_load_hint(struct rq *rq, enum sched_load_event event)
+{
+	struct sched_load_hint hint;
+	unsigned long load;
+	long delta;
+
+	if (!rcu_access_pointer(sched_load_notifier_head.head))
+		return;
+
+	load = rq->cfs.runnable_load_avg;
+	delta = (long)(load - rq->load_hint_last);
+	if ((unsigned long)abs(delta) < sysctl_sched_load_hint_delta)
+		return;
+
+	rq->load_hint_last = load;
+	hint.cpu = cpu_of(rq);
+	hint.load = load;
+	hint.delta = delta;
+	atomic_notifier_call_chain(&sched_load_notifier_head, event, &hint);
+}
+
+/*
+ * Load that set_task_cpu() moved here from another cpu since the task
+ * was last enqueued. decay_count <= 0 is not used for this, as dequeues
+ * that do not sleep (nice, policy or group changes) leave it at zero
+ * too without the task ever leaving this cpu.
+ */
+static inline int sched_load_migrated(struct task_struct *p)
+{
+	struct sched_entity *se = &p->se;
+	int migrated = se->nr_migrations != se->hint_migrations;
+
+	se->hint_migrations = se->nr_migrations;
+	return migrated;
+}
+#else
+static inline void sched_load_hint(struct rq *rq,
+				   enum sched_load_event event) { }
+static inline int sched_load_migrated(struct task_struct *p) { return 0; }
+#endif
+
 /*
  * The enqueue_task method is called before nr_running is
  * increased. Here we update the fair scheduling stats and
@@ -2233,6 +2302,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 {
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
+	int migrated = sched_load_migrated(p);
 
 	for_each_sched_entity(se) {
 		if (se->on_rq)
@@ -2268,6 +2338,7 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 		update_rq_runnable_avg(rq, rq->nr_running);
 		inc_nr_running(rq);
 	}
+	sched_load_hint(rq, migrated ? SCHED_LOAD_MIGRATE : SCHED_LOAD_ENQUEUE);
 	hrtick_update(rq);
 }
 
@@ -2329,6 +2400,7 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 		dec_nr_running(rq);
 		update_rq_runnable_avg(rq, 1);
 	}
+	sched_load_hint(rq, SCHED_LOAD_DEQUEUE);
 	hrtick_update(rq);
 }
 
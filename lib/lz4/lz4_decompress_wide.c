@@ -0,0 +1,21 @@
+/*
+ * LZ4 Decompressor using unaligned word copies
+ *
+ * The decoder of lz4_decompress.c, built so that literal and match
+ * copies use plain word loads and stores rather than the byte-wise
+ * get_unaligned() fallback of architectures that do not declare
+ * efficient unaligned access. Only usable on CPUs that handle unaligned
+ * word accesses in hardware; crypto/lz4.c checks that at runtime before
+ * registering it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define LZ4_WIDE_COPY
+
+#define lz4_decompress lz4_decompress_wide
+#define lz4_decompress_unknownoutputsize lz4_decompress_unknownoutputsize_wide
+
+#include "lz4_decompress.c"
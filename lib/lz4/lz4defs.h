@@ -22,12 +22,24 @@
  * Architecture-specific macros
  */
 #define BYTE	u8
+#ifdef LZ4_WIDE_COPY
+/*
+ * Built for CPUs that do unaligned word accesses in hardware (see
+ * lz4_decompress_wide.c). Packed, so the compiler never merges them into
+ * double-word or multiple loads that still need alignment.
+ */
+typedef struct _U16_S { u16 v; } __packed U16_S;
+typedef struct _U32_S { u32 v; } __packed U32_S;
+typedef struct _U64_S { u64 v; } __packed U64_S;
+#else
 typedef struct _U16_S { u16 v; } U16_S;
 typedef struct _U32_S { u32 v; } U32_S;
 typedef struct _U64_S { u64 v; } U64_S;
+#endif
 #if defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS) || defined(CONFIG_ARM) \
 	&& __LINUX_ARM_ARCH__ >= 6 \
-	&& defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS)
+	&& defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS) \
+	|| defined(LZ4_WIDE_COPY)
 
 #define A16(x) (((U16_S *)(x))->v)
 #define A32(x) (((U32_S *)(x))->v)
@@ -0,0 +1,15 @@
+/*
+ *  LZO1X Decompressor using unaligned word copies
+ *
+ *  The decoder of lzo1x_decompress.c, built so that COPY4/COPY8 are
+ *  plain word loads and stores rather than the byte-wise get_unaligned()
+ *  fallback of architectures that do not declare efficient unaligned
+ *  access. Only usable on CPUs that handle unaligned word accesses in
+ *  hardware; crypto/lzo.c checks that at runtime before registering it.
+ */
+
+#define LZO_WIDE_COPY
+
+#define lzo1x_decompress_safe lzo1x_decompress_safe_wide
+
+#include "lzo1x_decompress.c"
@@ -12,8 +12,15 @@
  */
 
 
+#ifdef LZO_WIDE_COPY
+/* one word access each way, see lzo1x_decompress_wide.c */
+typedef struct { u32 v; } __packed lzo_u32_p;
+#define COPY4(dst, src)	\
+		(((lzo_u32_p *)(dst))->v = ((const lzo_u32_p *)(src))->v)
+#else
 #define COPY4(dst, src)	\
 		put_unaligned(get_unaligned((const u32 *)(src)), (u32 *)(dst))
+#endif
 #if defined(__x86_64__)
 #define COPY8(dst, src)	\
 		put_unaligned(get_unaligned((const u64 *)(src)), (u64 *)(dst))
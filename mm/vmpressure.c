@@ -0,0 +1,257 @@
+/*
+ * linux/mm/vmpressure.c - global memory pressure from reclaim efficiency
+ *
+ * Reclaim reports how many pages it scanned and how many of them it
+ * could actually free. Once a window of scanned pages has accumulated,
+ * the share of scanned pages that could not be reclaimed gives the
+ * pressure (0-100): near zero while clean cache is cheap to drop, close to
+ * 100 when reclaim is only churning through referenced or dirty pages.
+ *
+ * The level derived from the pressure is exported in
+ * /sys/kernel/mm/vmpressure/level, which supports poll(), so userspace can
+ * shed its own caches before in-kernel killers step in. Kernel users get
+ * every window's pressure through vmpressure_register_notifier(), with the
+ * pressure as the notifier action.
+ *
+ * This file is released under the GPL v2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Pages reclaim has to scan before the pressure is evaluated. Smaller
+ * windows react faster but are noisier; this is 2MB with 4k pages.
+ */
+static unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* Pressure at which the low, medium and critical levels start */
+static unsigned int vmpressure_level_low = 40;
+static unsigned int vmpressure_level_med = 60;
+static unsigned int vmpressure_level_critical = 95;
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_NONE] = "none",
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+static void vmpressure_work_fn(struct work_struct *work);
+
+static struct {
+	spinlock_t sr_lock;
+	unsigned long scanned;
+	unsigned long reclaimed;
+	/* last full window, handed over to the work item */
+	unsigned long win_scanned;
+	unsigned long win_reclaimed;
+	struct work_struct work;
+
+	unsigned int pressure;
+	enum vmpressure_levels level;
+} vmpr = {
+	.sr_lock = __SPIN_LOCK_UNLOCKED(vmpr.sr_lock),
+	.work = __WORK_INITIALIZER(vmpr.work, vmpressure_work_fn),
+};
+
+static ATOMIC_NOTIFIER_HEAD(vmpressure_notifier);
+
+
+static unsigned int vmpressure_calc_pressure(unsigned long scanned,
+					     unsigned long reclaimed)
+{
+	unsigned long scale = scanned + reclaimed;
+	unsigned long pressure;
+
+	/*
+	 * Reclaim may free more than it scanned (e.g. whole huge pages or
+	 * pages freed by the shrinkers); count that as no pressure.
+	 */
+	if (!scanned || reclaimed >= scanned)
+		return 0;
+
+	pressure = scale - (reclaimed * scale / scanned);
+	return pressure * 100 / scale;
+}
+
+static enum vmpressure_levels vmpressure_level(unsigned int pressure)
+{
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	if (pressure >= vmpressure_level_low)
+		return VMPRESSURE_LOW;
+	return VMPRESSURE_NONE;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	unsigned long scanned, reclaimed;
+	enum vmpressure_levels level;
+	unsigned int pressure;
+
+	spin_lock(&vmpr.sr_lock);
+	scanned = vmpr.win_scanned;
+	reclaimed = vmpr.win_reclaimed;
+	vmpr.win_scanned = 0;
+	vmpr.win_reclaimed = 0;
+	spin_unlock(&vmpr.sr_lock);
+
+	if (!scanned)
+		return;
+
+	pressure = vmpressure_calc_pressure(scanned, reclaimed);
+	level = vmpressure_level(pressure);
+	vmpr.pressure = pressure;
+
+	atomic_notifier_call_chain(&vmpressure_notifier, pressure, NULL);
+
+	if (level != vmpr.level) {
+		vmpr.level = level;
+		sysfs_notify(mm_kobj, "vmpressure", "level");
+	}
+}
+
+/**
+ * vmpressure() - account reclaim efficiency
+ * @gfp:	reclaimer's gfp mask
+ * @scanned:	number of pages scanned
+ * @reclaimed:	number of pages reclaimed
+ *
+ * Called by reclaim after each zone pass. Reclaim for allocations that
+ * userspace could not help with is ignored; the evaluation itself is
+ * deferred to a work item once a window of pages has been scanned.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	/*
+	 * Only account pressure that freeing userspace memory relieves.
+	 * An allocation that is neither highmem nor movable and may not
+	 * do I/O or enter the filesystem is typically after low zone
+	 * (e.g. DMA) pages, which userspace does not hold.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpr.sr_lock);
+	vmpr.scanned += scanned;
+	vmpr.reclaimed += reclaimed;
+	if (vmpr.scanned < vmpressure_win) {
+		spin_unlock(&vmpr.sr_lock);
+		return;
+	}
+	vmpr.win_scanned += vmpr.scanned;
+	vmpr.win_reclaimed += vmpr.reclaimed;
+	vmpr.scanned = 0;
+	vmpr.reclaimed = 0;
+	spin_unlock(&vmpr.sr_lock);
+
+	schedule_work(&vmpr.work);
+}
+
+int vmpressure_register_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_register_notifier);
+
+int vmpressure_unregister_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_unregister_notifier);
+
+static ssize_t level_show(struct kobject *kobj,
+			  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", vmpressure_str_levels[vmpr.level]);
+}
+static struct kobj_attribute level_attr = __ATTR_RO(level);
+
+static ssize_t pressure_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", vmpr.pressure);
+}
+static struct kobj_attribute pressure_attr = __ATTR_RO(pressure);
+
+static ssize_t window_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", vmpressure_win);
+}
+
+static ssize_t window_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	unsigned long win;
+	int err;
+
+	err = strict_strtoul(buf, 10, &win);
+	if (err || win < SWAP_CLUSTER_MAX)
+		return -EINVAL;
+
+	vmpressure_win = win;
+	return count;
+}
+static struct kobj_attribute window_attr =
+	__ATTR(window, 0644, window_show, window_store);
+
+#define VMPRESSURE_THRESHOLD_ATTR(_name, _var)				\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", _var);				\
+}									\
+static ssize_t _name##_store(struct kobject *kobj,			\
+			     struct kobj_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	unsigned long val;						\
+									\
+	if (strict_strtoul(buf, 10, &val) || val > 100)			\
+		return -EINVAL;						\
+	_var = val;							\
+	return count;							\
+}									\
+static struct kobj_attribute _name##_attr =				\
+	__ATTR(_name, 0644, _name##_show, _name##_store)
+
+VMPRESSURE_THRESHOLD_ATTR(level_low, vmpressure_level_low);
+VMPRESSURE_THRESHOLD_ATTR(level_medium, vmpressure_level_med);
+VMPRESSURE_THRESHOLD_ATTR(level_critical, vmpressure_level_critical);
+
+static struct attribute *vmpressure_attrs[] = {
+	&level_attr.attr,
+	&pressure_attr.attr,
+	&window_attr.attr,
+	&level_low_attr.attr,
+	&level_medium_attr.attr,
+	&level_critical_attr.attr,
+	NULL,
+};
+
+static struct attribute_group vmpressure_attr_group = {
+	.attrs = vmpressure_attrs,
+	.name = "vmpressure",
+};
+
+static int __init vmpressure_init(void)
+{
+	if (sysfs_create_group(mm_kobj, &vmpressure_attr_group))
+		printk(KERN_ERR "vmpressure: register sysfs failed\n");
+	return 0;
+}
+late_initcall(vmpressure_init);
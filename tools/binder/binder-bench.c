@@ -0,0 +1,602 @@
+/*
+ * binder-bench -- binder IPC ping-pong throughput and latency as the
+ * number of independent client/server process pairs grows.
+ *
+ * The benchmark is its own context manager, so it needs a /dev/binder
+ * nobody else is using: a QEMU guest, or a device with servicemanager
+ * stopped. Build it against the kernel's binder.h for the target:
+ *
+ *	make -C tools/binder CC=arm-linux-androideabi-gcc
+ *	binder-bench -p 1,2,4,8 -n 20000 -s 64
+ *
+ * One server process is started per pair and registers a binder object
+ * with the manager. For each pair count in -p, that many client processes
+ * look up their own server and, released together, each make -n
+ * synchronous transactions of -s bytes, which the server echoes back.
+ * Every client talks only to its own server, so the pairs share nothing
+ * but the driver.
+ *
+ * For each pair count it prints the aggregate transactions per second
+ * over the window in which the clients ran, and the distribution of
+ * round-trip latencies across all clients.
+ *
+ * -r makes the clients SCHED_FIFO at the given priority and -l starts
+ * that many SCHED_NORMAL busy loops next to them. Together they show
+ * what RT inheritance buys a caller whose server would otherwise queue
+ * behind the hogs; compare a run with inheritance turned off:
+ *
+ *	echo 0 > /sys/module/binder/parameters/inherit_rt
+ *	binder-bench -p 1 -n 20000 -r 50 -l 4
+ *	echo 1 > /sys/module/binder/parameters/inherit_rt
+ *	binder-bench -p 1 -n 20000 -r 50 -l 4
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_PAYLOAD	4096
+#define MAX_HOGS	64
+
+enum {
+	CODE_REGISTER = 1,	/* server -> manager: obj, index */
+	CODE_LOOKUP,		/* client -> manager: index */
+	CODE_PING,		/* client -> server: payload */
+};
+
+struct binder {
+	int fd;
+	void *map;
+	void *pending_free;	/* buffer to free with the next write */
+};
+
+struct shared {
+	uint64_t start[MAX_PAIRS];
+	uint64_t end[MAX_PAIRS];
+	uint32_t lat[];		/* ns, iterations per client */
+};
+
+static const char *device = "/dev/binder";
+static unsigned int iterations = 10000;
+static unsigned int payload = 32;
+static int rt_priority;
+static struct shared *shm;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void binder_open(struct binder *b)
+{
+	struct binder_version vers;
+
+	b->fd = open(device, O_RDWR);
+	if (b->fd < 0)
+		die(device);
+	if (ioctl(b->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, built for %d\n",
+			vers.protocol_version,
+			BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	b->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, b->fd, 0);
+	if (b->map == MAP_FAILED)
+		die("mmap");
+	b->pending_free = NULL;
+}
+
+static int binder_ioctl(struct binder *b, void *wbuf, size_t wlen,
+			void *rbuf, size_t rlen, size_t *rdone)
+{
+	struct binder_write_read bwr;
+
+	bwr.write_size = wlen;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.read_size = rlen;
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+
+	while (ioctl(b->fd, BINDER_WRITE_READ, &bwr) < 0)
+		if (errno != EINTR)
+			return -1;
+	if (rdone)
+		*rdone = bwr.read_consumed;
+	return 0;
+}
+
+/* command buffer for one write */
+struct wbuf {
+	size_t len;
+	uint8_t data[256];
+};
+
+static void put(struct wbuf *w, uint32_t cmd, const void *arg, size_t len)
+{
+	memcpy(w->data + w->len, &cmd, sizeof(cmd));
+	w->len += sizeof(cmd);
+	if (len)
+		memcpy(w->data + w->len, arg, len);
+	w->len += len;
+}
+
+static void put_free(struct binder *b, struct wbuf *w)
+{
+	if (b->pending_free) {
+		put(w, BC_FREE_BUFFER, &b->pending_free, sizeof(void *));
+		b->pending_free = NULL;
+	}
+}
+
+static void put_acquire(struct wbuf *w, uint32_t handle)
+{
+	put(w, BC_INCREFS, &handle, sizeof(handle));
+	put(w, BC_ACQUIRE, &handle, sizeof(handle));
+}
+
+/*
+ * Write w, then read until a BR_TRANSACTION or BR_REPLY arrives, which is
+ * returned in txn with its buffer queued for freeing. Reference count
+ * requests on our own objects are acknowledged on the way.
+ */
+static int binder_wait(struct binder *b, struct wbuf *w,
+		       struct binder_transaction_data *txn)
+{
+	uint32_t rbuf[128];
+	size_t rlen, pos;
+
+	for (;;) {
+		if (binder_ioctl(b, w ? w->data : NULL, w ? w->len : 0,
+				 rbuf, sizeof(rbuf), &rlen) < 0)
+			return -1;
+		w = NULL;
+
+		for (pos = 0; pos < rlen; ) {
+			uint8_t *p = (uint8_t *)rbuf + pos;
+			uint32_t cmd;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			pos += sizeof(cmd) + _IOC_SIZE(cmd);
+
+			switch (cmd) {
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(txn, p, sizeof(*txn));
+				b->pending_free = (void *)txn->data.ptr.buffer;
+				return cmd;
+			case BR_INCREFS:
+			case BR_ACQUIRE: {
+				struct wbuf ack = { 0 };
+
+				put(&ack, cmd == BR_INCREFS ?
+				    BC_INCREFS_DONE : BC_ACQUIRE_DONE,
+				    p, sizeof(struct binder_ptr_cookie));
+				if (binder_ioctl(b, ack.data, ack.len,
+						 NULL, 0, NULL) < 0)
+					return -1;
+				break;
+			}
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+			case BR_ERROR:
+				errno = EPIPE;
+				return -1;
+			default:
+				/* BR_NOOP, BR_TRANSACTION_COMPLETE, ... */
+				break;
+			}
+		}
+	}
+}
+
+static void put_txn(struct wbuf *w, uint32_t cmd, uint32_t handle,
+		    uint32_t code, const void *data, size_t len,
+		    const size_t *offs, size_t noffs)
+{
+	struct binder_transaction_data txn;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.target.handle = handle;
+	txn.code = code;
+	txn.data_size = len;
+	txn.offsets_size = noffs * sizeof(size_t);
+	txn.data.ptr.buffer = data;
+	txn.data.ptr.offsets = offs;
+	put(w, cmd, &txn, sizeof(txn));
+}
+
+static int binder_call(struct binder *b, uint32_t handle, uint32_t code,
+		       const void *data, size_t len,
+		       const size_t *offs, size_t noffs,
+		       struct binder_transaction_data *reply)
+{
+	struct wbuf w = { 0 };
+
+	put_free(b, &w);
+	put_txn(&w, BC_TRANSACTION, handle, code, data, len, offs, noffs);
+	return binder_wait(b, &w, reply) == BR_REPLY ? 0 : -1;
+}
+
+/* Hands out the handle of server i to client i. */
+static void manager_main(int ready)
+{
+	uint32_t handles[MAX_PAIRS];
+	int registered[MAX_PAIRS] = { 0 };
+	struct binder_transaction_data txn;
+	struct flat_binder_object obj;
+	struct binder b;
+	struct wbuf w = { 0 };
+	size_t off = 0;
+
+	binder_open(&b);
+	if (ioctl(b.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		die("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+	put(&w, BC_ENTER_LOOPER, NULL, 0);
+	if (write(ready, "m", 1) != 1)
+		die("write");
+	close(ready);
+
+	for (;;) {
+		const uint8_t *data;
+		uint32_t index;
+
+		if (binder_wait(&b, &w, &txn) != BR_TRANSACTION)
+			die("manager");
+		data = txn.data.ptr.buffer;
+		memset(&w, 0, sizeof(w));
+
+		switch (txn.code) {
+		case CODE_REGISTER:
+			memcpy(&obj, data, sizeof(obj));
+			memcpy(&index, data + sizeof(obj), sizeof(index));
+			if (index < MAX_PAIRS) {
+				handles[index] = obj.handle;
+				registered[index] = 1;
+				/* keep the ref past freeing the buffer */
+				put_acquire(&w, obj.handle);
+			}
+			put_txn(&w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+			break;
+		case CODE_LOOKUP:
+			memcpy(&index, data, sizeof(index));
+			if (index < MAX_PAIRS && registered[index]) {
+				memset(&obj, 0, sizeof(obj));
+				obj.type = BINDER_TYPE_HANDLE;
+				obj.handle = handles[index];
+				put_txn(&w, BC_REPLY, 0, 0, &obj, sizeof(obj),
+					&off, 1);
+			} else {
+				put_txn(&w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+			}
+			break;
+		default:
+			put_txn(&w, BC_REPLY, 0, 0, NULL, 0, NULL, 0);
+			break;
+		}
+		/* the reply may point into this buffer, free it after */
+		put_free(&b, &w);
+	}
+}
+
+/* Echoes every transaction back as the reply. */
+static void server_main(uint32_t index, int ready)
+{
+	struct binder_transaction_data txn;
+	struct binder b;
+	struct wbuf w = { 0 };
+	static int cookie;
+	struct {
+		struct flat_binder_object obj;
+		uint32_t index;
+	} reg;
+	size_t off = 0;
+
+	binder_open(&b);
+
+	memset(&reg, 0, sizeof(reg));
+	reg.obj.type = BINDER_TYPE_BINDER;
+	reg.obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	reg.obj.binder = &cookie;
+	reg.obj.cookie = &cookie;
+	reg.index = index;
+	if (binder_call(&b, 0, CODE_REGISTER, &reg, sizeof(reg), &off, 1,
+			&txn) < 0)
+		die("register");
+	if (write(ready, "s", 1) != 1)
+		die("write");
+	close(ready);
+
+	put_free(&b, &w);
+	put(&w, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (binder_wait(&b, &w, &txn) != BR_TRANSACTION)
+			die("server");
+		memset(&w, 0, sizeof(w));
+		put_txn(&w, BC_REPLY, 0, 0, txn.data.ptr.buffer,
+			txn.data_size, NULL, 0);
+		put_free(&b, &w);
+	}
+}
+
+static void client_main(uint32_t index, int ready, int go)
+{
+	struct binder_transaction_data txn;
+	struct flat_binder_object obj;
+	uint32_t *lat = shm->lat + (size_t)index * iterations;
+	uint8_t data[MAX_PAYLOAD];
+	struct binder b;
+	struct wbuf w = { 0 };
+	unsigned int i;
+	char c;
+
+	if (rt_priority) {
+		struct sched_param param = { .sched_priority = rt_priority };
+
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+			die("sched_setscheduler");
+	}
+	binder_open(&b);
+	memset(data, 0x5a, payload);
+
+	for (;;) {
+		if (binder_call(&b, 0, CODE_LOOKUP, &index, sizeof(index),
+				NULL, 0, &txn) < 0)
+			die("lookup");
+		if (txn.data_size >= sizeof(obj))
+			break;
+		usleep(1000);
+	}
+	memcpy(&obj, txn.data.ptr.buffer, sizeof(obj));
+	put_acquire(&w, obj.handle);
+	put_free(&b, &w);
+	if (binder_ioctl(&b, w.data, w.len, NULL, 0, NULL) < 0)
+		die("acquire");
+
+	if (write(ready, "c", 1) != 1)
+		die("write");
+	close(ready);
+	if (read(go, &c, 1) < 0)
+		die("read");
+
+	shm->start[index] = now_ns();
+	for (i = 0; i < iterations; i++) {
+		uint64_t t = now_ns();
+
+		if (binder_call(&b, obj.handle, CODE_PING, data, payload,
+				NULL, 0, &txn) < 0)
+			die("ping");
+		lat[i] = now_ns() - t;
+	}
+	shm->end[index] = now_ns();
+	exit(0);
+}
+
+static void hog_main(void)
+{
+	volatile unsigned long spin = 0;
+
+	for (;;)
+		spin++;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run_round(unsigned int pairs)
+{
+	size_t n = (size_t)pairs * iterations, k;
+	uint64_t start = UINT64_MAX, end = 0, sum = 0;
+	int ready[2], go[2], status;
+	pid_t clients[MAX_PAIRS];
+	unsigned int i;
+	char c;
+
+	if (pipe(ready) < 0 || pipe(go) < 0)
+		die("pipe");
+
+	for (i = 0; i < pairs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid) {
+			close(ready[0]);
+			close(go[1]);
+			client_main(i, ready[1], go[0]);
+		}
+		clients[i] = pid;
+	}
+	close(ready[1]);
+	close(go[0]);
+
+	for (i = 0; i < pairs; i++)
+		if (read(ready[0], &c, 1) != 1)
+			die("client setup");
+	close(go[1]);		/* release them all at once */
+
+	for (i = 0; i < pairs; i++) {
+		if (waitpid(clients[i], &status, 0) < 0)
+			die("waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			exit(1);
+	}
+	close(ready[0]);
+
+	for (i = 0; i < pairs; i++) {
+		if (shm->start[i] < start)
+			start = shm->start[i];
+		if (shm->end[i] > end)
+			end = shm->end[i];
+	}
+	for (k = 0; k < n; k++)
+		sum += shm->lat[k];
+	qsort(shm->lat, n, sizeof(uint32_t), cmp_u32);
+
+	printf("%5u %10.0f %8.1f %8.1f %8.1f %8.1f %8.1f\n", pairs,
+	       n * 1e9 / (end - start),
+	       sum / 1e3 / n,
+	       shm->lat[n / 2] / 1e3,
+	       shm->lat[n * 90 / 100] / 1e3,
+	       shm->lat[n * 99 / 100] / 1e3,
+	       shm->lat[n - 1] / 1e3);
+	fflush(stdout);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: binder-bench [-d device] [-p pairs,...] "
+		"[-n iterations] [-s bytes] [-r rt_prio] [-l hogs]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int counts[MAX_PAIRS], ncounts = 0, max = 0, i;
+	pid_t helpers[MAX_PAIRS + 1 + MAX_HOGS];
+	unsigned int nhelpers = 0, hogs = 0;
+	char defaults[] = "1,2,4,8", *list = defaults, *s;
+	int ready[2], opt, ret = 0;
+	char c;
+
+	while ((opt = getopt(argc, argv, "d:p:n:s:r:l:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'p':
+			list = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rt_priority = strtol(optarg, NULL, 0);
+			break;
+		case 'l':
+			hogs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!iterations || payload > MAX_PAYLOAD || hogs > MAX_HOGS ||
+	    rt_priority < 0 || rt_priority > sched_get_priority_max(SCHED_FIFO))
+		usage();
+
+	for (s = strtok(list, ","); s; s = strtok(NULL, ",")) {
+		unsigned int p = strtoul(s, NULL, 0);
+
+		if (!p || p > MAX_PAIRS || ncounts == MAX_PAIRS)
+			usage();
+		counts[ncounts++] = p;
+		if (p > max)
+			max = p;
+	}
+	if (!ncounts)
+		usage();
+
+	shm = mmap(NULL, sizeof(*shm) + sizeof(uint32_t) * max * iterations,
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		die("mmap");
+
+	for (i = 0; i <= max; i++) {
+		pid_t pid;
+		int ok;
+
+		if (pipe(ready) < 0)
+			die("pipe");
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid) {
+			/* don't outlive an early exit of the parent */
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			close(ready[0]);
+			if (i == 0)
+				manager_main(ready[1]);
+			server_main(i - 1, ready[1]);
+		}
+		helpers[nhelpers++] = pid;
+		close(ready[1]);
+		/* servers register with the manager, so it goes first */
+		ok = read(ready[0], &c, 1) == 1;
+		close(ready[0]);
+		if (!ok) {
+			fprintf(stderr, "binder-bench: setup failed\n");
+			ret = 1;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < hogs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid) {
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			hog_main();
+		}
+		helpers[nhelpers++] = pid;
+	}
+
+	printf("%u-byte payload, %u round trips per client", payload,
+	       iterations);
+	if (rt_priority)
+		printf(", clients SCHED_FIFO %d", rt_priority);
+	if (hogs)
+		printf(", %u cpu hogs", hogs);
+	printf("\n");
+	printf("pairs   trans/s   avg_us   p50_us   p90_us   p99_us   max_us\n");
+	for (i = 0; i < ncounts; i++)
+		run_round(counts[i]);
+
+out:
+	for (i = 0; i < nhelpers; i++)
+		kill(helpers[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+	return ret;
+}
@@ -0,0 +1,389 @@
+/*
+ * sio-replay -- replay a block trace against a scratch device and report
+ * IOPS and completion latency for each I/O scheduler setting.
+ *
+ * The trace is the text output of blkparse, for instance
+ *
+ *	blktrace -d /dev/mmcblk0 -o - | blkparse -i - > app.trace
+ *
+ * taken while the application of interest ran. Only the Q (queued) events
+ * are replayed, as O_DIRECT reads and writes of the same size and sector,
+ * wrapped to the size of the target device. Without -i a synthetic trace
+ * is used instead: -w streams of 4 KiB writes, each sequential in its own
+ * region of the device and interleaved with the others, the pattern of a
+ * database writing its journal and its main file at the same time.
+ *
+ * -q worker threads take the trace entries in order and each keeps one
+ * request in flight, so up to -q consecutive entries are queued together
+ * and the scheduler can merge or batch them. Entries are issued at their
+ * trace time unless -f is given, in which case they go out as fast as the
+ * workers can issue them.
+ *
+ * Each scheduler of -e is selected in turn through the device's sysfs
+ * queue/scheduler. For a scheduler with a contig_batch tunable (sio) the
+ * replay is repeated for each value of -c; contig_batch 1 is stock SIO.
+ * The I/O is O_DIRECT, so the runs do not affect each other through the
+ * page cache:
+ *
+ *	make -C tools/block CC=arm-linux-androideabi-gcc
+ *	sio-replay -d /dev/block/loop0 -e sio,noop -c 1,8,32 -q 16 -f
+ *	sio-replay -d /dev/nullb0 -i app.trace -e sio -c 1,16
+ *
+ * Use a loop device over tmpfs or null_blk as target to measure the
+ * scheduler rather than the media, or the real eMMC to see what batching
+ * buys there. This needs root and destroys the content of the device.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define MAX_THREADS	256
+#define MAX_LIST	16
+#define MAX_IO		(512 * 1024)
+#define SYNTH_IO	4096
+
+struct trace_io {
+	uint64_t time;		/* ns from the start of the trace */
+	uint64_t offset;	/* bytes */
+	uint32_t len;		/* bytes */
+	int write;
+	uint32_t lat;		/* ns, filled in by the replay */
+};
+
+static const char *device;
+static char disk[64];
+static struct trace_io *trace;
+static size_t nr_ios, next_io;
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t barrier;
+static uint64_t dev_size, replay_start;
+static unsigned int sector_size = 512;
+static int full_speed, fd;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int sysfs_write(const char *attr, const char *val)
+{
+	char path[128];
+	int sfd, ret = 0;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/%s", disk, attr);
+	sfd = open(path, O_WRONLY);
+	if (sfd < 0)
+		return -1;
+	if (write(sfd, val, strlen(val)) < 0)
+		ret = -1;
+	close(sfd);
+	return ret;
+}
+
+static void add_io(uint64_t time, uint64_t offset, uint32_t len, int write)
+{
+	static size_t size;
+	struct trace_io *io;
+
+	if (nr_ios == size) {
+		size = size ? size * 2 : 4096;
+		trace = realloc(trace, size * sizeof(*trace));
+		if (!trace)
+			die("realloc");
+	}
+	/* keep it inside the device and aligned for O_DIRECT */
+	if (len > MAX_IO)
+		len = MAX_IO;
+	len = (len + sector_size - 1) / sector_size * sector_size;
+	offset = offset % (dev_size - len) / sector_size * sector_size;
+
+	io = &trace[nr_ios++];
+	io->time = time;
+	io->offset = offset;
+	io->len = len;
+	io->write = write;
+}
+
+/* Q events of blkparse's default output format */
+static void load_trace(const char *path)
+{
+	unsigned long long sector;
+	unsigned int nsect;
+	char line[256], action[8], rwbs[8];
+	uint64_t first = 0;
+	double t;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		die(path);
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%*d,%*d %*d %*u %lf %*d %7s %7s %llu + %u",
+			   &t, action, rwbs, &sector, &nsect) != 5)
+			continue;
+		if (strcmp(action, "Q") || !nsect || strchr(rwbs, 'D'))
+			continue;
+		if (!strchr(rwbs, 'R') && !strchr(rwbs, 'W'))
+			continue;
+		if (!nr_ios)
+			first = t * 1e9;
+		add_io(t * 1e9 - first, sector * 512, nsect * 512,
+		       strchr(rwbs, 'W') != NULL);
+	}
+	fclose(f);
+	if (!nr_ios) {
+		fprintf(stderr, "sio-replay: no Q events in %s\n", path);
+		exit(1);
+	}
+}
+
+/* Interleaved sequential 4 KiB writes, one stream per region */
+static void synth_trace(unsigned int streams, size_t count)
+{
+	uint64_t region = dev_size / streams / SYNTH_IO * SYNTH_IO;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		add_io(0, (i % streams) * region +
+		       (i / streams) * SYNTH_IO % region, SYNTH_IO, 1);
+}
+
+static void *worker_main(void *arg)
+{
+	unsigned char *buf;
+
+	if (posix_memalign((void **)&buf, 4096, MAX_IO))
+		die("posix_memalign");
+	memset(buf, 0x5a, MAX_IO);
+
+	pthread_barrier_wait(&barrier);
+
+	for (;;) {
+		struct trace_io *io;
+		uint64_t t;
+		ssize_t ret;
+
+		pthread_mutex_lock(&next_lock);
+		io = next_io < nr_ios ? &trace[next_io++] : NULL;
+		pthread_mutex_unlock(&next_lock);
+		if (!io)
+			break;
+
+		if (!full_speed) {
+			t = replay_start + io->time;
+			while (now_ns() < t) {
+				struct timespec ts = {
+					.tv_sec = (t - now_ns()) / 1000000000ull,
+					.tv_nsec = (t - now_ns()) % 1000000000ull,
+				};
+
+				nanosleep(&ts, NULL);
+			}
+		}
+		t = now_ns();
+		if (io->write)
+			ret = pwrite(fd, buf, io->len, io->offset);
+		else
+			ret = pread(fd, buf, io->len, io->offset);
+		if (ret != io->len)
+			die(io->write ? "pwrite" : "pread");
+		io->lat = now_ns() - t;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run_replay(const char *sched, const char *contig,
+		       unsigned int threads, uint32_t *lat)
+{
+	pthread_t thread[MAX_THREADS];
+	uint64_t bytes = 0, sum = 0, elapsed;
+	unsigned int i;
+	size_t k;
+	int err;
+
+	next_io = 0;
+	if (pthread_barrier_init(&barrier, NULL, threads + 1))
+		die("pthread_barrier_init");
+	for (i = 0; i < threads; i++) {
+		err = pthread_create(&thread[i], NULL, worker_main, NULL);
+		if (err) {
+			errno = err;
+			die("pthread_create");
+		}
+	}
+	replay_start = now_ns();
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < threads; i++)
+		pthread_join(thread[i], NULL);
+	elapsed = now_ns() - replay_start;
+	pthread_barrier_destroy(&barrier);
+
+	for (k = 0; k < nr_ios; k++) {
+		lat[k] = trace[k].lat;
+		sum += lat[k];
+		bytes += trace[k].len;
+	}
+	qsort(lat, nr_ios, sizeof(uint32_t), cmp_u32);
+
+	printf("%-12s %6s %9.0f %8.1f %8.1f %8.1f %8.1f %9.1f\n",
+	       sched, contig,
+	       nr_ios / (elapsed / 1e9),
+	       bytes / (double)(1 << 20) / (elapsed / 1e9),
+	       sum / 1e3 / nr_ios,
+	       lat[nr_ios / 2] / 1e3,
+	       lat[nr_ios * 99 / 100] / 1e3,
+	       lat[nr_ios - 1] / 1e3);
+	fflush(stdout);
+}
+
+static unsigned int split(char *list, char **items)
+{
+	unsigned int n = 0;
+	char *s;
+
+	for (s = strtok(list, ","); s && n < MAX_LIST; s = strtok(NULL, ","))
+		items[n++] = s;
+	return n;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: sio-replay -d device [-i blkparse_output] "
+		"[-w streams] [-n ios] [-e sched,...] [-c contig_batch,...] "
+		"[-q threads] [-f]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	char sched_defaults[] = "sio", contig_defaults[] = "1,8,32";
+	char *sched_list = sched_defaults, *contig_list = contig_defaults;
+	char *scheds[MAX_LIST], *contigs[MAX_LIST], *p;
+	unsigned int nscheds, ncontigs, threads = 16, streams = 2, i, j;
+	const char *input = NULL;
+	size_t count = 100000;
+	uint32_t *lat;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:i:w:n:e:c:q:f")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'w':
+			streams = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			sched_list = optarg;
+			break;
+		case 'c':
+			contig_list = optarg;
+			break;
+		case 'q':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			full_speed = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!device || !streams || !count || !threads ||
+	    threads > MAX_THREADS)
+		usage();
+	nscheds = split(sched_list, scheds);
+	ncontigs = split(contig_list, contigs);
+	if (!nscheds || !ncontigs)
+		usage();
+
+	/* /dev/block/loop0 -> loop0, for the sysfs queue attributes */
+	p = strrchr(device, '/');
+	snprintf(disk, sizeof(disk), "%s", p ? p + 1 : device);
+
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0)
+		die(device);
+	if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0)
+		die("BLKGETSIZE64");
+	if (ioctl(fd, BLKSSZGET, &sector_size) < 0)
+		die("BLKSSZGET");
+	if (dev_size < 2 * MAX_IO * streams) {
+		fprintf(stderr, "sio-replay: %s is too small\n", device);
+		exit(1);
+	}
+
+	if (input)
+		load_trace(input);
+	else
+		synth_trace(streams, count);
+
+	lat = malloc(nr_ios * sizeof(uint32_t));
+	if (!lat)
+		die("malloc");
+
+	printf("%zu I/Os, %u threads%s\n", nr_ios, threads,
+	       full_speed ? ", full speed" : "");
+	printf("sched        contig      IOPS     MB/s   avg_us   p50_us   p99_us"
+	       "    max_us\n");
+	for (i = 0; i < nscheds; i++) {
+		if (sysfs_write("scheduler", scheds[i])) {
+			fprintf(stderr, "sio-replay: cannot select %s\n",
+				scheds[i]);
+			continue;
+		}
+		for (j = 0; j < ncontigs; j++) {
+			const char *contig = contigs[j];
+
+			if (sysfs_write("iosched/contig_batch", contig)) {
+				/* not SIO: one run is enough */
+				run_replay(scheds[i], "-", threads, lat);
+				break;
+			}
+			run_replay(scheds[i], contig, threads, lat);
+		}
+	}
+
+	free(lat);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * logger-bench -- Android logger write throughput and latency as the
+ * number of concurrent writer threads grows.
+ *
+ * Each writer thread makes -n writev() calls of a -s byte message to the
+ * log device, in the same priority/tag/message layout liblog uses. Run it
+ * once for each thread count in -t, on a kernel with and without staged
+ * writes, with nothing else logging heavily:
+ *
+ *	make -C tools/logger CC=arm-linux-androideabi-gcc
+ *	logger-bench -d /dev/log/main -t 1,2,4,8 -n 100000 -s 64
+ *
+ * For each thread count it prints the aggregate writes per second over
+ * the window in which the writers ran, and the distribution of writev()
+ * latencies across all threads. Pin it with taskset to compare writers
+ * sharing a cpu against writers spread over several.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define MAX_THREADS	64
+#define MAX_PAYLOAD	4000
+
+struct writer {
+	pthread_t thread;
+	uint64_t start, end;
+	uint32_t *lat;		/* ns, one per write */
+};
+
+static const char *device = "/dev/log/main";
+static unsigned int iterations = 10000;
+static unsigned int payload = 64;
+static pthread_barrier_t barrier;
+static int fd;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *writer_main(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char prio = 4;	/* ANDROID_LOG_INFO */
+	char tag[] = "logger-bench";
+	char msg[MAX_PAYLOAD];
+	struct iovec iov[3];
+	unsigned int i;
+
+	memset(msg, 'x', payload);
+	msg[payload - 1] = '\0';
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = payload;
+
+	pthread_barrier_wait(&barrier);
+
+	w->start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		uint64_t t = now_ns();
+
+		while (writev(fd, iov, 3) < 0)
+			if (errno != EINTR)
+				die("writev");
+		w->lat[i] = now_ns() - t;
+	}
+	w->end = now_ns();
+
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run_round(unsigned int threads, uint32_t *lat)
+{
+	size_t n = (size_t)threads * iterations, k;
+	uint64_t start = UINT64_MAX, end = 0, sum = 0;
+	struct writer w[MAX_THREADS];
+	unsigned int i;
+	int err;
+
+	if (pthread_barrier_init(&barrier, NULL, threads))
+		die("pthread_barrier_init");
+
+	for (i = 0; i < threads; i++) {
+		w[i].lat = lat + (size_t)i * iterations;
+		err = pthread_create(&w[i].thread, NULL, writer_main, &w[i]);
+		if (err) {
+			errno = err;
+			die("pthread_create");
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		if (w[i].start < start)
+			start = w[i].start;
+		if (w[i].end > end)
+			end = w[i].end;
+	}
+	pthread_barrier_destroy(&barrier);
+
+	for (k = 0; k < n; k++)
+		sum += lat[k];
+	qsort(lat, n, sizeof(uint32_t), cmp_u32);
+
+	printf("%7u %10.0f %8.2f %8.2f %8.2f %8.2f %8.1f\n", threads,
+	       n * 1e9 / (end - start),
+	       sum / 1e3 / n,
+	       lat[n / 2] / 1e3,
+	       lat[n * 90 / 100] / 1e3,
+	       lat[n * 99 / 100] / 1e3,
+	       lat[n - 1] / 1e3);
+	fflush(stdout);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: logger-bench [-d device] [-t threads,...] "
+		"[-n iterations] [-s bytes]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int counts[MAX_THREADS], ncounts = 0, max = 0, i;
+	char defaults[] = "1,2,4,8", *list = defaults, *s;
+	uint32_t *lat;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:n:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			list = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!iterations || !payload || payload > MAX_PAYLOAD)
+		usage();
+
+	for (s = strtok(list, ","); s; s = strtok(NULL, ",")) {
+		unsigned int t = strtoul(s, NULL, 0);
+
+		if (!t || t > MAX_THREADS || ncounts == MAX_THREADS)
+			usage();
+		counts[ncounts++] = t;
+		if (t > max)
+			max = t;
+	}
+	if (!ncounts)
+		usage();
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0)
+		die(device);
+
+	lat = malloc(sizeof(uint32_t) * max * iterations);
+	if (!lat)
+		die("malloc");
+
+	printf("%u-byte messages, %u writes per thread\n", payload,
+	       iterations);
+	printf("threads  writes/s   avg_us   p50_us   p90_us   p99_us   max_us\n");
+	for (i = 0; i < ncounts; i++)
+		run_round(counts[i], lat);
+
+	free(lat);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * lmk-bench -- cost of the low memory killer's victim selection under a
+ * memory storm, with the linear task list scan and with batch_kill.
+ *
+ * It forks -n victim processes, each touching -m MB of anonymous memory,
+ * with oom_score_adj spread evenly from 100 to 1000 so they land in many
+ * different buckets of the adj index. -i idle processes with
+ * oom_score_adj -1000 are added to lengthen the task list the linear scan
+ * has to walk. The parent then protects itself (oom_score_adj -1000) and
+ * allocates memory in -s MB steps until -k victims have been killed or
+ * -a MB have been allocated, releases everything and reaps the victims.
+ *
+ * Each storm is run with batch_kill off and then on, through
+ * /sys/module/lowmemorykiller/parameters/batch_kill, and the difference of
+ * /sys/kernel/debug/lowmemorykiller/stats over the storm is reported:
+ *
+ *	make -C tools/lowmemorykiller CC=arm-linux-androideabi-gcc
+ *	lmk-bench -n 32 -m 32 -i 500 -k 16
+ *
+ * This needs root, debugfs mounted on /sys/kernel/debug, a kernel with
+ * CONFIG_ANDROID_LMK_ADJ_INDEX and minfree levels that the storm can
+ * reach before the OOM killer runs. It does kill processes. Swap or zram
+ * slow the storm down and make the runs harder to compare; disable them.
+ * scan_time_ns_max is the maximum since the driver was loaded, so for a
+ * clean per-mode figure run each mode from a fresh boot with -b.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#define MB		(1 << 20)
+#define MAX_VICTIMS	1024
+#define MAX_IDLE	8192
+#define MAX_STEPS	16384
+
+#define STATS		"/sys/kernel/debug/lowmemorykiller/stats"
+#define BATCH_KILL	"/sys/module/lowmemorykiller/parameters/batch_kill"
+
+struct lmk_stats {
+	unsigned long long scans;
+	unsigned long long scan_ns;
+	unsigned long long scan_ns_max;
+	unsigned long long kill_events;
+	unsigned long long kills;
+	unsigned long long kills_max;
+	unsigned long long suppressed;
+};
+
+static unsigned int victims = 32, victim_mb = 32, idle, kill_target;
+static unsigned int step_mb = 4, storm_mb = 4096;
+static pid_t victim_pid[MAX_VICTIMS], idle_pid[MAX_IDLE];
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_str(const char *path, const char *val)
+{
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -1;
+	close(fd);
+	return ret;
+}
+
+static void set_adj(int adj)
+{
+	char val[16];
+
+	snprintf(val, sizeof(val), "%d", adj);
+	if (write_str("/proc/self/oom_score_adj", val))
+		die("oom_score_adj");
+}
+
+static void read_stats(struct lmk_stats *st)
+{
+	char key[64];
+	unsigned long long val;
+	FILE *f;
+
+	memset(st, 0, sizeof(*st));
+	f = fopen(STATS, "r");
+	if (!f)
+		die(STATS);
+	while (fscanf(f, "%63[^:]: %llu\n", key, &val) == 2) {
+		if (!strcmp(key, "scans"))
+			st->scans = val;
+		else if (!strcmp(key, "scan_time_ns_total"))
+			st->scan_ns = val;
+		else if (!strcmp(key, "scan_time_ns_max"))
+			st->scan_ns_max = val;
+		else if (!strcmp(key, "kill_events"))
+			st->kill_events = val;
+		else if (!strcmp(key, "kills"))
+			st->kills = val;
+		else if (!strcmp(key, "kills_per_event_max"))
+			st->kills_max = val;
+		else if (!strcmp(key, "suppressed"))
+			st->suppressed = val;
+	}
+	fclose(f);
+}
+
+static void touch(char *p, size_t len)
+{
+	size_t i;
+
+	/* non-zero, so no zero page or KSM sharing */
+	for (i = 0; i < len; i += 4096)
+		p[i] = 1 + (i >> 12) % 255;
+}
+
+/* Touch 'mb' MB, tell the parent through 'ready' and wait to be killed */
+static pid_t spawn(int adj, unsigned int mb)
+{
+	int ready[2];
+	pid_t pid;
+	char c = 0;
+
+	if (pipe(ready))
+		die("pipe");
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid) {
+		close(ready[0]);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		set_adj(adj);
+		if (mb) {
+			char *p = mmap(NULL, (size_t)mb * MB,
+				       PROT_READ | PROT_WRITE,
+				       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (p == MAP_FAILED)
+				die("mmap");
+			touch(p, (size_t)mb * MB);
+		}
+		if (write(ready[1], &c, 1) != 1)
+			die("write");
+		close(ready[1]);
+		for (;;)
+			pause();
+	}
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "lmk-bench: child %d did not start\n", pid);
+		exit(1);
+	}
+	close(ready[0]);
+	return pid;
+}
+
+/* Reap victims that died, return how many are gone in total */
+static unsigned int reap(unsigned int *dead)
+{
+	unsigned int i;
+
+	for (i = 0; i < victims; i++) {
+		if (victim_pid[i] &&
+		    waitpid(victim_pid[i], NULL, WNOHANG) == victim_pid[i]) {
+			victim_pid[i] = 0;
+			(*dead)++;
+		}
+	}
+	return *dead;
+}
+
+static void run_storm(const char *mode)
+{
+	static char *steps[MAX_STEPS];
+	struct lmk_stats before, after;
+	unsigned int i, nsteps = 0, dead = 0;
+	uint64_t start, last_kill = 0;
+	unsigned long long kills;
+
+	for (i = 0; i < victims; i++)
+		victim_pid[i] = spawn(100 + i * 900 / victims, victim_mb);
+
+	read_stats(&before);
+	start = now_ns();
+	while (reap(&dead) < kill_target &&
+	       nsteps < storm_mb / step_mb && nsteps < MAX_STEPS) {
+		unsigned int prev = dead;
+		char *p = mmap(NULL, (size_t)step_mb * MB,
+			       PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED)
+			break;
+		touch(p, (size_t)step_mb * MB);
+		steps[nsteps++] = p;
+		if (reap(&dead) != prev)
+			last_kill = now_ns();
+	}
+	/* kills selected during the last step may still be in flight */
+	i = dead;
+	usleep(500000);
+	if (reap(&dead) != i)
+		last_kill = now_ns();
+	read_stats(&after);
+
+	for (i = 0; i < nsteps; i++)
+		munmap(steps[i], (size_t)step_mb * MB);
+	for (i = 0; i < victims; i++) {
+		if (victim_pid[i]) {
+			kill(victim_pid[i], SIGKILL);
+			waitpid(victim_pid[i], NULL, 0);
+			victim_pid[i] = 0;
+		}
+	}
+
+	kills = after.kills - before.kills;
+	printf("%-7s %6u %6u %7llu %10.1f %10.1f %7llu %6llu %8.2f %7llu"
+	       " %10llu %9.1f\n", mode, nsteps * step_mb, dead,
+	       after.scans - before.scans,
+	       after.scans - before.scans ?
+	       (after.scan_ns - before.scan_ns) / 1e3 /
+	       (after.scans - before.scans) : 0.0,
+	       after.scan_ns_max / 1e3,
+	       after.kill_events - before.kill_events, kills,
+	       after.kill_events - before.kill_events ?
+	       (double)kills / (after.kill_events - before.kill_events) : 0.0,
+	       after.kills_max,
+	       after.suppressed - before.suppressed,
+	       last_kill ? (last_kill - start) / 1e6 : 0.0);
+	fflush(stdout);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: lmk-bench [-n victims] [-m victim_MB] [-i idle] "
+		"[-k kills] [-s step_MB] [-a storm_MB] [-b 0|1]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, mode, only = -1;
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "n:m:i:k:s:a:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			victims = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			victim_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			kill_target = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			step_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			storm_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			only = !!strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!kill_target)
+		kill_target = victims / 2;
+	if (!victims || victims > MAX_VICTIMS || idle > MAX_IDLE ||
+	    !victim_mb || !step_mb || !storm_mb ||
+	    !kill_target || kill_target > victims)
+		usage();
+
+	set_adj(-1000);
+	for (i = 0; i < idle; i++)
+		idle_pid[i] = spawn(-1000, 0);
+
+	printf("%u victims of %u MB, %u idle tasks, %u MB steps\n",
+	       victims, victim_mb, idle, step_mb);
+	printf("mode    storm_mb killed   scans avg_scan_us max_scan_us"
+	       "  events  kills kills/evt max/evt suppressed  storm_ms\n");
+	for (mode = 0; mode < 2; mode++) {
+		if (only >= 0 && mode != only)
+			continue;
+		if (write_str(BATCH_KILL, mode ? "1" : "0"))
+			die(BATCH_KILL);
+		run_storm(mode ? "batch" : "linear");
+		/* let the page allocator settle before the next storm */
+		sleep(2);
+	}
+
+	for (i = 0; i < idle; i++) {
+		kill(idle_pid[i], SIGKILL);
+		waitpid(idle_pid[i], NULL, 0);
+	}
+	return 0;
+}
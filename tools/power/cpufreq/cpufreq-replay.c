@@ -0,0 +1,667 @@
+/*
+ * cpufreq-replay -- replay a recorded cpufreq governor load trace through
+ * models of the in-kernel governors and compare them.
+ *
+ * Record on the device with
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/cpufreq_governor/enable
+ *	... run the workload ...
+ *	cat /sys/kernel/debug/tracing/trace > trace.txt
+ *
+ * and replay on any host with
+ *
+ *	cpufreq-replay -f 350000,700000,920000,1200000 trace.txt
+ *
+ * Every cpufreq_governor_load event gives the busy percentage at the
+ * frequency the cpu was running, which is turned into a demand in kHz.
+ * Each governor model is fed that demand, one sample per recorded sample,
+ * and accounted:
+ *
+ *	energy	sum of (freq / max_freq)^2 * time, in seconds at max freq
+ *	trans	number of frequency changes
+ *	short	time during which the demand exceeded the frequency
+ *	to_max	for each burst, an idle sample followed by a busy one, the
+ *		time from the load arriving until max_freq was chosen:
+ *		average, worst, and bursts that ended before reaching it
+ *
+ * The "recorded" row accounts for what the traced governor actually did.
+ * A recorded load of 100% only tells that the demand was at least the
+ * frequency it ran at, so demand is a lower bound on saturated samples.
+ *
+ * The models follow the decision logic of the governors in
+ * drivers/cpufreq with their default tunables, which can be changed with
+ * -t name=value. Keep them in sync when changing a governor.
+ *
+ * "interactive+hints" is the interactive model with the scheduler load
+ * hints of CONFIG_SCHED_FREQ_HINTS: at the start of a burst it takes an
+ * extra sample of a fully busy cpu once the hint timer expires, between
+ * usecs_to_jiffies(1ms) and one tick more after the load arrived (half a
+ * tick more on average, at interactive.hz), instead of waiting for the
+ * end of the recorded sample. The load is taken to arrive at the end of
+ * the busy sample, as late as its load allows, and the samples after the
+ * hint stay at their recorded times rather than restarting timer_rate.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_FREQS	32
+#define MAX_CPUS	8
+
+/* a burst is a sample at or above BUSY load following one at or below IDLE */
+#define BURST_IDLE_LOAD	10
+#define BURST_BUSY_LOAD	90
+
+struct sample {
+	double time;		/* seconds */
+	unsigned int load;	/* percent of cur */
+	unsigned int cur;	/* kHz */
+};
+
+struct trace {
+	struct sample *samples;
+	unsigned int nr, alloc;
+};
+
+static struct trace traces[MAX_CPUS];
+static char recorded_governor[32] = "?";
+static unsigned int recorded_hotplug;
+
+static unsigned int freqs[MAX_FREQS] = { 350000, 700000, 920000, 1200000 };
+static unsigned int nr_freqs = 4;
+#define min_freq	(freqs[0])
+#define max_freq	(freqs[nr_freqs - 1])
+
+/* governor tunables, defaults as in drivers/cpufreq */
+static struct tunable {
+	const char *name;
+	unsigned int val;
+} tunables[] = {
+#define T_OD_UP			0
+	{ "ondemand.up_threshold", 65 },
+#define T_OD_DIFF		1
+	{ "ondemand.down_differential", 10 },
+#define T_CS_UP			2
+	{ "conservative.up_threshold", 75 },
+#define T_CS_DOWN		3
+	{ "conservative.down_threshold", 20 },
+#define T_CS_STEP		4
+	{ "conservative.freq_step", 5 },
+#define T_HP_UP			5
+	{ "hotplug.up_threshold", 80 },
+#define T_HP_DIFF		6
+	{ "hotplug.down_differential", 10 },
+#define T_IA_HISPEED		7
+	{ "interactive.hispeed_freq", 0 },	/* 0: max_freq */
+#define T_IA_GO_HISPEED		8
+	{ "interactive.go_hispeed_load", 85 },
+#define T_IA_MIN_SAMPLE		9
+	{ "interactive.min_sample_time", 80000 },	/* usec */
+#define T_IA_ABOVE_DELAY	10
+	{ "interactive.above_hispeed_delay", 20000 },	/* usec */
+#define T_IA_HZ			11
+	{ "interactive.hz", 100 },	/* tick rate, for the hint timer */
+	/* with micro idle accounting, as cpufreq_gov_dbs_init() sets them */
+#define T_ID_UP			12
+	{ "intellidemand.up_threshold", 75 },
+#define T_ID_DIFF		13
+	{ "intellidemand.down_differential", 3 },
+#define T_IX_HISPEED		14
+	{ "intelliactive.hispeed_freq", 0 },	/* 0: max_freq */
+#define T_IX_GO_HISPEED		15
+	{ "intelliactive.go_hispeed_load", 99 },
+#define T_IX_TARGET_LOAD	16
+	{ "intelliactive.target_load", 90 },
+#define T_IX_MIN_SAMPLE		17
+	{ "intelliactive.min_sample_time", 80000 },	/* usec */
+#define T_IX_ABOVE_DELAY	18
+	{ "intelliactive.above_hispeed_delay", 20000 },	/* usec */
+#define T_IX_TWO_PHASE		19
+	{ "intelliactive.two_phase_freq", 1060000 },	/* 0: off */
+};
+#define TUN(i)	(tunables[i].val)
+
+/* lowest table frequency >= target, else the highest */
+static unsigned int freq_l(unsigned int target)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_freqs; i++)
+		if (freqs[i] >= target)
+			return freqs[i];
+	return max_freq;
+}
+
+/* highest table frequency <= target, else the lowest */
+static unsigned int freq_h(unsigned int target)
+{
+	unsigned int i;
+
+	for (i = nr_freqs; i > 0; i--)
+		if (freqs[i - 1] <= target)
+			return freqs[i - 1];
+	return min_freq;
+}
+
+/*
+ * Governor models. Each gets the load seen at the current frequency over
+ * the last sample and returns the next frequency.
+ */
+struct model_state {
+	unsigned int cur;
+	unsigned int requested;		/* conservative */
+	double now;
+	double floor_validate;		/* interactive, intelliactive */
+	unsigned int floor_freq;
+	double hispeed_validate;
+	unsigned int counter;		/* intelliactive */
+	int phase;
+};
+
+static unsigned int model_ondemand(struct model_state *st, unsigned int load)
+{
+	unsigned int up = TUN(T_OD_UP), diff = TUN(T_OD_DIFF);
+
+	if (load > up)
+		return max_freq;
+	if (st->cur > min_freq && load < up - diff) {
+		unsigned int next = load * st->cur / (up - diff);
+		return freq_l(next < min_freq ? min_freq : next);
+	}
+	return st->cur;
+}
+
+static unsigned int model_conservative(struct model_state *st,
+				       unsigned int load)
+{
+	unsigned int step = TUN(T_CS_STEP) * max_freq / 100;
+
+	if (!step)
+		return st->cur;
+
+	if (load > TUN(T_CS_UP)) {
+		st->requested += step;
+		if (st->requested > max_freq)
+			st->requested = max_freq;
+		return freq_h(st->requested);
+	}
+	if (TUN(T_CS_DOWN) > 10 && load < TUN(T_CS_DOWN) - 10) {
+		st->requested = st->requested > min_freq + step ?
+				st->requested - step : min_freq;
+		if (st->cur == min_freq)
+			return st->cur;
+		return freq_h(st->requested);
+	}
+	return st->cur;
+}
+
+static unsigned int model_hotplug(struct model_state *st, unsigned int load)
+{
+	unsigned int up = TUN(T_HP_UP), diff = TUN(T_HP_DIFF);
+
+	if (load > up)
+		return max_freq;
+	if (st->cur > min_freq && load < up - diff) {
+		unsigned int next = load * st->cur / (up - diff);
+		return freq_l(next < min_freq ? min_freq : next);
+	}
+	return st->cur;
+}
+
+static unsigned int model_interactive(struct model_state *st,
+				      unsigned int load)
+{
+	unsigned int hispeed = TUN(T_IA_HISPEED) ? TUN(T_IA_HISPEED) : max_freq;
+	unsigned int next;
+
+	if (load >= TUN(T_IA_GO_HISPEED)) {
+		if (st->cur < hispeed && hispeed < max_freq) {
+			next = hispeed;
+		} else {
+			next = max_freq * load / 100;
+			if (next < hispeed)
+				next = hispeed;
+			if (st->cur == hispeed && next > hispeed &&
+			    st->now - st->hispeed_validate <
+			    TUN(T_IA_ABOVE_DELAY) / 1e6)
+				return st->cur;
+		}
+	} else {
+		next = hispeed * load / 100;
+	}
+
+	if (next <= hispeed)
+		st->hispeed_validate = st->now;
+
+	next = freq_h(next);
+
+	if (next < st->floor_freq &&
+	    st->now - st->floor_validate < TUN(T_IA_MIN_SAMPLE) / 1e6)
+		return st->cur;
+
+	st->floor_freq = next;
+	st->floor_validate = st->now;
+	return next;
+}
+
+/*
+ * Only the single cpu path: the rules raising a cpu to sync_freq or
+ * optimal_freq when another cpu is busy need the other cpus' samples,
+ * which this per-cpu replay does not line up.
+ */
+static unsigned int model_intellidemand(struct model_state *st,
+					unsigned int load)
+{
+	unsigned int up = TUN(T_ID_UP), diff = TUN(T_ID_DIFF);
+
+	if (load > up)
+		return max_freq;
+	if (st->cur > min_freq && load < up - diff) {
+		unsigned int next = load * st->cur / (up - diff);
+		return freq_l(next < min_freq ? min_freq : next);
+	}
+	return st->cur;
+}
+
+/*
+ * Single target load and no boost; the sync_freq rule for busy other
+ * cpus is left out as for intellidemand. The two phase counter is kept
+ * per cpu rather than shared by all of them.
+ */
+static unsigned int model_intelliactive(struct model_state *st,
+					unsigned int load)
+{
+	unsigned int hispeed = TUN(T_IX_HISPEED) ? TUN(T_IX_HISPEED) : max_freq;
+	unsigned int two_phase = TUN(T_IX_TWO_PHASE);
+	unsigned int tl = TUN(T_IX_TARGET_LOAD) ? TUN(T_IX_TARGET_LOAD) : 1;
+	unsigned int loadadjfreq = load * st->cur;
+	unsigned int next;
+
+	if (st->counter < 5 && ++st->counter > 2)
+		st->phase = 1;
+
+	if (load >= TUN(T_IX_GO_HISPEED)) {
+		if (st->cur < hispeed) {
+			if (two_phase < st->cur)
+				st->phase = 1;
+			next = two_phase && !st->phase ? two_phase : hispeed;
+		} else {
+			next = freq_l(loadadjfreq / tl);
+			if (next < hispeed)
+				next = hispeed;
+		}
+	} else {
+		next = freq_l(loadadjfreq / tl);
+	}
+
+	if (st->counter && !--st->counter)
+		st->phase = 0;
+
+	if (st->cur >= hispeed && next > st->cur &&
+	    st->now - st->hispeed_validate <
+	    (TUN(T_IX_ABOVE_DELAY) > 1000 ?
+	     TUN(T_IX_ABOVE_DELAY) - 1000 : TUN(T_IX_ABOVE_DELAY)) / 1e6)
+		return st->cur;
+	st->hispeed_validate = st->now;
+
+	next = freq_l(next);
+
+	if (next < st->floor_freq &&
+	    st->now - st->floor_validate < TUN(T_IX_MIN_SAMPLE) / 1e6)
+		return st->cur;
+
+	st->floor_freq = next;
+	st->floor_validate = st->now;
+	return next;
+}
+
+static const struct model {
+	const char *name;
+	unsigned int (*next)(struct model_state *, unsigned int);
+	int hints;		/* evaluates on scheduler load hints */
+} models[] = {
+	{ "ondemand",		model_ondemand },
+	{ "conservative",	model_conservative },
+	{ "hotplug",		model_hotplug },
+	{ "interactive",	model_interactive },
+	{ "interactive+hints",	model_interactive, 1 },
+	{ "intellidemand",	model_intellidemand },
+	{ "intelliactive",	model_intelliactive },
+};
+#define NR_MODELS	(sizeof(models) / sizeof(models[0]))
+
+struct result {
+	double time, energy, shortfall;
+	unsigned long transitions;
+	unsigned long bursts, missed;	/* missed: burst ended below max */
+	double to_max, to_max_worst;
+	double arrival;			/* of the burst in progress, or < 0 */
+};
+
+static void account(struct result *r, unsigned int freq, double demand,
+		    double dt)
+{
+	double rel = (double)freq / max_freq;
+
+	r->time += dt;
+	r->energy += rel * rel * dt;
+	if (demand > freq)
+		r->shortfall += dt;
+}
+
+/*
+ * Time at which the burst starting with sample i arrived, or -1 if it
+ * does not start one: at the end of the sample, as late as its load
+ * allows.
+ */
+static double burst_arrival(struct trace *tr, unsigned int i)
+{
+	struct sample *s = &tr->samples[i], *prev = &tr->samples[i - 1];
+
+	if (prev->load > BURST_IDLE_LOAD || s->load < BURST_BUSY_LOAD)
+		return -1;
+	return s->time - (s->time - prev->time) * s->load / 100;
+}
+
+/* Start or end the burst in progress at sample i */
+static void burst_track(struct result *r, struct trace *tr, unsigned int i)
+{
+	double arrival = burst_arrival(tr, i);
+
+	if (r->arrival >= 0 &&
+	    (arrival >= 0 || tr->samples[i].load <= BURST_IDLE_LOAD)) {
+		/* idle again before reaching max */
+		r->missed++;
+		r->arrival = -1;
+	}
+	if (arrival >= 0) {
+		r->bursts++;
+		r->arrival = arrival;
+	}
+}
+
+/* freq runs from 'when' on */
+static void burst_freq(struct result *r, unsigned int freq, double when)
+{
+	double lat;
+
+	if (r->arrival < 0 || freq != max_freq)
+		return;
+	lat = when > r->arrival ? when - r->arrival : 0;
+	r->to_max += lat;
+	if (lat > r->to_max_worst)
+		r->to_max_worst = lat;
+	r->arrival = -1;
+}
+
+static void replay_recorded(struct trace *tr, struct result *r)
+{
+	unsigned int i;
+
+	r->arrival = -1;
+	for (i = 1; i < tr->nr; i++) {
+		struct sample *s = &tr->samples[i];
+		double demand = (double)s->load * s->cur / 100;
+
+		/* a saturated sample only bounds the demand from below */
+		account(r, s->cur, s->load >= 100 ? demand + 1 : demand,
+			s->time - tr->samples[i - 1].time);
+		if (s->cur != tr->samples[i - 1].cur)
+			r->transitions++;
+		burst_track(r, tr, i);
+		burst_freq(r, s->cur, tr->samples[i - 1].time);
+	}
+	if (r->arrival >= 0)
+		r->missed++;
+}
+
+/* Mean delay of a hint, see cpufreq_interactive_hint_expires() */
+static double hint_delay(void)
+{
+	double tick = 1.0 / (TUN(T_IA_HZ) ? TUN(T_IA_HZ) : 100);
+	unsigned int jiffies = (unsigned int)(1e-3 / tick + 0.999999);
+
+	return (jiffies + 0.5) * tick;
+}
+
+static void replay_model(const struct model *m, struct trace *tr,
+			 struct result *r)
+{
+	struct model_state st;
+	unsigned int i;
+
+	memset(&st, 0, sizeof(st));
+	st.cur = freq_l(tr->samples[0].cur);
+	st.requested = st.cur;
+	r->arrival = -1;
+
+	for (i = 1; i < tr->nr; i++) {
+		struct sample *s = &tr->samples[i];
+		double demand = (double)s->load * s->cur / 100;
+		double dt = s->time - tr->samples[i - 1].time;
+		double arrival = burst_arrival(tr, i);
+		unsigned int load, next;
+
+		burst_track(r, tr, i);
+		burst_freq(r, st.cur, arrival);
+		if (m->hints && arrival >= 0 && st.cur != max_freq &&
+		    arrival + hint_delay() < s->time) {
+			/* the hint cuts the sample short, fully busy */
+			double hint = arrival + hint_delay();
+
+			account(r, st.cur, demand, hint - tr->samples[i - 1].time);
+			dt = s->time - hint;
+			st.now = hint;
+			next = m->next(&st, 100);
+			if (next != st.cur)
+				r->transitions++;
+			st.cur = next;
+			burst_freq(r, st.cur, hint);
+		}
+
+		account(r, st.cur, demand, dt);
+
+		load = demand * 100 / st.cur;
+		if (load > 100)
+			load = 100;
+
+		st.now = s->time;
+		next = m->next(&st, load);
+		if (next != st.cur)
+			r->transitions++;
+		st.cur = next;
+		burst_freq(r, st.cur, s->time);
+	}
+	if (r->arrival >= 0)
+		r->missed++;
+}
+
+static void print_result(const char *name, struct result *r)
+{
+	if (r->time <= 0) {
+		printf("  %-18s (no samples)\n", name);
+		return;
+	}
+	printf("  %-18s %10.3f %8.1f%% %8lu %9.3f %6.1f%% %6lu", name,
+	       r->energy, 100 * r->energy / r->time, r->transitions,
+	       r->shortfall, 100 * r->shortfall / r->time, r->bursts);
+	if (r->bursts > r->missed)
+		printf(" %8.1f %8.1f", 1e3 * r->to_max /
+		       (r->bursts - r->missed), 1e3 * r->to_max_worst);
+	else
+		printf(" %8s %8s", "-", "-");
+	printf(" %6lu\n", r->missed);
+}
+
+/*
+ * Parse one line of ftrace text output. The timestamp is the last field
+ * before the event name, e.g.
+ *   kworker/0:1-12    [000]  1234.567890: cpufreq_governor_load: ...
+ */
+static int parse_time(const char *line, const char *event, double *time)
+{
+	const char *p = event;
+
+	/* skip back over ": " and the timestamp */
+	while (p > line && (p[-1] == ' ' || p[-1] == ':'))
+		p--;
+	while (p > line && p[-1] != ' ' && p[-1] != ']')
+		p--;
+	return sscanf(p, "%lf", time) == 1 ? 0 : -1;
+}
+
+static void add_sample(unsigned int cpu, struct sample *s)
+{
+	struct trace *tr = &traces[cpu];
+
+	if (tr->nr == tr->alloc) {
+		tr->alloc = tr->alloc ? tr->alloc * 2 : 1024;
+		tr->samples = realloc(tr->samples,
+				      tr->alloc * sizeof(*tr->samples));
+		if (!tr->samples) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	tr->samples[tr->nr++] = *s;
+}
+
+static void read_trace(FILE *f)
+{
+	char line[512], gov[32];
+	unsigned int cpu, online;
+	struct sample s;
+	char *ev;
+
+	while (fgets(line, sizeof(line), f)) {
+		if ((ev = strstr(line, "cpufreq_governor_load: "))) {
+			if (sscanf(ev, "cpufreq_governor_load: governor=%31s "
+				   "cpu=%u load=%u cur=%u", gov, &cpu, &s.load,
+				   &s.cur) != 4 || cpu >= MAX_CPUS || !s.cur)
+				continue;
+			if (parse_time(line, ev, &s.time))
+				continue;
+			strcpy(recorded_governor, gov);
+			add_sample(cpu, &s);
+		} else if ((ev = strstr(line, "cpufreq_governor_hotplug: "))) {
+			if (sscanf(ev, "cpufreq_governor_hotplug: governor=%31s "
+				   "cpu=%u online=%u", gov, &cpu, &online) == 3)
+				recorded_hotplug++;
+		}
+	}
+}
+
+static int parse_freqs(char *arg)
+{
+	char *tok;
+
+	nr_freqs = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		unsigned int f = strtoul(tok, NULL, 10);
+
+		if (!f || nr_freqs == MAX_FREQS ||
+		    (nr_freqs && f <= freqs[nr_freqs - 1]))
+			return -1;
+		freqs[nr_freqs++] = f;
+	}
+	return nr_freqs ? 0 : -1;
+}
+
+static int parse_tunable(const char *arg)
+{
+	unsigned int i;
+	size_t len;
+	const char *eq = strchr(arg, '=');
+
+	if (!eq)
+		return -1;
+	len = eq - arg;
+	for (i = 0; i < sizeof(tunables) / sizeof(tunables[0]); i++) {
+		if (strlen(tunables[i].name) == len &&
+		    !strncmp(tunables[i].name, arg, len)) {
+			tunables[i].val = strtoul(eq + 1, NULL, 10);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static void usage(void)
+{
+	unsigned int i;
+
+	fprintf(stderr, "usage: cpufreq-replay [-f freq,freq,...] "
+		"[-t governor.tunable=value]... [trace]\n"
+		"  -f  ascending frequency table in kHz\n"
+		"  -t  override a model tunable:\n");
+	for (i = 0; i < sizeof(tunables) / sizeof(tunables[0]); i++)
+		fprintf(stderr, "        %s (%u)\n", tunables[i].name,
+			tunables[i].val);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int cpu, i;
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:t:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (parse_freqs(optarg))
+				usage();
+			break;
+		case 't':
+			if (parse_tunable(optarg))
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind < argc && strcmp(argv[optind], "-")) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	read_trace(f);
+
+	printf("recorded with %s, %u hotplug decisions\n", recorded_governor,
+	       recorded_hotplug);
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		struct trace *tr = &traces[cpu];
+		struct result r;
+
+		if (tr->nr < 2)
+			continue;
+
+		printf("cpu%u: %u samples over %.3fs\n", cpu, tr->nr,
+		       tr->samples[tr->nr - 1].time - tr->samples[0].time);
+		printf("  %-18s %10s %9s %8s %9s %7s %6s %8s %8s %6s\n",
+		       "governor", "energy", "of max", "trans", "short(s)",
+		       "short", "bursts", "to_max", "worst", "missed");
+
+		memset(&r, 0, sizeof(r));
+		replay_recorded(tr, &r);
+		print_result("recorded", &r);
+
+		for (i = 0; i < NR_MODELS; i++) {
+			memset(&r, 0, sizeof(r));
+			replay_model(&models[i], tr, &r);
+			print_result(models[i].name, &r);
+		}
+	}
+
+	return 0;
+}
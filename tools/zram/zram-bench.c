@@ -0,0 +1,351 @@
+/*
+ * zram-bench -- zram write throughput and latency with the inline and the
+ * parallel write path.
+ *
+ * Swap-out writes single pages, or short runs of them, to scattered
+ * slots. Each writer thread does the same: -n O_DIRECT writes of -b
+ * bytes to random page-aligned offsets of the device, with contents that
+ * compress to about -c percent of their size and are refilled for every
+ * write, so neither same-page detection nor dedup can skip the work.
+ *
+ * Given a disksize with -s, the device is set up from scratch for each
+ * write mode in turn (reset, parallel_write, disksize) and both modes are
+ * reported side by side; this needs root and destroys the device content:
+ *
+ *	make -C tools/zram CC=arm-linux-androideabi-gcc
+ *	zram-bench -d zram0 -s 256M -t 1,2,4 -n 20000
+ *
+ * Without -s the device is used as already configured and only that mode
+ * is measured.
+ *
+ * For each thread count it prints the aggregate MB/s over the window in
+ * which the writers ran, the distribution of write latencies across all
+ * threads, and how many times writers were throttled on full worker
+ * queues (write_stalls).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define PAGE_SZ		4096
+#define MAX_THREADS	64
+#define MAX_BLOCK	(128 * 1024)
+
+struct writer {
+	pthread_t thread;
+	uint64_t seed;
+	uint64_t start, end;
+	uint32_t *lat;		/* ns, one per write */
+};
+
+static const char *name = "zram0";
+static char device[64];
+static unsigned int iterations = 10000;
+static unsigned int block = PAGE_SZ;
+static unsigned int compress = 50;
+static uint64_t disksize, pages;
+static pthread_barrier_t barrier;
+static int fd;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+static int sysfs_write(const char *attr, const char *val)
+{
+	char path[128];
+	int sfd, ret = 0;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr);
+	sfd = open(path, O_WRONLY);
+	if (sfd < 0)
+		return -1;
+	if (write(sfd, val, strlen(val)) < 0)
+		ret = -1;
+	close(sfd);
+	return ret;
+}
+
+static long long sysfs_read(const char *attr)
+{
+	char path[128], buf[32];
+	long long val = -1;
+	int sfd, n;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr);
+	sfd = open(path, O_RDONLY);
+	if (sfd < 0)
+		return -1;
+	n = read(sfd, buf, sizeof(buf) - 1);
+	if (n > 0) {
+		buf[n] = '\0';
+		val = strtoll(buf, NULL, 0);
+	}
+	close(sfd);
+	return val;
+}
+
+/* The first 'compress' percent of each page is random, the rest zero */
+static void fill(unsigned char *buf, uint64_t *seed)
+{
+	unsigned int off, i, rnd = PAGE_SZ * compress / 100;
+
+	for (off = 0; off < block; off += PAGE_SZ) {
+		for (i = 0; i + 8 <= rnd; i += 8) {
+			uint64_t v = xorshift(seed);
+
+			memcpy(buf + off + i, &v, 8);
+		}
+		memset(buf + off + i, 0, PAGE_SZ - i);
+	}
+}
+
+static void *writer_main(void *arg)
+{
+	struct writer *w = arg;
+	uint64_t span = pages - block / PAGE_SZ + 1;
+	unsigned char *buf;
+	unsigned int i;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, block))
+		die("posix_memalign");
+
+	pthread_barrier_wait(&barrier);
+
+	w->start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		off_t off = (off_t)(xorshift(&w->seed) % span) * PAGE_SZ;
+		uint64_t t;
+
+		fill(buf, &w->seed);
+		t = now_ns();
+		if (pwrite(fd, buf, block, off) != block)
+			die("pwrite");
+		w->lat[i] = now_ns() - t;
+	}
+	w->end = now_ns();
+
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run_round(const char *mode, unsigned int threads, uint32_t *lat)
+{
+	size_t n = (size_t)threads * iterations, k;
+	uint64_t start = UINT64_MAX, end = 0, sum = 0;
+	struct writer w[MAX_THREADS];
+	long long stalls;
+	unsigned int i;
+	int err;
+
+	stalls = sysfs_read("write_stalls");
+	if (pthread_barrier_init(&barrier, NULL, threads))
+		die("pthread_barrier_init");
+
+	for (i = 0; i < threads; i++) {
+		w[i].seed = 0x9e3779b97f4a7c15ull * (i + 1) + now_ns();
+		w[i].lat = lat + (size_t)i * iterations;
+		err = pthread_create(&w[i].thread, NULL, writer_main, &w[i]);
+		if (err) {
+			errno = err;
+			die("pthread_create");
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		if (w[i].start < start)
+			start = w[i].start;
+		if (w[i].end > end)
+			end = w[i].end;
+	}
+	pthread_barrier_destroy(&barrier);
+	if (stalls >= 0)
+		stalls = sysfs_read("write_stalls") - stalls;
+
+	for (k = 0; k < n; k++)
+		sum += lat[k];
+	qsort(lat, n, sizeof(uint32_t), cmp_u32);
+
+	printf("%-8s %7u %8.1f %8.1f %8.1f %8.1f %8.1f", mode, threads,
+	       (double)n * block * 1e3 / (1 << 20) / ((end - start) / 1e6),
+	       sum / 1e3 / n,
+	       lat[n / 2] / 1e3,
+	       lat[n * 99 / 100] / 1e3,
+	       lat[n - 1] / 1e3);
+	if (stalls >= 0)
+		printf(" %9lld\n", stalls);
+	else
+		printf("         -\n");
+	fflush(stdout);
+}
+
+/* Set the device up from scratch in the given write mode */
+static void setup(int parallel)
+{
+	char val[32];
+
+	if (fd >= 0)
+		close(fd);
+	snprintf(val, sizeof(val), "%llu", (unsigned long long)disksize);
+	if (sysfs_write("reset", "1") ||
+	    sysfs_write("parallel_write", parallel ? "1" : "0") ||
+	    sysfs_write("disksize", val))
+		die("zram setup");
+	fd = open(device, O_WRONLY | O_DIRECT);
+	if (fd < 0)
+		die(device);
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'G': case 'g':
+		v <<= 10;
+	case 'M': case 'm':
+		v <<= 10;
+	case 'K': case 'k':
+		v <<= 10;
+	}
+	return v;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: zram-bench [-d zram<id>] [-s disksize] [-t threads,...] "
+		"[-n writes] [-b bytes] [-c percent]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int counts[MAX_THREADS], ncounts = 0, max = 0, i;
+	char defaults[] = "1,2,4", *list = defaults, *s;
+	uint32_t *lat;
+	int opt, mode, configure;
+
+	while ((opt = getopt(argc, argv, "d:s:t:n:b:c:")) != -1) {
+		switch (opt) {
+		case 'd':
+			name = optarg;
+			break;
+		case 's':
+			disksize = parse_size(optarg);
+			break;
+		case 't':
+			list = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			block = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			compress = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!iterations || !block || block % PAGE_SZ || block > MAX_BLOCK ||
+	    compress > 100 || strchr(name, '/'))
+		usage();
+
+	for (s = strtok(list, ","); s; s = strtok(NULL, ",")) {
+		unsigned int t = strtoul(s, NULL, 0);
+
+		if (!t || t > MAX_THREADS || ncounts == MAX_THREADS)
+			usage();
+		counts[ncounts++] = t;
+		if (t > max)
+			max = t;
+	}
+	if (!ncounts)
+		usage();
+
+	snprintf(device, sizeof(device), "/dev/%s", name);
+	fd = -1;
+	configure = disksize != 0;
+	if (!configure) {
+		fd = open(device, O_WRONLY | O_DIRECT);
+		if (fd < 0)
+			die(device);
+		if (ioctl(fd, BLKGETSIZE64, &disksize) < 0)
+			die("BLKGETSIZE64");
+	}
+	pages = disksize / PAGE_SZ;
+	if (pages < block / PAGE_SZ) {
+		fprintf(stderr, "zram-bench: %s is not initialized\n", device);
+		exit(1);
+	}
+
+	lat = malloc(sizeof(uint32_t) * max * iterations);
+	if (!lat)
+		die("malloc");
+
+	printf("%u-byte writes, ~%u%% compressed size, %u writes per thread\n",
+	       block, compress, iterations);
+	printf("mode     threads     MB/s   avg_us   p50_us   p99_us   max_us"
+	       "    stalls\n");
+	if (configure) {
+		for (mode = 0; mode < 2; mode++) {
+			setup(mode);
+			for (i = 0; i < ncounts; i++)
+				run_round(mode ? "parallel" : "inline",
+					  counts[i], lat);
+		}
+	} else {
+		mode = sysfs_read("parallel_write") > 0;
+		for (i = 0; i < ncounts; i++)
+			run_round(mode ? "parallel" : "inline", counts[i], lat);
+	}
+
+	free(lat);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * zram-compact-stress -- fragment a zram device's zsmalloc pool with
+ * random-sized objects and report what compaction gives back.
+ *
+ * The device is reset and set up with -s bytes. Every page is filled
+ * with a random prefix of random length followed by zeros, so the
+ * compressed objects land in size classes all over the pool. Each round
+ * then frees -f percent of the live pages at random, by overwriting them
+ * with zeros (zram stores zero pages as metadata only and frees their
+ * object), writes 1 to 'compact' and reports mem_used_total before and
+ * after, and the pool's pages_compacted from debugfs when it is mounted.
+ * Every live page is read back and compared after compaction, since
+ * compaction moves objects behind the handles. The freed pages are
+ * written with fresh content before the next round, so the pool keeps
+ * churning.
+ *
+ *	make -C tools/zram CC=arm-linux-androideabi-gcc
+ *	zram-compact-stress -d zram0 -s 64M -f 50 -r 10
+ *
+ * This needs root and destroys the content of the device. zsmalloc also
+ * compacts from its shrinker, so under memory pressure part of the gain
+ * can show up before the explicit compaction.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PAGE_SZ		4096
+
+static const char *name = "zram0";
+static char device[64];
+static uint64_t disksize = 64 << 20;
+static unsigned int free_pct = 50;
+static unsigned int rounds = 10;
+static uint32_t *gen;		/* content generation per page, 0 if freed */
+static uint64_t pages;
+static int fd;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+static int sysfs_write(const char *attr, const char *val)
+{
+	char path[128];
+	int sfd, ret = 0;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr);
+	sfd = open(path, O_WRONLY);
+	if (sfd < 0)
+		return -1;
+	if (write(sfd, val, strlen(val)) < 0)
+		ret = -1;
+	close(sfd);
+	return ret;
+}
+
+static long long read_ll(const char *path)
+{
+	char buf[32];
+	long long val = -1;
+	int sfd, n;
+
+	sfd = open(path, O_RDONLY);
+	if (sfd < 0)
+		return -1;
+	n = read(sfd, buf, sizeof(buf) - 1);
+	if (n > 0) {
+		buf[n] = '\0';
+		val = strtoll(buf, NULL, 0);
+	}
+	close(sfd);
+	return val;
+}
+
+static long long sysfs_read(const char *attr)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "/sys/block/%s/%s", name, attr);
+	return read_ll(path);
+}
+
+static long long pages_compacted(void)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path),
+		 "/sys/kernel/debug/zsmalloc/%s/pages_compacted", name);
+	return read_ll(path);
+}
+
+/* Page content is a function of its index and generation only */
+static void fill(unsigned char *buf, uint64_t index, uint32_t g)
+{
+	uint64_t seed = (index + 1) * 0x9e3779b97f4a7c15ull ^ g;
+	unsigned int i, len;
+
+	xorshift(&seed);
+	/* at least 8 random bytes, so the page is never all zeros */
+	len = 8 + (xorshift(&seed) % (PAGE_SZ - 8)) / 8 * 8;
+	for (i = 0; i < len; i += 8) {
+		uint64_t v = xorshift(&seed);
+
+		memcpy(buf + i, &v, 8);
+	}
+	memset(buf + len, 0, PAGE_SZ - len);
+}
+
+static void write_page(unsigned char *buf, uint64_t index)
+{
+	if (pwrite(fd, buf, PAGE_SZ, index * PAGE_SZ) != PAGE_SZ)
+		die("pwrite");
+}
+
+static uint64_t verify(unsigned char *buf, unsigned char *expect)
+{
+	uint64_t index, bad = 0;
+
+	for (index = 0; index < pages; index++) {
+		if (!gen[index])
+			continue;
+		if (pread(fd, buf, PAGE_SZ, index * PAGE_SZ) != PAGE_SZ)
+			die("pread");
+		fill(expect, index, gen[index]);
+		if (memcmp(buf, expect, PAGE_SZ)) {
+			if (!bad)
+				fprintf(stderr, "page %llu corrupted\n",
+					(unsigned long long)index);
+			bad++;
+		}
+	}
+	return bad;
+}
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch (*end) {
+	case 'G': case 'g':
+		v <<= 10;
+	case 'M': case 'm':
+		v <<= 10;
+	case 'K': case 'k':
+		v <<= 10;
+	}
+	return v;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: zram-compact-stress [-d zram<id>] [-s disksize] "
+		"[-f free_percent] [-r rounds]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *buf, *zero, *expect;
+	uint64_t seed = 0x2545f4914f6cdd1dull, index, live, bad = 0;
+	unsigned int round;
+	char val[32];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:f:r:")) != -1) {
+		switch (opt) {
+		case 'd':
+			name = optarg;
+			break;
+		case 's':
+			disksize = parse_size(optarg);
+			break;
+		case 'f':
+			free_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	pages = disksize / PAGE_SZ;
+	if (!pages || !free_pct || free_pct > 100 || !rounds ||
+	    strchr(name, '/'))
+		usage();
+
+	snprintf(device, sizeof(device), "/dev/%s", name);
+	snprintf(val, sizeof(val), "%llu", (unsigned long long)disksize);
+	if (sysfs_write("reset", "1") || sysfs_write("disksize", val))
+		die("zram setup");
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0)
+		die(device);
+
+	gen = calloc(pages, sizeof(*gen));
+	if (posix_memalign((void **)&buf, PAGE_SZ, PAGE_SZ) ||
+	    posix_memalign((void **)&zero, PAGE_SZ, PAGE_SZ) ||
+	    posix_memalign((void **)&expect, PAGE_SZ, PAGE_SZ) || !gen)
+		die("alloc");
+	memset(zero, 0, PAGE_SZ);
+
+	for (index = 0; index < pages; index++) {
+		gen[index] = 1;
+		fill(buf, index, gen[index]);
+		write_page(buf, index);
+	}
+
+	printf("%llu pages, freeing %u%% per round\n",
+	       (unsigned long long)pages, free_pct);
+	printf("round     live  before_kb  after_kb  reclaimed_kb"
+	       "  pages_compacted  bad\n");
+	for (round = 1; round <= rounds; round++) {
+		long long before, after, pc_before, pc_after;
+		uint64_t round_bad;
+
+		for (index = 0, live = 0; index < pages; index++) {
+			if (xorshift(&seed) % 100 < free_pct) {
+				gen[index] = 0;
+				write_page(zero, index);
+			} else {
+				live++;
+			}
+		}
+
+		pc_before = pages_compacted();
+		before = sysfs_read("mem_used_total");
+		if (sysfs_write("compact", "1"))
+			die("compact");
+		after = sysfs_read("mem_used_total");
+		pc_after = pages_compacted();
+
+		round_bad = verify(buf, expect);
+		bad += round_bad;
+
+		printf("%5u %8llu %10lld %9lld %13lld", round,
+		       (unsigned long long)live, before >> 10, after >> 10,
+		       (before - after) >> 10);
+		if (pc_before >= 0 && pc_after >= 0)
+			printf(" %16lld", pc_after - pc_before);
+		else
+			printf(" %16s", "-");
+		printf(" %4llu\n", (unsigned long long)round_bad);
+		fflush(stdout);
+
+		/* refill what was freed with new content */
+		for (index = 0; index < pages; index++) {
+			if (gen[index])
+				continue;
+			gen[index] = round + 1;
+			fill(buf, index, gen[index]);
+			write_page(buf, index);
+		}
+	}
+
+	close(fd);
+	return bad ? 1 : 0;
+}